@@ -0,0 +1,66 @@
+/* Benchmark for the channelizer's throughput, in millions of complex
+ * input samples per second (compare with the SDR's sample rate).
+ *
+ * Usage: bench_channelizer [CHANNELS [THREADS]] */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "spooky_channelizer.h"
+
+#define SAMPLES (1UL << 23)
+#define CHUNK 65536
+#define TAPS 8
+
+static unsigned long received = 0;
+
+static void rx_cb(uint16_t channel, uint8_t *data, uint8_t data_size,
+        void *udata) {
+    (void)channel; (void)data; (void)data_size; (void)udata;
+    received++;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv) {
+    uint16_t channels = (argc > 1 ? atoi(argv[1]) : 256);
+    uint8_t threads = (argc > 2 ? atoi(argv[2]) : 4);
+    static float iq[2 * CHUNK];
+
+    struct spooky_channelizer *ch = NULL;
+    struct spooky_channelizer_config cfg = {
+        .channels = channels, .taps = TAPS, .threads = threads,
+        .buffer_size = 32, .squelch = 0.5f, .cb = rx_cb,
+    };
+    if (spooky_channelizer_new(&cfg, &ch) != SPOOKY_CHANNELIZER_OK) {
+        fprintf(stderr, "bad config\n");
+        return 1;
+    }
+
+    /* Noise only: the decoders still run their header search. */
+    srand(1);
+    for (size_t i=0; i<2 * CHUNK; i++) {
+        iq[i] = (float)rand() / RAND_MAX - 0.5f;
+    }
+
+    double start = now();
+    for (unsigned long n=0; n<SAMPLES; n += CHUNK) {
+        if (spooky_channelizer_push(ch, iq, CHUNK) != SPOOKY_CHANNELIZER_OK) {
+            return 1;
+        }
+    }
+    double sec = now() - start;
+    spooky_channelizer_free(ch);
+
+    printf("channelizer: %u channels, %u taps, %u threads, %lu samples, "
+        "%.3f sec, %.2f MS/s\n", channels, TAPS, threads, SAMPLES, sec,
+        SAMPLES / sec / 1e6);
+    return 0;
+}
@@ -0,0 +1,279 @@
+/* Goodput sweep: sends frames through the channel model (spooky_sim.h)
+ * at a range of rates and impairment levels, and reports for each:
+ *
+ * - the line rate, in kbit/s;
+ * - the frame error rate (frames sent but not received intact);
+ * - the false accept rate (frames delivered with the wrong contents,
+ *   per frame sent);
+ * - goodput, in payload bytes/sec over the time on the air, including
+ *   the header, length, and checksum.
+ *
+ * Rates are for a receiver sampling at SAMPLE_HZ (the example rx
+ * project's 50 usec timer), with TX encoder ticks per half bit and OVER
+ * receiver samples per encoder tick.
+ *
+ * Usage: bench_goodput [-n FRAMES] [-p PAYLOAD] [-r SAMPLE_HZ]
+ *     [-c manchester|4b5b|diff] [BASELINE]
+ *
+ * -c picks the line code (see spooky_line_code.h).
+ *
+ * With BASELINE (saved output, e.g. goodput.txt), each point is
+ * compared against it, and it exits with 1 if any got worse. */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "spooky_encoder.h"
+#include "spooky_decoder.h"
+#include "spooky_filter.h"
+#include "spooky_sim.h"
+
+#define DEF_FRAMES 1000
+#define DEF_PAYLOAD 8
+#define DEF_SAMPLE_HZ 20000
+#define MAX_PAYLOAD 64
+#define MAX_SAMPLES (1UL << 16)
+
+/* Idle time between frames, in half bits. */
+#define GAP_HALF_BITS 32
+
+/* How much worse than the baseline counts as a regression. */
+#define FER_SLACK 0.02
+#define FAR_SLACK 0.005
+#define GOODPUT_SLACK 0.95
+
+struct profile {
+    const char *name;
+    struct spooky_sim_config sim;
+    uint8_t filter_window;      /* 0: no filter */
+    uint8_t filter_need;
+};
+
+static const struct profile profiles[] = {
+    { "clean", { .oversample = 1 }, 0, 0 },
+    { "mild", { .oversample = 1, .clock_skew = 0.01f, .jitter = 0.3f,
+                .asymmetry = 0.5f }, 0, 0 },
+    { "noisy", { .oversample = 1, .clock_skew = 0.02f, .jitter = 0.6f,
+                 .asymmetry = 1.0f, .spike_rate = 0.002f }, 3, 2 },
+    { "harsh", { .oversample = 1, .clock_skew = -0.03f, .jitter = 1.0f,
+                 .asymmetry = 1.5f, .spike_rate = 0.005f,
+                 .dropout_rate = 0.0002f, .dropout_length = 20 }, 3, 2 },
+};
+
+static const uint8_t tx_rates[] = { 1, 2, 3, 4, 6 };
+static enum spooky_line_code line_code = SPOOKY_LINE_MANCHESTER;
+static const float oversamples[] = { 2, 3, 4 };
+
+#define COUNT_OF(A) (sizeof(A) / sizeof(A[0]))
+
+struct point {
+    char profile[16];
+    unsigned tx_rate;
+    float oversample;
+    double kbps;
+    double fer;
+    double far;
+    double goodput;
+};
+
+struct rx_state {
+    const uint8_t *sent;
+    uint8_t size;
+    bool got;
+    unsigned long ok;
+    unsigned long false_accepts;
+};
+
+static void rx_cb(uint8_t *data, uint8_t data_size, void *udata) {
+    struct rx_state *rx = (struct rx_state *)udata;
+    if (!rx->got && data_size == rx->size
+        && 0 == memcmp(data, rx->sent, data_size)) {
+        rx->got = true;
+        rx->ok++;
+    } else {
+        rx->false_accepts++;
+    }
+}
+
+static bool run_point(const struct profile *p, uint8_t tx_rate,
+        float oversample, unsigned frames, uint8_t payload,
+        unsigned long sample_hz, struct point *res) {
+    static uint8_t samples[MAX_SAMPLES];
+    static uint8_t idle[GAP_HALF_BITS * 8];
+    uint8_t msg[MAX_PAYLOAD];
+    uint8_t enc_buf[MAX_PAYLOAD];
+    uint8_t dec_buf[MAX_PAYLOAD];
+    struct spooky_encoder enc;
+    struct spooky_decoder dec;
+    struct spooky_filter filter;
+    struct spooky_sim sim;
+
+    struct spooky_sim_config cfg = p->sim;
+    cfg.oversample = oversample;
+    cfg.seed = 1;
+    if (spooky_sim_init(&sim, &cfg) != SPOOKY_SIM_OK) { return false; }
+    if (p->filter_window > 0 && spooky_filter_init(&filter,
+            p->filter_window, p->filter_need) != SPOOKY_FILTER_INIT_OK) {
+        return false;
+    }
+    struct rx_state rx = { .sent = msg, .size = payload };
+    if (spooky_decoder_init(&dec, dec_buf, sizeof(dec_buf),
+            rx_cb, &rx) != SPOOKY_DECODER_INIT_OK
+        || spooky_decoder_set_line_code(&dec, line_code)
+        != SPOOKY_DECODER_INIT_OK) {
+        return false;
+    }
+
+    uint32_t rng = tx_rate;
+    unsigned long airtime = 0;
+    for (unsigned f=0; f<frames; f++) {
+        for (uint8_t i=0; i<payload; i++) {
+            msg[i] = spooky_sim_lcg(&rng) >> 24;
+        }
+        if (spooky_encoder_init(&enc, enc_buf, payload, tx_rate)
+            != SPOOKY_ENCODER_INIT_OK
+            || spooky_encoder_set_line_code(&enc, line_code)
+            != SPOOKY_ENCODER_INIT_OK) { return false; }
+        if (spooky_encoder_enqueue(&enc, msg, payload)
+            != SPOOKY_ENCODER_ENQUEUE_OK) { return false; }
+
+        size_t n = 0, idle_n = 0;
+        if (spooky_sim_encode(&sim, &enc, samples, MAX_SAMPLES, &n)
+            != SPOOKY_SIM_OK) { return false; }
+        airtime += n;
+        if (spooky_sim_run(&sim, idle, GAP_HALF_BITS * tx_rate,
+                &samples[n], MAX_SAMPLES - n, &idle_n) != SPOOKY_SIM_OK) {
+            return false;
+        }
+
+        rx.got = false;
+        for (size_t i=0; i<n + idle_n; i++) {
+            bool bit = samples[i];
+            if (p->filter_window > 0) {
+                bit = spooky_filter_step(&filter, bit);
+            }
+            (void)spooky_decoder_step(&dec, bit);
+        }
+    }
+
+    strncpy(res->profile, p->name, sizeof(res->profile) - 1);
+    res->profile[sizeof(res->profile) - 1] = '\0';
+    res->tx_rate = tx_rate;
+    res->oversample = oversample;
+    res->kbps = sample_hz / (2.0 * tx_rate * oversample) / 1000;
+    res->fer = 1 - (double)rx.ok / frames;
+    res->far = (double)rx.false_accepts / frames;
+    res->goodput = (double)rx.ok * payload * sample_hz / airtime;
+    return true;
+}
+
+static void print_point(FILE *out, const struct point *pt) {
+    fprintf(out, "%-8s %3u %5.2f %8.3f %7.4f %7.4f %9.1f\n",
+        pt->profile, pt->tx_rate, pt->oversample, pt->kbps,
+        pt->fer, pt->far, pt->goodput);
+}
+
+/* Compare PT against the matching line in BASELINE, if any. Returns
+ * false if it got worse. */
+static bool check_point(FILE *baseline, const struct point *pt) {
+    char line[256];
+    rewind(baseline);
+    while (fgets(line, sizeof(line), baseline)) {
+        struct point b;
+        if (line[0] == '#') { continue; }
+        if (sscanf(line, "%15s %u %f %lf %lf %lf %lf", b.profile,
+                &b.tx_rate, &b.oversample, &b.kbps, &b.fer, &b.far,
+                &b.goodput) != 7) {
+            continue;
+        }
+        if (strcmp(b.profile, pt->profile) != 0 || b.tx_rate != pt->tx_rate
+            || b.oversample != pt->oversample) {
+            continue;
+        }
+        if (pt->fer > b.fer + FER_SLACK || pt->far > b.far + FAR_SLACK
+            || pt->goodput < b.goodput * GOODPUT_SLACK) {
+            fprintf(stderr, "regression, was: ");
+            print_point(stderr, &b);
+            fprintf(stderr, "            now: ");
+            print_point(stderr, pt);
+            return false;
+        }
+        return true;
+    }
+    return true;                /* new point */
+}
+
+static void usage(void) {
+    fprintf(stderr, "usage: bench_goodput [-n FRAMES] [-p PAYLOAD] "
+        "[-r SAMPLE_HZ] [-c manchester|4b5b|diff] [BASELINE]\n");
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    unsigned frames = DEF_FRAMES;
+    unsigned payload = DEF_PAYLOAD;
+    unsigned long sample_hz = DEF_SAMPLE_HZ;
+    int fl;
+    while ((fl = getopt(argc, argv, "n:p:r:c:")) != -1) {
+        switch (fl) {
+        case 'n': frames = strtoul(optarg, NULL, 10); break;
+        case 'p': payload = strtoul(optarg, NULL, 10); break;
+        case 'r': sample_hz = strtoul(optarg, NULL, 10); break;
+        case 'c':
+            if (0 == strcmp(optarg, "manchester")) {
+                line_code = SPOOKY_LINE_MANCHESTER;
+            } else if (0 == strcmp(optarg, "4b5b")) {
+                line_code = SPOOKY_LINE_4B5B;
+            } else if (0 == strcmp(optarg, "diff")) {
+                line_code = SPOOKY_LINE_DIFF_MANCHESTER;
+            } else {
+                usage();
+            }
+            break;
+        default: usage();
+        }
+    }
+    if (frames == 0 || payload == 0 || payload > MAX_PAYLOAD
+        || sample_hz == 0) {
+        usage();
+    }
+
+    FILE *baseline = NULL;
+    if (optind < argc) {
+        baseline = fopen(argv[optind], "r");
+        if (baseline == NULL) {
+            fprintf(stderr, "can't open %s\n", argv[optind]);
+            return 1;
+        }
+    }
+
+    printf("# %u frames of %u bytes, receiver at %lu Hz\n",
+        frames, payload, sample_hz);
+    if (line_code == SPOOKY_LINE_4B5B) { printf("# 4B5B payloads\n"); }
+    if (line_code == SPOOKY_LINE_DIFF_MANCHESTER) {
+        printf("# differential Manchester\n");
+    }
+    printf("# profile tx  over   kbit/s     FER     FAR  goodput(B/s)\n");
+    bool ok = true;
+    for (size_t p=0; p<COUNT_OF(profiles); p++) {
+        for (size_t t=0; t<COUNT_OF(tx_rates); t++) {
+            for (size_t o=0; o<COUNT_OF(oversamples); o++) {
+                struct point pt;
+                if (!run_point(&profiles[p], tx_rates[t], oversamples[o],
+                        frames, payload, sample_hz, &pt)) {
+                    fprintf(stderr, "bad config: %s, tx %u, over %.2f\n",
+                        profiles[p].name, tx_rates[t], oversamples[o]);
+                    return 1;
+                }
+                print_point(stdout, &pt);
+                if (baseline && !check_point(baseline, &pt)) { ok = false; }
+            }
+        }
+    }
+    if (baseline) { fclose(baseline); }
+    return (ok ? 0 : 1);
+}
@@ -0,0 +1,73 @@
+/* Benchmark for the per-tick cost of the encoder and decoder.
+ *
+ * Built twice by 'make bench': once linked against spooky.a, and once
+ * with -DSPOOKY_SINGLE_HEADER against the generated spooky.h, where
+ * the step functions are static inline and can be folded into the
+ * caller (as they would be in an ISR). */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef SPOOKY_SINGLE_HEADER
+#include "spooky.h"
+#define BUILD_NAME "spooky.h"
+#else
+#include "spooky_encoder.h"
+#include "spooky_decoder.h"
+#define BUILD_NAME "spooky.a"
+#endif
+
+#define FRAMES 20000
+#define RATE_MUL 2
+#define TX_RATE 1
+#define MSG_SZ 8
+
+static struct spooky_encoder enc;
+static struct spooky_decoder dec;
+static uint8_t enc_buf[MSG_SZ];
+static uint8_t dec_buf[32];
+static unsigned long received = 0;
+
+static void rx_cb(uint8_t *data, uint8_t data_size, void *udata) {
+    unsigned long *count = (unsigned long *)udata;
+    (*count)++;
+}
+
+int main(int argc, char **argv) {
+    uint8_t msg[MSG_SZ] = { 0xED, 0x01, 0x02, 0x03, 0xa5, 0x5a, 0x00, 0xff };
+    unsigned long ticks = 0;
+    bool bit = false;
+
+    if (spooky_encoder_init(&enc, enc_buf, MSG_SZ, TX_RATE)
+        != SPOOKY_ENCODER_INIT_OK) { return 1; }
+    if (spooky_decoder_init(&dec, dec_buf, sizeof(dec_buf), rx_cb, &received)
+        != SPOOKY_DECODER_INIT_OK) { return 1; }
+
+    clock_t start = clock();
+    for (int f=0; f<FRAMES; f++) {
+        msg[1] = (uint8_t)f;
+        if (spooky_encoder_enqueue(&enc, msg, MSG_SZ)
+            != SPOOKY_ENCODER_ENQUEUE_OK) { return 1; }
+        for (;;) {
+            enum spooky_encoder_step_res esres = spooky_encoder_step(&enc);
+            if (esres == SPOOKY_ENCODER_STEP_OK_DONE) { break; }
+            if (esres == SPOOKY_ENCODER_STEP_OK_LOW) {
+                bit = false;
+            } else if (esres == SPOOKY_ENCODER_STEP_OK_HIGH) {
+                bit = true;
+            }
+            for (int i=0; i<RATE_MUL; i++) {
+                (void)spooky_decoder_step(&dec, bit);
+                ticks++;
+            }
+        }
+    }
+    clock_t end = clock();
+
+    double sec = (double)(end - start) / CLOCKS_PER_SEC;
+    printf("%-8s: %d frames, %lu received, %lu ticks, %.3f sec, %.2f ns/tick\n",
+        BUILD_NAME, FRAMES, received, ticks, sec,
+        ticks > 0 ? 1e9 * sec / ticks : 0.0);
+    return (received == FRAMES ? 0 : 1);
+}
@@ -0,0 +1,59 @@
+/* Benchmark for the per-tick cost of the C++ layer (spooky.hpp), with
+ * the same link as bench_spooky.c: the sizes, the TX rate, the RX
+ * interval, and the handler are all fixed at compile time. Compare
+ * with bench_spooky_lib and bench_spooky_inline ('make bench'). */
+
+#include <stdio.h>
+#include <time.h>
+
+#include "spooky.hpp"
+
+#define FRAMES 20000
+#define RATE_MUL 2
+#define TX_RATE 1
+#define MSG_SZ 8
+
+static unsigned long received = 0;
+
+struct Counter {
+    static void frame(uint8_t *data, uint8_t size) {
+        (void)data;
+        (void)size;
+        received++;
+    }
+};
+
+static spooky::Encoder<MSG_SZ, TX_RATE> enc;
+static spooky::Decoder<32, TX_RATE * RATE_MUL, Counter> dec;
+
+int main(int argc, char **argv) {
+    uint8_t msg[MSG_SZ] = { 0xED, 0x01, 0x02, 0x03, 0xa5, 0x5a, 0x00, 0xff };
+    unsigned long ticks = 0;
+    bool bit = false;
+
+    clock_t start = clock();
+    for (int f=0; f<FRAMES; f++) {
+        msg[1] = (uint8_t)f;
+        if (enc.enqueue(msg) != SPOOKY_ENCODER_ENQUEUE_OK) { return 1; }
+        for (;;) {
+            spooky_encoder_step_res esres = enc.step();
+            if (esres == SPOOKY_ENCODER_STEP_OK_DONE) { break; }
+            if (esres == SPOOKY_ENCODER_STEP_OK_LOW) {
+                bit = false;
+            } else if (esres == SPOOKY_ENCODER_STEP_OK_HIGH) {
+                bit = true;
+            }
+            for (int i=0; i<RATE_MUL; i++) {
+                (void)dec.step(bit);
+                ticks++;
+            }
+        }
+    }
+    clock_t end = clock();
+
+    double sec = (double)(end - start) / CLOCKS_PER_SEC;
+    printf("%-8s: %d frames, %lu received, %lu ticks, %.3f sec, %.2f ns/tick\n",
+        "spooky.hpp", FRAMES, received, ticks, sec,
+        ticks > 0 ? 1e9 * sec / ticks : 0.0);
+    return (received == FRAMES ? 0 : 1);
+}
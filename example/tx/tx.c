@@ -50,6 +50,12 @@
 #define TIMEOUT_SECONDS 3
 #define TIMEOUT (TIMEOUT_SECONDS * 1000 * DELAY_TICKS_PER_MSEC)
 
+/* How many times to send each message, and how many bits of idle
+ * line between copies, so a receiver that misses one can catch the
+ * next. The encoder repeats it on its own. */
+#define TX_REPEAT 3
+#define TX_GAP_BITS 8
+
 #define TX_PIN 5 /* "13" on Arduino */
 
 typedef enum { M_BUTTON, M_TX, M_TIMEOUT, } mode_t;
@@ -102,6 +108,8 @@ static void init(void)
     enum spooky_encoder_init_res res;
     res = spooky_encoder_init(&enc, enc_buf, ENC_BUF_SIZE, 1);
     if (res != SPOOKY_ENCODER_INIT_OK) blinky_death();
+    res = spooky_encoder_set_repeat(&enc, TX_REPEAT, TX_GAP_BITS);
+    if (res != SPOOKY_ENCODER_INIT_OK) blinky_death();
 
     sei();   /* enable interrupts */
 }
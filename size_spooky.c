@@ -0,0 +1,12 @@
+/* RAM footprint for 'make size': one encoder and one decoder, each
+ * with the smallest buffer allowed. The flash footprint is the text
+ * size of spooky_encoder.o and spooky_decoder.o. */
+
+#include "spooky_encoder.h"
+#include "spooky_decoder.h"
+
+struct spooky_encoder enc;
+uint8_t enc_buf[1];
+
+struct spooky_decoder dec;
+uint8_t dec_buf[SPOOKY_DECODER_MIN_BUFFER_SIZE];
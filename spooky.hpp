@@ -0,0 +1,178 @@
+/*
+ * Copyright (c) 2014 Scott Vokes <vokes.s@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef SPOOKY_HPP
+#define SPOOKY_HPP
+
+/* Header-only C++ layer over the spooky encoder and decoder, built on
+ * the single-header build (spooky.h, see 'make spooky.h'), so the step
+ * functions are inlined into the caller along with everything fixed
+ * at compile time:
+ *
+ * - Buffer sizes, the TX rate, and (optionally) the RX interval are
+ *   template parameters, checked at compile time, and the structs own
+ *   correctly-sized buffers.
+ *
+ * - A non-zero FixedInterval is passed to spooky_decoder_step_fixed as
+ *   a constant, so the header lock compares against it directly and
+ *   the alternate intervals' per-tick work (only used when recovering
+ *   the clock) is compiled out.
+ *
+ * - The receive handler is a type, and its frame() is called directly
+ *   from step(), rather than through a function pointer and udata.
+ *
+ * To do that, spooky.h is included here with SPOOKY_DECODER_FIXED_CB
+ * set to a hook that notes each frame for the Decoder that stepped
+ * it, so don't include spooky.h separately in the same file; in this
+ * file, a raw spooky_decoder's frames only reach a spooky::Decoder's
+ * handler. Nothing needs to be linked: everything in spooky.h is
+ * static inline. 'make bench' compares the per-tick cost against
+ * spooky.a. */
+
+#ifdef SPOOKY_H
+#error "spooky.hpp includes spooky.h itself, with its own frame hook"
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+inline void spooky_hpp_frame(uint8_t *data, uint8_t size, void *udata);
+#define SPOOKY_DECODER_FIXED_CB spooky_hpp_frame
+#include "spooky.h"
+
+namespace spooky {
+
+/* Encoder with a fixed-size buffer, stepping at TX_RATE ticks per bit. */
+template <uint8_t BufSize, uint8_t TxRate>
+class Encoder {
+    static_assert(BufSize > 0, "encoder buffer must be non-empty");
+    static_assert(TxRate > 0, "TX rate must be at least 1 tick");
+
+public:
+    static const uint8_t buffer_size = BufSize;
+    static const uint8_t tx_rate = TxRate;
+
+    Encoder() { (void)spooky_encoder_init(&enc_, buf_, BufSize, TxRate); }
+
+    /* Enqueue a message whose size is known at compile time. */
+    template <size_t N>
+    spooky_encoder_enqueue_res enqueue(const uint8_t (&input)[N]) {
+        static_assert(N <= BufSize, "message larger than encoder buffer");
+        return enqueue(input, N);
+    }
+
+    spooky_encoder_enqueue_res enqueue(const uint8_t *input, uint8_t size) {
+        return spooky_encoder_enqueue(&enc_,
+            const_cast<uint8_t *>(input), size);
+    }
+
+    spooky_encoder_clear_res clear() { return spooky_encoder_clear(&enc_); }
+
+    /* See spooky_encoder_set_line_code. */
+    void set_line_code(spooky_line_code code) {
+        (void)spooky_encoder_set_line_code(&enc_, code);
+    }
+
+    /* See spooky_encoder_set_repeat. */
+    spooky_encoder_init_res set_repeat(uint8_t count, uint16_t gap) {
+        return spooky_encoder_set_repeat(&enc_, count, gap);
+    }
+
+    spooky_encoder_step_res step() { return spooky_encoder_step(&enc_); }
+
+    struct spooky_encoder *raw() { return &enc_; }
+
+private:
+    struct spooky_encoder enc_;
+    uint8_t buf_[BufSize];
+};
+
+namespace detail {
+
+/* A decoder, and the frame spooky_hpp_frame last noted for it. */
+struct Rx {
+    struct spooky_decoder dec;  /* first, so the hook can find the rest */
+    uint8_t size;
+    bool ready;
+};
+
+}
+
+/* Decoder with a fixed-size buffer. HANDLER must provide
+ *     static void frame(uint8_t *data, uint8_t size);
+ * which is called from step() with each complete, checksummed message.
+ *
+ * If FIXED_INTERVAL is non-zero, it is the known number of ticks
+ * between single edges (TX rate * oversampling); headers at other
+ * rates are ignored. 0 means recover the clock from each header. */
+template <uint8_t BufSize, uint8_t FixedInterval, typename Handler>
+class Decoder {
+    static_assert(BufSize >= SPOOKY_DECODER_MIN_BUFFER_SIZE,
+        "decoder buffer too small for clock recovery");
+    static_assert(BufSize <= SPOOKY_DECODER_MAX_BUFFER_SIZE,
+        "decoder buffer too large");
+
+public:
+    static const uint8_t buffer_size = BufSize;
+    static const uint8_t fixed_interval = FixedInterval;
+
+    Decoder() {
+        (void)spooky_decoder_init(&rx_.dec, buf_, BufSize, NULL, NULL);
+        (void)spooky_decoder_fix_interval(&rx_.dec, FixedInterval);
+        rx_.ready = false;
+    }
+
+    /* See spooky_decoder_set_address. */
+    void set_address(uint8_t address, uint8_t mask = 0xFF) {
+        (void)spooky_decoder_set_address(&rx_.dec, address, mask);
+    }
+
+    /* See spooky_decoder_set_line_code. */
+    void set_line_code(spooky_line_code code) {
+        (void)spooky_decoder_set_line_code(&rx_.dec, code);
+    }
+
+    spooky_decoder_step_res step(bool bit) {
+        spooky_decoder_step_res res =
+            spooky_decoder_step_fixed(&rx_.dec, bit, FixedInterval);
+        if (res == SPOOKY_DECODER_STEP_DONE && rx_.ready) {
+            rx_.ready = false;
+            Handler::frame(buf_, rx_.size);
+        }
+        return res;
+    }
+
+    /* For the spooky_decoder_* functions in spooky.h. */
+    struct spooky_decoder *raw() { return &rx_.dec; }
+
+private:
+    detail::Rx rx_;
+    uint8_t buf_[BufSize];
+};
+
+}
+
+/* The decoders' fixed callback (see SPOOKY_DECODER_FIXED_CB), with the
+ * decoder as UDATA. The frame is still in the decoder's buffer when
+ * spooky_decoder_step returns, so just note it for Decoder::step. */
+inline void spooky_hpp_frame(uint8_t *data, uint8_t size, void *udata) {
+    (void)data;
+    spooky::detail::Rx *rx = reinterpret_cast<spooky::detail::Rx *>(udata);
+    rx->size = size;
+    rx->ready = true;
+}
+
+#endif
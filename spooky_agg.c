@@ -0,0 +1,127 @@
+/*
+ * Copyright (c) 2014 Scott Vokes <vokes.s@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <string.h>
+#include "spooky_agg.h"
+
+#if 0
+#include <stdio.h>
+#define LOG(...) printf("g: " __VA_ARGS__)
+#else
+#define LOG(...)
+#endif
+
+/* Initialize a sender. */
+SPOOKY_API enum spooky_agg_res
+spooky_agg_tx_init(struct spooky_agg_tx *tx, uint8_t *buffer,
+                   uint8_t buffer_size) {
+    if (tx == NULL || buffer == NULL) { return SPOOKY_AGG_ERROR_NULL; }
+    if (buffer_size <= SPOOKY_AGG_SUBHEADER_SIZE) {
+        return SPOOKY_AGG_ERROR_BAD_ARGUMENT;
+    }
+    memset(tx, 0, sizeof(*tx));
+    tx->buffer = buffer;
+    tx->buffer_size = buffer_size;
+    return SPOOKY_AGG_OK;
+}
+
+/* Add a message to the frame. */
+SPOOKY_API enum spooky_agg_res
+spooky_agg_tx_add(struct spooky_agg_tx *tx, const uint8_t *data,
+                  uint8_t size) {
+    if (tx == NULL || data == NULL) { return SPOOKY_AGG_ERROR_NULL; }
+    if (size == 0) { return SPOOKY_AGG_ERROR_BAD_ARGUMENT; }
+    if (size > tx->buffer_size - SPOOKY_AGG_SUBHEADER_SIZE) {
+        return SPOOKY_AGG_ERROR_SIZE;
+    }
+    if (size > tx->buffer_size - tx->used - SPOOKY_AGG_SUBHEADER_SIZE) {
+        return SPOOKY_AGG_ERROR_FULL;
+    }
+    tx->buffer[tx->used] = size;
+    memcpy(&tx->buffer[tx->used + SPOOKY_AGG_SUBHEADER_SIZE], data, size);
+    tx->used += SPOOKY_AGG_SUBHEADER_SIZE + size;
+    tx->count++;
+    LOG("added %u bytes, %u messages in %u bytes\n",
+        size, tx->count, tx->used);
+    return SPOOKY_AGG_OK;
+}
+
+/* Send the frame. */
+SPOOKY_API enum spooky_agg_res
+spooky_agg_tx_enqueue(struct spooky_agg_tx *tx, struct spooky_encoder *enc) {
+    if (tx == NULL || enc == NULL) { return SPOOKY_AGG_ERROR_NULL; }
+    if (tx->count == 0) { return SPOOKY_AGG_EMPTY; }
+    switch (spooky_encoder_enqueue(enc, tx->buffer, tx->used)) {
+    case SPOOKY_ENCODER_ENQUEUE_OK:
+        break;
+    case SPOOKY_ENCODER_ENQUEUE_ERROR_FULL:
+        return SPOOKY_AGG_ERROR_FULL;
+    default:
+        return SPOOKY_AGG_ERROR_SIZE;
+    }
+    LOG("sending %u messages in %u bytes\n", tx->count, tx->used);
+    tx->used = 0;
+    tx->count = 0;
+    return SPOOKY_AGG_OK;
+}
+
+/* Messages in the frame. */
+SPOOKY_API uint8_t
+spooky_agg_tx_pending(const struct spooky_agg_tx *tx) {
+    return (tx == NULL ? 0 : tx->count);
+}
+
+/* Initialize a receiver. */
+SPOOKY_API enum spooky_agg_res
+spooky_agg_rx_init(struct spooky_agg_rx *rx, spooky_agg_cb *cb, void *udata) {
+    if (rx == NULL || cb == NULL) { return SPOOKY_AGG_ERROR_NULL; }
+    memset(rx, 0, sizeof(*rx));
+    rx->cb = cb;
+    rx->cb_udata = udata;
+    return SPOOKY_AGG_OK;
+}
+
+/* Split a container frame. */
+SPOOKY_API enum spooky_agg_res
+spooky_agg_rx_split(struct spooky_agg_rx *rx, const uint8_t *frame,
+                    uint8_t size) {
+    if (rx == NULL || frame == NULL) { return SPOOKY_AGG_ERROR_NULL; }
+
+    /* Check the whole frame first, so nothing from a frame that
+     * isn't a container gets passed on. */
+    uint16_t i = 0;
+    while (i < size) {
+        if (frame[i] == 0) { break; }
+        i += SPOOKY_AGG_SUBHEADER_SIZE + frame[i];
+    }
+    if (size == 0 || i != size) {
+        LOG("not a container: %u bytes, sizes add up to %u\n", size, i);
+        rx->rejected++;
+        return SPOOKY_AGG_ERROR_BAD_ARGUMENT;
+    }
+
+    for (i = 0; i < size; i += SPOOKY_AGG_SUBHEADER_SIZE + frame[i]) {
+        rx->messages++;
+        rx->cb(&frame[i + SPOOKY_AGG_SUBHEADER_SIZE], frame[i], rx->cb_udata);
+    }
+    return SPOOKY_AGG_OK;
+}
+
+/* Handle a frame from the decoder. */
+SPOOKY_API void
+spooky_agg_frame_cb(uint8_t *data, uint8_t size, void *udata) {
+    (void)spooky_agg_rx_split((struct spooky_agg_rx *)udata, data, size);
+}
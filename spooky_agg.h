@@ -0,0 +1,105 @@
+#ifndef SPOOKY_AGG_H
+#define SPOOKY_AGG_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "spooky_encoder.h"
+
+#ifndef SPOOKY_API
+#define SPOOKY_API
+#endif
+
+/* Aggregation, for many small messages (e.g. sensor readings) going
+ * the same way. Every frame pays for the header, length, and checksum,
+ * which for a 2-byte message is many times the message itself, so the
+ * sender packs several messages into one container frame, and the
+ * receiver passes each one on separately.
+ *
+ * A container frame's payload is just the messages, each after a
+ * 1-byte sub-header with its size:
+ *
+ *     size, message, size, message, ...
+ *
+ * Sizes are 1 to 255. The receiver checks that the sizes add up to the
+ * frame's payload before passing any of them on, so a frame that isn't
+ * a container is dropped as a whole. Since the first byte is a size,
+ * spooky_decoder_set_address can't filter containers; put an address
+ * in each message instead, if needed. */
+
+/* Bytes of sub-header, before each message. */
+#define SPOOKY_AGG_SUBHEADER_SIZE 1
+
+enum spooky_agg_res {
+    SPOOKY_AGG_OK = 0,
+    SPOOKY_AGG_EMPTY = 1,           /* nothing to send */
+    SPOOKY_AGG_ERROR_NULL = -1,
+    SPOOKY_AGG_ERROR_BAD_ARGUMENT = -2,
+    SPOOKY_AGG_ERROR_SIZE = -3,     /* message can't fit in any frame */
+    SPOOKY_AGG_ERROR_FULL = -4,     /* frame full / encoder busy */
+};
+
+/* Callback for each message in a container. */
+typedef void (spooky_agg_cb)(const uint8_t *data, uint8_t size, void *udata);
+
+/* Sender. */
+struct spooky_agg_tx {
+    uint8_t *buffer;            /* the container frame being filled */
+    uint8_t buffer_size;        /* largest container frame */
+    uint8_t used;               /* bytes in it so far */
+    uint8_t count;              /* messages in it */
+};
+
+/* Receiver. */
+struct spooky_agg_rx {
+    spooky_agg_cb *cb;
+    void *cb_udata;
+    uint16_t messages;          /* messages passed on */
+    uint16_t rejected;          /* frames that weren't containers */
+};
+
+/* Initialize a sender, packing frames of up to BUFFER_SIZE bytes into
+ * BUFFER. It should be no larger than the encoder's buffer or the
+ * receiving decoder's. */
+SPOOKY_API enum spooky_agg_res
+spooky_agg_tx_init(struct spooky_agg_tx *tx, uint8_t *buffer,
+    uint8_t buffer_size);
+
+/* Add a message (copied) to the frame being filled. Returns ERROR_FULL
+ * if it doesn't fit, so send the frame and add it again, or
+ * ERROR_SIZE if it can't fit even in an empty frame. */
+SPOOKY_API enum spooky_agg_res
+spooky_agg_tx_add(struct spooky_agg_tx *tx, const uint8_t *data,
+    uint8_t size);
+
+/* Hand the frame to ENC and start a new one. Returns EMPTY if there
+ * are no messages to send, and ERROR_FULL (keeping them) if the
+ * encoder is still busy. When to send is up to the caller: when a
+ * message doesn't fit, or before the oldest one gets too stale. */
+SPOOKY_API enum spooky_agg_res
+spooky_agg_tx_enqueue(struct spooky_agg_tx *tx, struct spooky_encoder *enc);
+
+/* Messages in the frame being filled. */
+SPOOKY_API uint8_t
+spooky_agg_tx_pending(const struct spooky_agg_tx *tx);
+
+/* Initialize a receiver, calling CB with each message. */
+SPOOKY_API enum spooky_agg_res
+spooky_agg_rx_init(struct spooky_agg_rx *rx, spooky_agg_cb *cb, void *udata);
+
+/* Split a received frame's payload (as passed to the decoder's
+ * callback), calling the receiver's callback with each message, in
+ * order. Returns BAD_ARGUMENT, passing nothing on, if it isn't a
+ * well-formed container. */
+SPOOKY_API enum spooky_agg_res
+spooky_agg_rx_split(struct spooky_agg_rx *rx, const uint8_t *frame,
+    uint8_t size);
+
+/* Decoder callback (see spooky_decoder_cb), with the receiver as
+ * UDATA: calls spooky_agg_rx_split. With SPOOKY_DECODER_FIXED_CB, call
+ * it from that function. */
+SPOOKY_API void
+spooky_agg_frame_cb(uint8_t *data, uint8_t size, void *udata);
+
+#endif
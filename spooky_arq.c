@@ -0,0 +1,358 @@
+/*
+ * Copyright (c) 2014 Scott Vokes <vokes.s@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <string.h>
+#include "spooky_arq.h"
+
+#if 0
+#include <stdio.h>
+#define LOG(...) printf("a: " __VA_ARGS__)
+#else
+#define LOG(...)
+#endif
+
+/* Offsets in the header. */
+#define ARQ_DST 0
+#define ARQ_SRC 1
+#define ARQ_KIND 2
+#define ARQ_SEQ 3
+
+/* An ACK's report on the frame it answers. */
+#define ARQ_INTERVAL 4
+#define ARQ_MISFITS 5
+#define ARQ_ACK_SIZE 6
+
+/* Frame kinds. Until the sender gets an ACK for a SYNC frame (at
+ * first, and after giving up), it sends that instead of DATA, and then
+ * numbers the window from the ACK's sequence number. A receiver that
+ * hasn't had a SYNC frame since it started sets the SYNC flag on its
+ * ACKs, asking the sender to sync again. */
+#define KIND_DATA 0x01
+#define KIND_ACK 0x02
+#define KIND_SYNC 0x80
+
+/* Initialize a node. */
+SPOOKY_API enum spooky_arq_res
+spooky_arq_init(struct spooky_arq *arq, const struct spooky_arq_config *cfg,
+        struct spooky_encoder *enc, struct spooky_decoder *dec,
+        uint8_t *buffer, size_t buffer_size, spooky_arq_cb *cb, void *udata) {
+    if (arq == NULL || cfg == NULL || enc == NULL || dec == NULL
+        || buffer == NULL || cb == NULL) {
+        return SPOOKY_ARQ_ERROR_NULL;
+    }
+    if (cfg->window == 0 || cfg->window > SPOOKY_ARQ_MAX_WINDOW
+        || cfg->timeout == 0 || cfg->address == cfg->peer
+        || cfg->fast_rate > enc->tx_rate) {
+        return SPOOKY_ARQ_ERROR_BAD_ARGUMENT;
+    }
+    size_t slot_size = buffer_size / cfg->window;
+    if (slot_size > SPOOKY_DECODER_MAX_BUFFER_SIZE) {
+        slot_size = SPOOKY_DECODER_MAX_BUFFER_SIZE;
+    }
+    if (slot_size > enc->buffer_size) { slot_size = enc->buffer_size; }
+    if (slot_size <= SPOOKY_ARQ_HEADER_SIZE) { return SPOOKY_ARQ_ERROR_SIZE; }
+
+    memset(arq, 0, sizeof(*arq));
+    arq->enc = enc;
+    arq->dec = dec;
+    arq->buffer = buffer;
+    arq->slot_size = slot_size;
+    arq->cfg = *cfg;
+    arq->cb = cb;
+    arq->cb_udata = udata;
+    arq->slow_rate = enc->tx_rate;
+    arq->rate = enc->tx_rate;
+    arq->rate_up_acks = SPOOKY_ARQ_RATE_UP_ACKS;
+    arq->lfsr = 0xACE1 ^ cfg->address;  /* never 0; differs by node */
+    (void)spooky_decoder_set_address(dec, cfg->address, 0xFF);
+    LOG("node 0x%02x, peer 0x%02x, window %u of %u bytes\n",
+        cfg->address, cfg->peer, cfg->window, arq->slot_size);
+    return SPOOKY_ARQ_OK;
+}
+
+static uint8_t *slot(struct spooky_arq *arq, uint8_t i) {
+    return &arq->buffer[((arq->base_slot + i) % arq->cfg.window)
+        * arq->slot_size];
+}
+
+/* Queue a message. */
+SPOOKY_API enum spooky_arq_res
+spooky_arq_send(struct spooky_arq *arq, const uint8_t *data, uint8_t size) {
+    if (arq == NULL || (data == NULL && size > 0)) {
+        return SPOOKY_ARQ_ERROR_NULL;
+    }
+    if (size > arq->slot_size - SPOOKY_ARQ_HEADER_SIZE) {
+        return SPOOKY_ARQ_ERROR_SIZE;
+    }
+    if (arq->count == arq->cfg.window) { return SPOOKY_ARQ_ERROR_FULL; }
+
+    uint8_t *frame = slot(arq, arq->count);
+    frame[ARQ_DST] = arq->cfg.peer;
+    frame[ARQ_SRC] = arq->cfg.address;
+    frame[ARQ_KIND] = KIND_DATA;
+    frame[ARQ_SEQ] = arq->base + arq->count;
+    memcpy(&frame[SPOOKY_ARQ_HEADER_SIZE], data, size);
+    arq->sizes[(arq->base_slot + arq->count) % arq->cfg.window]
+        = SPOOKY_ARQ_HEADER_SIZE + size;
+    arq->count++;
+    LOG("queued seq %u, %u bytes\n", frame[ARQ_SEQ], size);
+    return SPOOKY_ARQ_OK;
+}
+
+/* Pick how long to wait before resending, up to the configured
+ * backoff, so two nodes whose frames collided don't send them again
+ * at the same time. */
+static uint16_t draw_backoff(struct spooky_arq *arq) {
+    if (arq->cfg.backoff == 0) { return 0; }
+    for (int i=0; i<16; i++) {  /* Galois LFSR, x^16 + x^14 + x^13 + x^11 + 1 */
+        arq->lfsr = (arq->lfsr >> 1) ^ ((arq->lfsr & 1) ? 0xB400 : 0);
+    }
+    return arq->lfsr % ((uint32_t)arq->cfg.backoff + 1);
+}
+
+/* Go back to the next slower rate. If the current one was a faster
+ * rate that never got a clean ACK, wait longer before trying it again;
+ * otherwise, the link got worse, so start over. */
+static void slow_down(struct spooky_arq *arq) {
+    if (arq->cfg.fast_rate == 0) { return; }
+    if (arq->probing) {
+        if (arq->rate_up_acks < SPOOKY_ARQ_MAX_RATE_UP_ACKS) {
+            arq->rate_up_acks *= 2;
+        }
+    } else {
+        arq->rate_up_acks = SPOOKY_ARQ_RATE_UP_ACKS;
+    }
+    arq->probing = false;
+    arq->clean = 0;
+    if (arq->rate < arq->slow_rate) {
+        arq->rate++;
+        LOG("slowing down to rate %u\n", arq->rate);
+    }
+}
+
+/* Adapt the rate to an ACK's report on how its frame was received. */
+static void adapt_rate(struct spooky_arq *arq, uint8_t interval,
+        uint8_t misfits) {
+    if (arq->cfg.fast_rate == 0) { return; }
+    if (misfits > SPOOKY_ARQ_MAX_MISFITS) {
+        slow_down(arq);
+        return;
+    }
+    if (misfits > 0) {
+        arq->clean = 0;
+        return;
+    }
+    if (arq->probing) {         /* the faster rate works */
+        arq->probing = false;
+        arq->rate_up_acks = SPOOKY_ARQ_RATE_UP_ACKS;
+    }
+    if (++arq->clean < arq->rate_up_acks) { return; }
+    arq->clean = 0;
+
+    /* The interval scales with the rate, so the receiver would get
+     * INTERVAL * (RATE - 1) / RATE at the next one. */
+    uint8_t r = arq->rate;
+    if (r > arq->cfg.fast_rate
+        && (uint16_t)interval * (r - 1) >= SPOOKY_ARQ_MIN_INTERVAL * r) {
+        arq->rate--;
+        arq->probing = true;
+        LOG("speeding up to rate %u\n", arq->rate);
+    }
+}
+
+/* The peer expects SEQ next. Nothing in the window has been sent as
+ * DATA yet, so renumber it to start there, wherever the peer's count
+ * is (e.g. after this node restarted). */
+static void sync_to(struct spooky_arq *arq, uint8_t seq) {
+    LOG("synced at seq %u\n", seq);
+    for (uint8_t i=0; i<arq->count; i++) { slot(arq, i)[ARQ_SEQ] = seq + i; }
+    arq->base = seq;
+    arq->sent = 0;
+    arq->retries = 0;
+    arq->timer = 0;
+    arq->synced = true;
+}
+
+/* An ACK for everything before SEQ. It can be for frames sent before
+ * going back, so only the window limits it. Returns whether it's new
+ * (the SYNC's, or for frames not ACKed yet), rather than stale or a
+ * duplicate. */
+static bool got_ack(struct spooky_arq *arq, uint8_t seq) {
+    if (!arq->synced) {
+        sync_to(arq, seq);
+        return true;
+    }
+    uint8_t acked = seq - arq->base;
+    if (acked == 0 || acked > arq->count) {
+        LOG("stale ACK %u, base %u\n", seq, arq->base);
+        return false;
+    }
+    LOG("ACK %u, %u frames done\n", seq, acked);
+    arq->base = seq;
+    arq->base_slot = (arq->base_slot + acked) % arq->cfg.window;
+    arq->count -= acked;
+    arq->sent = (acked > arq->sent ? 0 : arq->sent - acked);
+    arq->retries = 0;
+    arq->timer = 0;
+    return true;
+}
+
+/* Answer the frame just received, with the decoder's report on it. */
+static void owe_ack(struct spooky_arq *arq) {
+    arq->ack_pending = true;
+    arq->ack_interval = arq->dec->interval;
+#ifndef SPOOKY_PROFILE_TINY
+    arq->ack_misfits = arq->dec->misfits;
+#endif
+}
+
+/* Handle a frame from the decoder. */
+SPOOKY_API void
+spooky_arq_frame_cb(uint8_t *data, uint8_t size, void *udata) {
+    struct spooky_arq *arq = (struct spooky_arq *)udata;
+    if (arq == NULL || size < SPOOKY_ARQ_HEADER_SIZE) { return; }
+    if (data[ARQ_DST] != arq->cfg.address || data[ARQ_SRC] != arq->cfg.peer) {
+        return;
+    }
+    switch (data[ARQ_KIND]) {
+    case KIND_ACK:
+        /* Duplicates report on frames already counted. */
+        if (got_ack(arq, data[ARQ_SEQ]) && size >= ARQ_ACK_SIZE) {
+            adapt_rate(arq, data[ARQ_INTERVAL], data[ARQ_MISFITS]);
+        }
+        break;
+    case KIND_ACK | KIND_SYNC:
+        /* The peer restarted. Anything it passed on but didn't get to
+         * ACK will be sent again. */
+        if (arq->synced) {
+            LOG("peer lost sync, resyncing\n");
+            arq->synced = false;
+            arq->sent = 0;
+            arq->retries = 0;
+            arq->timer = 0;
+        }
+        break;
+    case KIND_SYNC:
+        LOG("got sync, expecting seq %u\n", arq->expected);
+        arq->rx_synced = true;
+        owe_ack(arq);
+        break;
+    case KIND_DATA:
+        if (!arq->rx_synced) {
+            LOG("got seq %u before a sync\n", data[ARQ_SEQ]);
+        } else if (data[ARQ_SEQ] == arq->expected) {
+            LOG("got seq %u\n", arq->expected);
+            arq->expected++;
+            arq->cb(&data[SPOOKY_ARQ_HEADER_SIZE],
+                size - SPOOKY_ARQ_HEADER_SIZE, arq->cb_udata);
+        } else {
+            LOG("got seq %u, expected %u\n", data[ARQ_SEQ], arq->expected);
+        }
+        owe_ack(arq);
+        break;
+    default:
+        break;
+    }
+}
+
+/* Hand the encoder the ACK owed, or (unless backing off) the SYNC or
+ * the next frame in the window, in that order. Fails harmlessly while
+ * the encoder is busy. */
+static void send_next(struct spooky_arq *arq) {
+    if (arq->ack_pending) {
+        uint8_t ack[ARQ_ACK_SIZE];
+        ack[ARQ_DST] = arq->cfg.peer;
+        ack[ARQ_SRC] = arq->cfg.address;
+        ack[ARQ_KIND] = KIND_ACK | (arq->rx_synced ? 0 : KIND_SYNC);
+        ack[ARQ_SEQ] = arq->expected;
+        ack[ARQ_INTERVAL] = arq->ack_interval;
+        ack[ARQ_MISFITS] = arq->ack_misfits;
+        if (spooky_encoder_enqueue(arq->enc, ack, sizeof(ack))
+            == SPOOKY_ENCODER_ENQUEUE_OK) {
+            arq->ack_pending = false;
+        }
+    } else if (arq->backoff_left > 0) {
+        return;                 /* waiting to resend */
+    } else if (!arq->synced) {
+        if (arq->count > 0 && arq->sent == 0) {
+            uint8_t sync[SPOOKY_ARQ_HEADER_SIZE];
+            sync[ARQ_DST] = arq->cfg.peer;
+            sync[ARQ_SRC] = arq->cfg.address;
+            sync[ARQ_KIND] = KIND_SYNC;
+            sync[ARQ_SEQ] = arq->base;
+            if (spooky_encoder_enqueue(arq->enc, sync, sizeof(sync))
+                == SPOOKY_ENCODER_ENQUEUE_OK) {
+                LOG("sending sync\n");
+                arq->sent = 1;  /* waiting for its ACK */
+            }
+        }
+    } else if (arq->sent < arq->count) {
+        uint8_t i = (arq->base_slot + arq->sent) % arq->cfg.window;
+        uint8_t *frame = slot(arq, arq->sent);
+        if (spooky_encoder_enqueue(arq->enc, frame, arq->sizes[i])
+            == SPOOKY_ENCODER_ENQUEUE_OK) {
+            LOG("sending seq %u\n", (uint8_t)(arq->base + arq->sent));
+            arq->sent++;
+        }
+    }
+}
+
+/* Step timers, and send something if the encoder is idle. */
+SPOOKY_API enum spooky_arq_res
+spooky_arq_tick(struct spooky_arq *arq) {
+    if (arq == NULL) { return SPOOKY_ARQ_ERROR_NULL; }
+
+    /* Fails harmlessly while the encoder is busy; so will enqueueing. */
+    (void)spooky_encoder_set_rate(arq->enc, arq->rate);
+
+    if (arq->backoff_left > 0) { arq->backoff_left--; }
+    /* On a shared channel, don't start over a frame being received. */
+    if (!spooky_decoder_busy(arq->dec)) { send_next(arq); }
+
+    if (arq->sent == 0) { return SPOOKY_ARQ_OK; }
+    if (++arq->timer < arq->cfg.timeout) { return SPOOKY_ARQ_OK; }
+
+    arq->timer = 0;
+    arq->backoff_left = draw_backoff(arq);
+    if (arq->cfg.max_retries != 0 && arq->retries == arq->cfg.max_retries) {
+        LOG("giving up on seq %u\n", arq->base);
+        arq->base += arq->count;
+        arq->base_slot = (arq->base_slot + arq->count) % arq->cfg.window;
+        arq->count = 0;
+        arq->sent = 0;
+        arq->retries = 0;
+        arq->synced = false;
+        slow_down(arq);
+        return SPOOKY_ARQ_GAVE_UP;
+    }
+    LOG("timeout, resending from seq %u\n", arq->base);
+    slow_down(arq);
+    arq->retries++;
+    arq->sent = 0;              /* go back N */
+    return SPOOKY_ARQ_OK;
+}
+
+/* Messages queued or waiting for an ACK. */
+SPOOKY_API uint8_t
+spooky_arq_pending(const struct spooky_arq *arq) {
+    return (arq == NULL ? 0 : arq->count);
+}
+
+/* The TX rate for the next frame. */
+SPOOKY_API uint8_t
+spooky_arq_rate(const struct spooky_arq *arq) {
+    return (arq == NULL ? 0 : arq->rate);
+}
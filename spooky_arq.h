@@ -0,0 +1,170 @@
+#ifndef SPOOKY_ARQ_H
+#define SPOOKY_ARQ_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "spooky_encoder.h"
+#include "spooky_decoder.h"
+
+#ifndef SPOOKY_API
+#define SPOOKY_API
+#endif
+
+/* Acknowledged delivery between two nodes, each with an encoder and a
+ * decoder, so frames that get through aren't sent again and frames
+ * that don't are.
+ *
+ * Each frame's payload starts with a header:
+ *
+ *     destination address, source address, kind, sequence number
+ *
+ * DATA frames carry a message after it. The receiver passes on each
+ * message in order, exactly once, and answers every DATA frame (even
+ * a duplicate) with an ACK frame whose sequence number is the next
+ * one it expects. Before sending DATA (at first, and after giving
+ * up), the sender sends a SYNC frame, just a header, and numbers its
+ * messages from the sequence number in the ACK, so it picks up
+ * wherever the receiver's count is, even after the sender restarts.
+ * Until a receiver gets a SYNC frame, it passes nothing on and flags
+ * its ACKs, so after the receiver restarts the sender syncs again
+ * (and messages passed on just before the restart, but not ACKed, are
+ * passed on twice). Up to WINDOW frames can be sent before the first
+ * is ACKed; if it isn't ACKed within TIMEOUT ticks, that frame and the
+ * rest of the window are sent again (go-back-N). A WINDOW of 1 is
+ * stop-and-wait. Since the destination address comes first,
+ * spooky_decoder_set_address drops frames for other nodes (including
+ * the node's own, if its receiver hears them) early; spooky_arq_init
+ * sets it up.
+ *
+ * Each ACK also reports the interval the receiver's decoder recovered
+ * from the frame and how many of its edges missed the decoder's
+ * timing windows, so with a non-zero FAST_RATE the sender can adapt
+ * its TX rate to the link: after enough ACKs in a row with no misses,
+ * it tries the next faster rate (down to FAST_RATE, and no faster than
+ * leaves the receiver SPOOKY_ARQ_MIN_INTERVAL ticks per half-bit), and
+ * after a timeout or an ACK with more than SPOOKY_ARQ_MAX_MISFITS
+ * misses, it goes back to the next slower one (up to the encoder's
+ * rate at init). If a faster rate fails before it's been ACKed
+ * cleanly, it waits twice as long before trying it again.
+ *
+ * The two nodes can have a channel each way, or share one (half
+ * duplex, where each also hears itself). On a shared channel, nothing
+ * is sent while the node's decoder is receiving a frame (see
+ * spooky_decoder_busy), but frames started at about the same time,
+ * before either decoder has locked onto the other's header, still
+ * collide. So that they aren't sent at the same time again, set
+ * BACKOFF: after each timeout, the node waits a random number of
+ * ticks, up to BACKOFF, before resending. Half of TIMEOUT works well.
+ * A WINDOW of 1 is best there: with more, the rest of the window
+ * contends with the receiver's ACKs for the channel. */
+
+/* Bytes of header, before the message. */
+#define SPOOKY_ARQ_HEADER_SIZE 4
+
+/* Most frames in flight. */
+#define SPOOKY_ARQ_MAX_WINDOW 8
+
+/* Rate adaptation: the fewest receiver ticks per half-bit to aim for,
+ * the most missed edges in a frame before slowing down, and how many
+ * clean ACKs in a row (at first, and at most) before speeding up. */
+#define SPOOKY_ARQ_MIN_INTERVAL 4
+#define SPOOKY_ARQ_MAX_MISFITS 2
+#define SPOOKY_ARQ_RATE_UP_ACKS 8
+#define SPOOKY_ARQ_MAX_RATE_UP_ACKS 128
+
+enum spooky_arq_res {
+    SPOOKY_ARQ_OK = 0,
+    SPOOKY_ARQ_GAVE_UP = 1,         /* peer didn't ACK, window dropped */
+    SPOOKY_ARQ_ERROR_NULL = -1,
+    SPOOKY_ARQ_ERROR_BAD_ARGUMENT = -2,
+    SPOOKY_ARQ_ERROR_SIZE = -3,     /* message too large */
+    SPOOKY_ARQ_ERROR_FULL = -4,     /* window full, try again later */
+};
+
+/* Callback for each message from the peer, in order. */
+typedef void (spooky_arq_cb)(const uint8_t *data, uint8_t size, void *udata);
+
+struct spooky_arq_config {
+    uint8_t address;            /* this node */
+    uint8_t peer;               /* the other end */
+    uint8_t window;             /* frames in flight, 1 to MAX_WINDOW */
+    uint16_t timeout;           /* ticks to wait for an ACK */
+    uint8_t max_retries;        /* resends before giving up, 0: forever */
+    uint8_t fast_rate;          /* fastest TX rate to try, 0: don't adapt */
+    uint16_t backoff;           /* most ticks to wait to resend, 0: none */
+};
+
+struct spooky_arq {
+    struct spooky_encoder *enc;
+    struct spooky_decoder *dec;
+    uint8_t *buffer;            /* WINDOW slots of SLOT_SIZE bytes */
+    uint8_t slot_size;          /* frame size, header included */
+    uint8_t sizes[SPOOKY_ARQ_MAX_WINDOW];   /* frame size, by slot */
+    struct spooky_arq_config cfg;
+    uint8_t base;               /* oldest unACKed sequence number */
+    uint8_t base_slot;          /* its slot */
+    uint8_t count;              /* frames in the window */
+    uint8_t sent;               /* of those, sent since the last resend */
+    uint8_t retries;            /* resends of the current base */
+    uint16_t timer;             /* ticks waiting for an ACK */
+    uint16_t backoff_left;      /* ticks before resending */
+    uint16_t lfsr;              /* PRNG state, for the backoff */
+    uint8_t expected;           /* next sequence number from the peer */
+    bool synced;                /* peer ACKed a SYNC since init/giving up */
+    bool rx_synced;             /* peer has sent a SYNC since init */
+    bool ack_pending;           /* owe the peer an ACK... */
+    uint8_t ack_interval;       /* ...reporting this interval... */
+    uint8_t ack_misfits;        /* ...and this many missed edges */
+    uint8_t slow_rate;          /* encoder's rate at init */
+    uint8_t rate;               /* current TX rate */
+    uint8_t clean;              /* clean ACKs at this rate, in a row */
+    uint8_t rate_up_acks;       /* clean ACKs needed to speed up */
+    bool probing;               /* sped up, no clean ACK yet */
+    spooky_arq_cb *cb;
+    void *cb_udata;
+};
+
+/* Initialize a node with configuration CFG, sending with ENC and
+ * receiving with DEC. DEC must have been initialized with
+ * spooky_arq_frame_cb and this struct as its udata; this sets its
+ * address filter to CFG's address. BUFFER holds the frames in flight,
+ * WINDOW of them, so messages can be up to
+ * BUFFER_SIZE / WINDOW - SPOOKY_ARQ_HEADER_SIZE bytes, or less if the
+ * encoder's buffer is smaller than BUFFER_SIZE / WINDOW. The peer's
+ * decoder's buffer needs to hold a full frame. CB is called with each message from
+ * the peer. TIMEOUT should be longer than a full frame and its ACK
+ * take to send, at the encoder's rate (the slowest, when adapting).
+ * FAST_RATE, if non-zero, must be no more than the encoder's rate. */
+SPOOKY_API enum spooky_arq_res
+spooky_arq_init(struct spooky_arq *arq, const struct spooky_arq_config *cfg,
+    struct spooky_encoder *enc, struct spooky_decoder *dec,
+    uint8_t *buffer, size_t buffer_size, spooky_arq_cb *cb, void *udata);
+
+/* Queue a message (copied) for the peer. Returns ERROR_FULL if the
+ * window is full. */
+SPOOKY_API enum spooky_arq_res
+spooky_arq_send(struct spooky_arq *arq, const uint8_t *data, uint8_t size);
+
+/* Decoder callback (see spooky_decoder_cb), with the arq struct as
+ * UDATA. With SPOOKY_DECODER_FIXED_CB, call it from that function. */
+SPOOKY_API void
+spooky_arq_frame_cb(uint8_t *data, uint8_t size, void *udata);
+
+/* Step timers and hand the encoder the next frame to send, if it's
+ * idle. Call it once per encoder step. Returns GAVE_UP if the peer
+ * didn't ACK the oldest frame after MAX_RETRIES resends; the window
+ * is then emptied, and the frames in it are lost. */
+SPOOKY_API enum spooky_arq_res
+spooky_arq_tick(struct spooky_arq *arq);
+
+/* Messages queued or waiting for an ACK. */
+SPOOKY_API uint8_t
+spooky_arq_pending(const struct spooky_arq *arq);
+
+/* The TX rate for the next frame. */
+SPOOKY_API uint8_t
+spooky_arq_rate(const struct spooky_arq *arq);
+
+#endif
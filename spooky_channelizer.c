@@ -0,0 +1,396 @@
+/*
+ * Copyright (c) 2014 Scott Vokes <vokes.s@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <math.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <string.h>
+#include "spooky_channelizer.h"
+
+#if 0
+#include <stdio.h>
+#define LOG(...) printf("ch: " __VA_ARGS__)
+#else
+#define LOG(...)
+#endif
+
+/* Output samples per channel per pass. */
+#define BLOCK 256
+
+#define MAX_CHANNELS 4096
+
+/* How slowly the slicer's high and low levels decay, as a fraction
+ * of the gap closed per sample (cf. SOFT_DECAY_SHIFT). */
+#define ENVELOPE_DECAY (1.0f / 64)
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+typedef enum {
+    PHASE_FILTER,               /* filter bank + FFT, split by time */
+    PHASE_DECODE,               /* slicer + decoder, split by channel */
+} phase;
+
+/* One channel's slicer and decoder. */
+struct channel {
+    struct spooky_decoder dec;
+    struct spooky_channelizer *parent;
+    uint16_t index;
+    float hi;                   /* tracked high envelope level */
+    float lo;                   /* tracked low envelope level */
+};
+
+struct worker {
+    struct spooky_channelizer *parent;
+    uint8_t id;
+    float *scratch;             /* 2 * channels floats */
+};
+
+struct spooky_channelizer {
+    uint16_t channels;
+    uint8_t taps;
+    uint8_t threads;
+    float squelch;
+    spooky_channelizer_cb *cb;
+    void *udata;
+
+    float *filter;              /* prototype lowpass, taps * channels */
+    float *twiddle;             /* exp(+2 pi i k / channels), as re, im */
+    uint16_t *bitrev;           /* bit-reversal permutation for the FFT */
+
+    /* Input, as interleaved I and Q: (taps - 1) * channels samples of
+     * history, then up to BLOCK * channels new ones. */
+    float *input;
+    size_t history;             /* complex samples of history */
+    size_t fill;                /* complex samples in input */
+
+    float *envelope;            /* channel-major, channels * BLOCK */
+    size_t steps;               /* output samples in current block */
+
+    struct channel *chans;
+    uint8_t *buffers;
+
+    struct worker *workers;
+    pthread_t *tids;
+    uint8_t started;            /* threads successfully started */
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    unsigned generation;        /* bumped for each phase */
+    phase phase;
+    uint8_t pending;            /* workers still running the phase */
+    bool stop;
+};
+
+static void *worker_loop(void *arg);
+static void channel_cb(uint8_t *data, uint8_t data_size, void *udata);
+
+/* Windowed sinc lowpass, cut off at half the channel spacing, with
+ * a DC gain of 1. */
+static void make_filter(float *h, uint16_t channels, uint8_t taps) {
+    size_t len = (size_t)channels * taps;
+    double center = (len - 1) / 2.0;
+    double sum = 0;
+    for (size_t n=0; n<len; n++) {
+        double x = (n - center) / channels;
+        double sinc = (x == 0 ? 1.0 : sin(M_PI * x) / (M_PI * x));
+        double hamming = 0.54 - 0.46 * cos(2 * M_PI * n / (len - 1));
+        h[n] = (float)(sinc * hamming);
+        sum += h[n];
+    }
+    for (size_t n=0; n<len; n++) { h[n] /= (float)sum; }
+}
+
+static void make_fft_tables(float *twiddle, uint16_t *bitrev, uint16_t n) {
+    for (uint16_t k=0; k<n/2; k++) {
+        twiddle[2*k] = (float)cos(2 * M_PI * k / n);
+        twiddle[2*k + 1] = (float)sin(2 * M_PI * k / n);
+    }
+    uint16_t bits = 0;
+    while ((1U << bits) < n) { bits++; }
+    for (uint16_t i=0; i<n; i++) {
+        uint16_t r = 0;
+        for (uint16_t b=0; b<bits; b++) {
+            if (i & (1U << b)) { r |= 1U << (bits - 1 - b); }
+        }
+        bitrev[i] = r;
+    }
+}
+
+/* In-place radix-2 FFT of N interleaved complex values, with the
+ * inverse (+) sign and no scaling. */
+static void fft(struct spooky_channelizer *ch, float *v) {
+    uint16_t n = ch->channels;
+    for (uint16_t i=0; i<n; i++) {
+        uint16_t j = ch->bitrev[i];
+        if (i < j) {
+            float re = v[2*i], im = v[2*i + 1];
+            v[2*i] = v[2*j]; v[2*i + 1] = v[2*j + 1];
+            v[2*j] = re; v[2*j + 1] = im;
+        }
+    }
+    for (uint16_t len=2; len<=n; len <<= 1) {
+        uint16_t half = len / 2;
+        uint16_t stride = n / len;
+        for (uint16_t i=0; i<n; i += len) {
+            for (uint16_t k=0; k<half; k++) {
+                float wr = ch->twiddle[2*k*stride];
+                float wi = ch->twiddle[2*k*stride + 1];
+                float *a = &v[2*(i + k)];
+                float *b = &v[2*(i + k + half)];
+                float tr = b[0]*wr - b[1]*wi;
+                float ti = b[0]*wi + b[1]*wr;
+                b[0] = a[0] - tr; b[1] = a[1] - ti;
+                a[0] += tr; a[1] += ti;
+            }
+        }
+    }
+}
+
+/* Filter bank output for step M of the block, for every channel.
+ * Branch P sums every CHANNELS-th input sample, weighted by every
+ * CHANNELS-th filter tap; the FFT across branches then shifts each
+ * channel down to baseband. */
+static void filter_step(struct spooky_channelizer *ch, float *v, size_t m) {
+    uint16_t n = ch->channels;
+    const float *h = ch->filter;
+    size_t cur = ch->history + m * n + n - 1;  /* newest sample */
+    memset(v, 0, 2 * n * sizeof(*v));
+    for (uint8_t q=0; q<ch->taps; q++) {
+        const float *hq = &h[(size_t)q * n];
+        const float *x = &ch->input[2 * (cur - (size_t)q * n)];
+        for (uint16_t p=0; p<n; p++) {
+            v[2*p] += hq[p] * x[-2*(ptrdiff_t)p];
+            v[2*p + 1] += hq[p] * x[-2*(ptrdiff_t)p + 1];
+        }
+    }
+    fft(ch, v);
+    for (uint16_t k=0; k<n; k++) {
+        ch->envelope[(size_t)k * BLOCK + m] = sqrtf(v[2*k]*v[2*k] + v[2*k + 1]*v[2*k + 1]);
+    }
+}
+
+/* Slice a channel's envelope into bits, like the soft decoder's slicer:
+ * peak trackers for the high and low levels, and a squelch. */
+static void decode_channel(struct spooky_channelizer *ch, struct channel *c) {
+    const float *env = &ch->envelope[(size_t)c->index * BLOCK];
+    for (size_t m=0; m<ch->steps; m++) {
+        float e = env[m];
+        if (e > c->hi) { c->hi = e; } else { c->hi -= (c->hi - e) * ENVELOPE_DECAY; }
+        if (e < c->lo) { c->lo = e; } else { c->lo += (e - c->lo) * ENVELOPE_DECAY; }
+        bool bit = (c->hi - c->lo >= ch->squelch) && (2 * e > c->hi + c->lo);
+        (void)spooky_decoder_step(&c->dec, bit);
+    }
+}
+
+static void run_phase(struct worker *w, phase ph) {
+    struct spooky_channelizer *ch = w->parent;
+    if (ph == PHASE_FILTER) {
+        size_t from = ch->steps * w->id / ch->threads;
+        size_t to = ch->steps * (w->id + 1) / ch->threads;
+        for (size_t m=from; m<to; m++) { filter_step(ch, w->scratch, m); }
+    } else {
+        size_t from = (size_t)ch->channels * w->id / ch->threads;
+        size_t to = (size_t)ch->channels * (w->id + 1) / ch->threads;
+        for (size_t k=from; k<to; k++) { decode_channel(ch, &ch->chans[k]); }
+    }
+}
+
+static void *worker_loop(void *arg) {
+    struct worker *w = (struct worker *)arg;
+    struct spooky_channelizer *ch = w->parent;
+    unsigned seen = 0;
+    pthread_mutex_lock(&ch->lock);
+    for (;;) {
+        while (ch->generation == seen && !ch->stop) {
+            pthread_cond_wait(&ch->start, &ch->lock);
+        }
+        if (ch->stop) { break; }
+        seen = ch->generation;
+        phase ph = ch->phase;
+        pthread_mutex_unlock(&ch->lock);
+
+        run_phase(w, ph);
+
+        pthread_mutex_lock(&ch->lock);
+        if (--ch->pending == 0) { pthread_cond_signal(&ch->done); }
+    }
+    pthread_mutex_unlock(&ch->lock);
+    return NULL;
+}
+
+/* Run a phase on all the workers, and wait for them to finish. */
+static void run_workers(struct spooky_channelizer *ch, phase ph) {
+    pthread_mutex_lock(&ch->lock);
+    ch->phase = ph;
+    ch->pending = ch->threads;
+    ch->generation++;
+    pthread_cond_broadcast(&ch->start);
+    while (ch->pending > 0) { pthread_cond_wait(&ch->done, &ch->lock); }
+    pthread_mutex_unlock(&ch->lock);
+}
+
+static void channel_cb(uint8_t *data, uint8_t data_size, void *udata) {
+    struct channel *c = (struct channel *)udata;
+    struct spooky_channelizer *ch = c->parent;
+    LOG("channel %u: %u bytes\n", c->index, data_size);
+    ch->cb(c->index, data, data_size, ch->udata);
+}
+
+/* Allocate a channelizer, and start its worker threads. */
+enum spooky_channelizer_res
+spooky_channelizer_new(const struct spooky_channelizer_config *cfg,
+        struct spooky_channelizer **out) {
+    if (cfg == NULL || out == NULL || cfg->cb == NULL) {
+        return SPOOKY_CHANNELIZER_ERROR_NULL;
+    }
+    uint16_t n = cfg->channels;
+    if (n < 2 || n > MAX_CHANNELS || (n & (n - 1)) != 0
+        || cfg->taps == 0 || cfg->threads == 0 || cfg->squelch <= 0
+        || cfg->buffer_size < SPOOKY_DECODER_MIN_BUFFER_SIZE) {
+        return SPOOKY_CHANNELIZER_ERROR_BAD_ARGUMENT;
+    }
+
+    struct spooky_channelizer *ch = calloc(1, sizeof(*ch));
+    if (ch == NULL) { return SPOOKY_CHANNELIZER_ERROR_MEMORY; }
+    pthread_mutex_init(&ch->lock, NULL);
+    pthread_cond_init(&ch->start, NULL);
+    pthread_cond_init(&ch->done, NULL);
+    ch->channels = n;
+    ch->taps = cfg->taps;
+    ch->threads = cfg->threads;
+    ch->squelch = cfg->squelch;
+    ch->cb = cfg->cb;
+    ch->udata = cfg->udata;
+    ch->history = (size_t)(cfg->taps - 1) * n;
+    ch->fill = ch->history;
+
+    ch->filter = malloc((size_t)n * cfg->taps * sizeof(float));
+    ch->twiddle = malloc(n * sizeof(float));
+    ch->bitrev = malloc(n * sizeof(uint16_t));
+    ch->input = calloc(2 * (ch->history + (size_t)BLOCK * n), sizeof(float));
+    ch->envelope = malloc((size_t)n * BLOCK * sizeof(float));
+    ch->chans = calloc(n, sizeof(struct channel));
+    ch->buffers = malloc((size_t)n * cfg->buffer_size);
+    ch->workers = calloc(cfg->threads, sizeof(struct worker));
+    ch->tids = calloc(cfg->threads, sizeof(pthread_t));
+    if (!ch->filter || !ch->twiddle || !ch->bitrev || !ch->input
+        || !ch->envelope || !ch->chans || !ch->buffers
+        || !ch->workers || !ch->tids) {
+        spooky_channelizer_free(ch);
+        return SPOOKY_CHANNELIZER_ERROR_MEMORY;
+    }
+
+    make_filter(ch->filter, n, cfg->taps);
+    make_fft_tables(ch->twiddle, ch->bitrev, n);
+
+    for (uint16_t k=0; k<n; k++) {
+        struct channel *c = &ch->chans[k];
+        c->parent = ch;
+        c->index = k;
+        if (spooky_decoder_init(&c->dec,
+                &ch->buffers[(size_t)k * cfg->buffer_size],
+                cfg->buffer_size, channel_cb, c) != SPOOKY_DECODER_INIT_OK) {
+            spooky_channelizer_free(ch);
+            return SPOOKY_CHANNELIZER_ERROR_BAD_ARGUMENT;
+        }
+    }
+
+    for (uint8_t i=0; i<cfg->threads; i++) {
+        struct worker *w = &ch->workers[i];
+        w->parent = ch;
+        w->id = i;
+        w->scratch = malloc(2 * n * sizeof(float));
+        if (w->scratch == NULL) {
+            spooky_channelizer_free(ch);
+            return SPOOKY_CHANNELIZER_ERROR_MEMORY;
+        }
+        if (pthread_create(&ch->tids[i], NULL, worker_loop, w) != 0) {
+            spooky_channelizer_free(ch);
+            return SPOOKY_CHANNELIZER_ERROR_THREAD;
+        }
+        ch->started++;
+    }
+
+    LOG("%u channels, %u taps, %u threads\n", n, cfg->taps, cfg->threads);
+    *out = ch;
+    return SPOOKY_CHANNELIZER_OK;
+}
+
+/* Process a buffer of IQ samples. */
+enum spooky_channelizer_res
+spooky_channelizer_push(struct spooky_channelizer *ch,
+        const float *iq, size_t count) {
+    if (ch == NULL || (iq == NULL && count > 0)) {
+        return SPOOKY_CHANNELIZER_ERROR_NULL;
+    }
+    size_t n = ch->channels;
+    size_t cap = ch->history + BLOCK * n;
+    while (count > 0) {
+        size_t take = cap - ch->fill;
+        if (take > count) { take = count; }
+        memcpy(&ch->input[2 * ch->fill], iq, 2 * take * sizeof(float));
+        ch->fill += take;
+        iq += 2 * take;
+        count -= take;
+
+        /* Run a block when it's full, or when out of input. */
+        ch->steps = (ch->fill - ch->history) / n;
+        if (ch->steps == BLOCK || (count == 0 && ch->steps > 0)) {
+            run_workers(ch, PHASE_FILTER);
+            run_workers(ch, PHASE_DECODE);
+
+            size_t used = ch->steps * n;
+            memmove(ch->input, &ch->input[2 * used],
+                2 * (ch->fill - used) * sizeof(float));
+            ch->fill -= used;
+        }
+    }
+    return SPOOKY_CHANNELIZER_OK;
+}
+
+/* Stop the worker threads and free the channelizer. */
+void spooky_channelizer_free(struct spooky_channelizer *ch) {
+    if (ch == NULL) { return; }
+    if (ch->started > 0) {
+        pthread_mutex_lock(&ch->lock);
+        ch->stop = true;
+        pthread_cond_broadcast(&ch->start);
+        pthread_mutex_unlock(&ch->lock);
+        for (uint8_t i=0; i<ch->started; i++) {
+            pthread_join(ch->tids[i], NULL);
+        }
+    }
+    pthread_mutex_destroy(&ch->lock);
+    pthread_cond_destroy(&ch->start);
+    pthread_cond_destroy(&ch->done);
+    if (ch->workers != NULL) {
+        for (uint8_t i=0; i<ch->threads; i++) { free(ch->workers[i].scratch); }
+    }
+    free(ch->tids);
+    free(ch->workers);
+    free(ch->buffers);
+    free(ch->chans);
+    free(ch->envelope);
+    free(ch->input);
+    free(ch->bitrev);
+    free(ch->twiddle);
+    free(ch->filter);
+    free(ch);
+}
@@ -0,0 +1,65 @@
+#ifndef SPOOKY_CHANNELIZER_H
+#define SPOOKY_CHANNELIZER_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "spooky_decoder.h"
+
+/* Host-side receiver for many OOK channels at once, from one wideband
+ * IQ stream (e.g. from an SDR).
+ *
+ * A polyphase filter bank splits the stream into CHANNELS equally
+ * spaced channels, each decimated by CHANNELS: channel K is centered
+ * at K * sample_rate / CHANNELS (so channels above the middle are at
+ * negative frequencies). Each channel's envelope goes through a
+ * slicer into its own spooky_decoder, at one tick per output sample.
+ *
+ * Work is split across worker threads: first by time (the filter bank
+ * and FFT for a block of output samples), then by channel (the slicer
+ * and decoder), with the block stored channel-major in between.
+ *
+ * This uses threads, floating point, and the heap, so it's host-only. */
+
+/* Callback, called with each message received on CHANNEL. With more
+ * than one thread, it can be called from several threads at once. */
+typedef void (spooky_channelizer_cb)(uint16_t channel,
+    uint8_t *data, uint8_t data_size, void *udata);
+
+struct spooky_channelizer_config {
+    uint16_t channels;          /* number of channels, a power of 2 */
+    uint8_t taps;               /* filter taps per channel, e.g. 8 */
+    uint8_t threads;            /* worker threads, at least 1 */
+    uint8_t buffer_size;        /* each decoder's buffer, in bytes */
+    float squelch;              /* least envelope swing that's a signal */
+    spooky_channelizer_cb *cb;  /* callback for received messages */
+    void *udata;                /* void * userdata for callback */
+};
+
+struct spooky_channelizer;
+
+enum spooky_channelizer_res {
+    SPOOKY_CHANNELIZER_OK = 0,
+    SPOOKY_CHANNELIZER_ERROR_NULL = -1,
+    SPOOKY_CHANNELIZER_ERROR_BAD_ARGUMENT = -2,
+    SPOOKY_CHANNELIZER_ERROR_MEMORY = -3,
+    SPOOKY_CHANNELIZER_ERROR_THREAD = -4,
+};
+
+/* Allocate a channelizer, and start its worker threads. */
+enum spooky_channelizer_res
+spooky_channelizer_new(const struct spooky_channelizer_config *cfg,
+    struct spooky_channelizer **out);
+
+/* Process COUNT complex samples, as interleaved I and Q floats.
+ * Samples left over past a multiple of the channel count are kept
+ * for the next call. Returns once they have all been decoded. */
+enum spooky_channelizer_res
+spooky_channelizer_push(struct spooky_channelizer *ch,
+    const float *iq, size_t count);
+
+/* Stop the worker threads and free the channelizer. */
+void spooky_channelizer_free(struct spooky_channelizer *ch);
+
+#endif
@@ -0,0 +1,278 @@
+/*
+ * Copyright (c) 2014 Scott Vokes <vokes.s@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <string.h>
+#include "spooky_correlator.h"
+
+#if 0
+#include <stdio.h>
+#define LOG(...) printf("c: " __VA_ARGS__)
+#else
+#define LOG(...)
+#endif
+
+#define HALF_BITS SPOOKY_CORRELATOR_HEADER_HALF_BITS
+
+/* Positions scored per pass. This is a constant so the inner loop has
+ * a fixed trip count, which lets the compiler vectorize it. */
+#define BLOCK 64
+
+/* Most samples in a frame after the header: length, checksum, and a
+ * full payload, 2 halves per bit. Multiplied by the interval. */
+#define MAX_FRAME_HALF_BITS ((2 + 255) * 8 * 2)
+
+/* A candidate match, before overlapping ones are dropped. */
+struct candidate {
+    size_t offset;
+    uint8_t interval;
+    double quality;             /* fraction of a perfect match */
+};
+
+/* Level of the header's Nth half bit: -1 for low, +1 for high. The
+ * encoder sends a 1 as low then high, and a 0 as high then low. */
+static int template_level(int n) {
+    uint8_t byte = (n < 16 ? 0xFF : 0x55);
+    int bit = (byte >> (7 - ((n / 2) % 8))) & 0x01;
+    int first = (bit ? -1 : 1);
+    return (n & 1) ? -first : first;
+}
+
+/* The correlation at offset P is the sum over the template of each
+ * half bit's level times the samples under it. With a prefix sum S,
+ * the half bit from P + N*I to P + (N+1)*I sums to S[P+(N+1)*I] -
+ * S[P+N*I], so the whole thing is a weighted sum of the S values at
+ * the HALF_BITS + 1 boundaries. Weights are the change in level at
+ * each boundary, which is 0 inside 0x55's long runs. */
+static int boundary_weight(int j) {
+    int before = (j > 0 ? template_level(j - 1) : 0);
+    int after = (j < HALF_BITS ? template_level(j) : 0);
+    return before - after;
+}
+
+static bool overlaps(const struct candidate *a, const struct candidate *b) {
+    size_t a_end = a->offset + (size_t)HALF_BITS * a->interval;
+    size_t b_end = b->offset + (size_t)HALF_BITS * b->interval;
+    return a->offset < b_end && b->offset < a_end;
+}
+
+static int cmp_quality(const void *a, const void *b) {
+    const struct candidate *ca = a, *cb = b;
+    if (ca->quality != cb->quality) { return (ca->quality < cb->quality) ? 1 : -1; }
+    return (ca->offset < cb->offset) ? -1 : (ca->offset > cb->offset);
+}
+
+static int cmp_offset(const void *a, const void *b) {
+    const struct candidate *ca = a, *cb = b;
+    return (ca->offset < cb->offset) ? -1 : (ca->offset > cb->offset);
+}
+
+static bool push_candidate(struct candidate **cands, size_t *count,
+        size_t *ceil, const struct candidate *c) {
+    if (*count == *ceil) {
+        size_t nceil = (*ceil == 0 ? 16 : 2 * *ceil);
+        struct candidate *n = realloc(*cands, nceil * sizeof(*n));
+        if (n == NULL) { return false; }
+        *cands = n;
+        *ceil = nceil;
+    }
+    (*cands)[(*count)++] = *c;
+    return true;
+}
+
+/* Score every offset at INTERVAL, and add the best offset of each run
+ * scoring at least MIN_QUALITY as a candidate. */
+static bool scan_interval(const uint32_t *prefix, size_t count,
+        uint8_t interval, uint32_t swing, double min_quality,
+        struct candidate **cands, size_t *cand_count, size_t *cand_ceil) {
+    size_t span = (size_t)HALF_BITS * interval;
+    if (span > count) { return true; }
+    size_t positions = count - span + 1;
+
+    int weights[HALF_BITS + 1];
+    size_t offsets[HALF_BITS + 1];
+    int wcount = 0;
+    for (int j=0; j<=HALF_BITS; j++) {
+        int w = boundary_weight(j);
+        if (w != 0) {
+            weights[wcount] = w;
+            offsets[wcount] = (size_t)j * interval;
+            wcount++;
+        }
+    }
+
+    /* A perfect match is +swing for every high half bit, of which
+     * there are HALF_BITS / 2. */
+    double perfect = (double)swing * interval * (HALF_BITS / 2);
+    struct candidate cur = { .offset = 0, .interval = 0, .quality = 0 };
+
+    for (size_t base=0; base<positions; base += BLOCK) {
+        /* Unsigned, so a wrapped prefix sum still gives the right
+         * differences. The weights sum to 0, so the total fits. */
+        uint32_t acc[BLOCK];
+        memset(acc, 0, sizeof(acc));
+        for (int k=0; k<wcount; k++) {
+            const uint32_t *s = &prefix[base + offsets[k]];
+            uint32_t w = (uint32_t)weights[k];
+            for (int i=0; i<BLOCK; i++) { acc[i] += w * s[i]; }
+        }
+
+        size_t limit = positions - base;
+        if (limit > BLOCK) { limit = BLOCK; }
+        for (size_t i=0; i<limit; i++) {
+            double q = (int32_t)acc[i] / perfect;
+            if (q < min_quality) { continue; }
+            size_t p = base + i;
+            if (cur.interval != 0 && p < cur.offset + span) {
+                if (q > cur.quality) { cur.offset = p; cur.quality = q; }
+                continue;
+            }
+            if (cur.interval != 0
+                && !push_candidate(cands, cand_count, cand_ceil, &cur)) {
+                return false;
+            }
+            cur.offset = p;
+            cur.interval = interval;
+            cur.quality = q;
+        }
+    }
+    if (cur.interval != 0) {
+        return push_candidate(cands, cand_count, cand_ceil, &cur);
+    }
+    return true;
+}
+
+/* Search a sample buffer for headers at the candidate intervals. */
+enum spooky_correlator_res
+spooky_correlator_scan(const uint8_t *samples, size_t count,
+        const uint8_t *intervals, uint8_t interval_count, uint8_t min_score,
+        struct spooky_correlator_lock *locks, size_t max_locks,
+        size_t *lock_count) {
+    if (samples == NULL || intervals == NULL || lock_count == NULL
+        || (locks == NULL && max_locks > 0)) {
+        return SPOOKY_CORRELATOR_ERROR_NULL;
+    }
+    if (interval_count == 0 || min_score == 0 || min_score > 100) {
+        return SPOOKY_CORRELATOR_ERROR_BAD_ARGUMENT;
+    }
+    for (int i=0; i<interval_count; i++) {
+        if (intervals[i] == 0) { return SPOOKY_CORRELATOR_ERROR_BAD_ARGUMENT; }
+    }
+    *lock_count = 0;
+
+    uint8_t lo = 0xFF, hi = 0x00;
+    for (size_t i=0; i<count; i++) {
+        if (samples[i] < lo) { lo = samples[i]; }
+        if (samples[i] > hi) { hi = samples[i]; }
+    }
+    if (count == 0 || hi == lo) { return SPOOKY_CORRELATOR_OK; }
+
+    /* Prefix sums, padded with the total so every block can be
+     * read in full. */
+    uint32_t *prefix = malloc((count + 1 + BLOCK) * sizeof(*prefix));
+    if (prefix == NULL) { return SPOOKY_CORRELATOR_ERROR_MEMORY; }
+    prefix[0] = 0;
+    for (size_t i=0; i<count; i++) {
+        prefix[i + 1] = prefix[i] + (uint32_t)(samples[i] - lo);
+    }
+    for (size_t i=count + 1; i<count + 1 + BLOCK; i++) {
+        prefix[i] = prefix[count];
+    }
+
+    struct candidate *cands = NULL;
+    size_t cand_count = 0, cand_ceil = 0;
+    enum spooky_correlator_res res = SPOOKY_CORRELATOR_OK;
+    for (int i=0; i<interval_count; i++) {
+        if (!scan_interval(prefix, count, intervals[i], hi - lo,
+                min_score / 100.0, &cands, &cand_count, &cand_ceil)) {
+            res = SPOOKY_CORRELATOR_ERROR_MEMORY;
+            goto cleanup;
+        }
+    }
+    LOG("%zu candidates\n", cand_count);
+
+    /* Keep the best of each set of overlapping matches, e.g. the
+     * right interval rather than its neighbors. */
+    qsort(cands, cand_count, sizeof(*cands), cmp_quality);
+    size_t kept = 0;
+    for (size_t i=0; i<cand_count; i++) {
+        bool keep = true;
+        for (size_t k=0; k<kept; k++) {
+            if (overlaps(&cands[i], &cands[k])) { keep = false; break; }
+        }
+        if (keep) { cands[kept++] = cands[i]; }
+    }
+    qsort(cands, kept, sizeof(*cands), cmp_offset);
+
+    for (size_t i=0; i<kept && i<max_locks; i++) {
+        locks[i].offset = cands[i].offset;
+        locks[i].interval = cands[i].interval;
+        locks[i].score = (uint8_t)(cands[i].quality > 1.0
+            ? 100 : 100 * cands[i].quality);
+        LOG("lock at %zu, interval %u, score %u\n",
+            locks[i].offset, locks[i].interval, locks[i].score);
+    }
+    *lock_count = kept;
+
+cleanup:
+    free(cands);
+    free(prefix);
+    return res;
+}
+
+/* Decode the frame after each header found by spooky_correlator_scan. */
+enum spooky_correlator_res
+spooky_correlator_decode(struct spooky_decoder *dec,
+        const uint8_t *samples, size_t count,
+        const struct spooky_correlator_lock *locks, size_t lock_count) {
+    if (dec == NULL || samples == NULL || (locks == NULL && lock_count > 0)) {
+        return SPOOKY_CORRELATOR_ERROR_NULL;
+    }
+
+    uint8_t lo = 0xFF, hi = 0x00;
+    for (size_t i=0; i<count; i++) {
+        if (samples[i] < lo) { lo = samples[i]; }
+        if (samples[i] > hi) { hi = samples[i]; }
+    }
+    unsigned threshold = lo + hi;  /* compared with 2x the sample */
+
+    size_t resume = 0;          /* end of the last complete frame */
+    for (size_t l=0; l<lock_count; l++) {
+        const struct spooky_correlator_lock *lock = &locks[l];
+        if (lock->offset < resume) { continue; }
+
+        /* The header ends on the data edge of 0x55's last bit, a 1,
+         * so the line is high after it. */
+        size_t start = lock->offset + (size_t)(HALF_BITS - 1) * lock->interval;
+        size_t end = start + (size_t)MAX_FRAME_HALF_BITS * lock->interval;
+        if (end > count) { end = count; }
+        if (spooky_decoder_lock(dec, lock->interval, true)
+            != SPOOKY_DECODER_INIT_OK) {
+            return SPOOKY_CORRELATOR_ERROR_BAD_ARGUMENT;
+        }
+
+        /* Stop once the frame is done, or the decoder gives up on it
+         * and goes back to looking for a header (interval is cleared),
+         * so it can't pick up the next frame a second time. */
+        for (size_t i=start + 1; i<end && dec->interval != 0; i++) {
+            bool bit = 2U * samples[i] > threshold;
+            if (spooky_decoder_step(dec, bit) == SPOOKY_DECODER_STEP_DONE) {
+                resume = i;
+                break;
+            }
+        }
+    }
+    return SPOOKY_CORRELATOR_OK;
+}
@@ -0,0 +1,63 @@
+#ifndef SPOOKY_CORRELATOR_H
+#define SPOOKY_CORRELATOR_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "spooky_decoder.h"
+
+/* Host-side header search for captured sample buffers (e.g. a logic
+ * analyzer dump of the receiver's data line, one byte per sample).
+ *
+ * Rather than timing edges one at a time, like the decoder's header
+ * state, this slides the whole 0xFF 0x55 header the encoder sends
+ * across the buffer as a matched filter, at each of several candidate
+ * intervals. Because every edge contributes to the score, headers
+ * whose first few edges are missing or corrupted are still found.
+ *
+ * This allocates scratch memory, so it's not meant for MCUs. */
+
+/* Length of the header, in intervals: 8 bits of 1 (sharp
+ * transitions) and the 8 bits of 0x55 (long ones), in two halves each. */
+#define SPOOKY_CORRELATOR_HEADER_HALF_BITS 32
+
+/* A header found in the buffer. */
+struct spooky_correlator_lock {
+    size_t offset;              /* sample index where the header starts */
+    uint8_t interval;           /* samples per half bit */
+    uint8_t score;              /* match, as a percent of a perfect one */
+};
+
+enum spooky_correlator_res {
+    SPOOKY_CORRELATOR_OK = 0,
+    SPOOKY_CORRELATOR_ERROR_NULL = -1,
+    SPOOKY_CORRELATOR_ERROR_BAD_ARGUMENT = -2,
+    SPOOKY_CORRELATOR_ERROR_MEMORY = -3,
+};
+
+/* Search COUNT SAMPLES for headers at each of the INTERVAL_COUNT
+ * candidate INTERVALS (samples per half bit, as in
+ * spooky_decoder_fix_interval). Samples can be 0/1 or multi-level;
+ * scores are relative to the smallest and largest sample in the buffer.
+ *
+ * Headers scoring at least MIN_SCORE percent are written to LOCKS, in
+ * order, up to MAX_LOCKS of them. Where matches at different intervals
+ * overlap, only the best is kept. The number found is written to
+ * *LOCK_COUNT (it may be more than MAX_LOCKS). */
+enum spooky_correlator_res
+spooky_correlator_scan(const uint8_t *samples, size_t count,
+    const uint8_t *intervals, uint8_t interval_count, uint8_t min_score,
+    struct spooky_correlator_lock *locks, size_t max_locks,
+    size_t *lock_count);
+
+/* Feed the frame after each of the LOCK_COUNT LOCKS into DEC: lock it
+ * at the header's interval, then step it with the (sliced) samples
+ * until the frame is done or the next header starts. Complete frames
+ * go to DEC's callback, as usual. */
+enum spooky_correlator_res
+spooky_correlator_decode(struct spooky_decoder *dec,
+    const uint8_t *samples, size_t count,
+    const struct spooky_correlator_lock *locks, size_t lock_count);
+
+#endif
@@ -22,42 +22,112 @@ typedef enum {
     RX_LENGTH,                  /* length byte */
     RX_CHKSUM,                  /* sum-and-invert checksum byte */
     RX_PAYLOAD,                 /* payload */
+    RX_SYNC,                    /* rest of 0x55, if the ring is short */
 } rx_mode;
 
-#define RING_BUF_SZ_BITS 4
+#define RING_BUF_SZ_BITS SPOOKY_DECODER_RING_BITS
 #define RING_BUF_SZ (1 << RING_BUF_SZ_BITS)
 #define RING_BUF_MASK (RING_BUF_SZ - 1)
 
 /* How many short transitions are required? The first few may be garbled. */
-#define SHORT_TRANSITIONS 8
+#define SHORT_TRANSITIONS (RING_BUF_SZ / 2)
+
+/* How many long transitions (from the 0x55 header byte) are required?
+ * If fewer than all 8, the rest of the byte is checked in RX_SYNC. */
+#define LONG_TRANSITIONS (RING_BUF_SZ - SHORT_TRANSITIONS)
+#define HEADER_LONG_BYTE 0x55
+
+/* The same transitions, read as differential Manchester. */
+#define HEADER_LONG_BYTE_DIFF 0xFF
 
 #define MAX_POSSIBLE_DELAY ((uint8_t)-1)
 
+/* Flags in pre_ticks, which soft decoding uses in place of the
+ * setup edge tick count. */
+#define SOFT_SKIP_BIT 0x01      /* discard the current bit */
+#define SOFT_RECENTERED 0x02    /* already re-centered during this bit */
+#define SOFT_LAST_HIGH 0x04     /* last bit ended high */
+
+/* How slowly the soft decoder's high and low levels decay, as a shift:
+ * they close about 1/2^SOFT_DECAY_SHIFT of the gap per sample. */
+#define SOFT_DECAY_SHIFT 6
+
+/* Squelch: the least difference between high and low levels that's
+ * treated as a signal, rather than noise on an idle line. */
+#define SOFT_MIN_SWING 48
+
+/* 4B5B: cells per symbol, and the most cells between edges. */
+#define SYMBOL_CELLS 5
+#define MAX_RUN_CELLS 4
+#define NO_NIBBLE 0xFF
+
+/* 4B5B symbols (as in FDDI) to nibbles, or NO_NIBBLE for symbols that
+ * are never sent. */
+static const uint8_t nibble_4b5b[32] = {
+    NO_NIBBLE, NO_NIBBLE, NO_NIBBLE, NO_NIBBLE,
+    NO_NIBBLE, NO_NIBBLE, NO_NIBBLE, NO_NIBBLE,
+    NO_NIBBLE, 0x1, 0x4, 0x5, NO_NIBBLE, NO_NIBBLE, 0x6, 0x7,
+    NO_NIBBLE, NO_NIBBLE, 0x8, 0x9, 0x2, 0x3, 0xA, 0xB,
+    NO_NIBBLE, NO_NIBBLE, 0xC, 0xD, 0xE, 0xF, 0x0, NO_NIBBLE,
+};
+
 #define DEBUG 0
 #if DEBUG
 #include <stdio.h>
 #define LOG(...) printf("d: " __VA_ARGS__)
-static char *st_names[] = {"HEADER", "LENGTH", "CHKSUM", "PAYLOAD",};
+static char *st_names[] = {"HEADER", "LENGTH", "CHKSUM", "PAYLOAD", "SYNC",};
 #else
 #define LOG(...)
 #endif
 
+#ifdef SPOOKY_DECODER_STATS
+#define COUNT(DEC, FIELD) ((DEC)->stats.FIELD++)
+#else
+#define COUNT(DEC, FIELD)
+#endif
+
+#define TRACE(OBJ, TYPE, A, B, C) \
+    SPOOKY_TRACE_EVENT(&(OBJ)->trace, SPOOKY_TRACE_##TYPE, A, B, C)
+
+#ifdef SPOOKY_DECODER_STREAM
+#ifdef SPOOKY_DECODER_FIXED_CB
+#define CB_UDATA(DEC) ((void *)(DEC))
+#else
+#define CB_UDATA(DEC) ((DEC)->cb_udata)
+#endif
+#endif
+
 /* Callback for when a complete byte has been received.
  * Returns whether the entire message payload is complete. */
 typedef int (byte_cb)(struct spooky_decoder *dec);
 
 static void reset_decoder(struct spooky_decoder *dec);
+static void reset_state(struct spooky_decoder *dec);
 static int sink_bit(struct spooky_decoder *dec, bool bit);
 static uint8_t checksum(uint8_t *buf, size_t size);
 static void append_to_ring_buffer(struct spooky_decoder *dec,
     uint8_t offset);
+static void set_windows(struct spooky_decoder *dec, uint8_t interval);
+static void count_lock(struct spooky_decoder *dec, uint8_t interval);
+#ifndef SPOOKY_PROFILE_TINY
+static void start_alternates(struct spooky_decoder *dec, uint8_t interval);
+static bool alternates_running(const struct spooky_decoder *dec);
+static void step_alternates(struct spooky_decoder *dec, bool bit);
+static void resolve_alternates(struct spooky_decoder *dec);
+#endif
 
 /* Initialize a spooky decoder. */
-enum spooky_decoder_init_res
+SPOOKY_API enum spooky_decoder_init_res
 spooky_decoder_init(struct spooky_decoder *dec,
                     uint8_t *output_buffer, size_t buffer_size,
                     spooky_decoder_cb *cb, void *udata) {
+#ifdef SPOOKY_DECODER_FIXED_CB
+    (void)cb;
+    (void)udata;
+    if ((dec == NULL) || (output_buffer == NULL)) {
+#else
     if ((dec == NULL) || (output_buffer == NULL) || (cb == NULL)) {
+#endif
         LOG("init error: null pointer given\n");
         return SPOOKY_DECODER_INIT_ERROR_NULL;
     }
@@ -75,48 +145,363 @@ spooky_decoder_init(struct spooky_decoder *dec,
     dec->buffer_size = buffer_size;
     memset(dec->buffer, 0, buffer_size);
 
+#ifndef SPOOKY_DECODER_FIXED_CB
     dec->cb = cb;
     dec->cb_udata = udata;
+#endif
+#ifndef SPOOKY_PROFILE_TINY
+    dec->soft_lo = 0xFFFF;
+#endif
 
     LOG("initialized decoder %p with buffer %p (%zu bytes)\n",
         (void*)dec, (void*)output_buffer, buffer_size);
     return SPOOKY_DECODER_INIT_OK;
 }
 
-/* States. */
+/* Pin the decoder to a known interval, rather than recovering it
+ * from each header. An INTERVAL of 0 restores clock recovery. */
+SPOOKY_API enum spooky_decoder_init_res
+spooky_decoder_fix_interval(struct spooky_decoder *dec, uint8_t interval) {
+    if (dec == NULL) { return SPOOKY_DECODER_INIT_ERROR_NULL; }
+    dec->fixed_interval = interval;
+    return SPOOKY_DECODER_INIT_OK;
+}
+
+/* Drop frames for other nodes, by their first payload byte. */
+SPOOKY_API enum spooky_decoder_init_res
+spooky_decoder_set_address(struct spooky_decoder *dec,
+        uint8_t address, uint8_t mask) {
+    if (dec == NULL) { return SPOOKY_DECODER_INIT_ERROR_NULL; }
+    dec->address = address;
+    dec->address_mask = mask;
+    return SPOOKY_DECODER_INIT_OK;
+}
+
+/* Set the duty cycle for spooky_decoder_step_idle. */
+SPOOKY_API enum spooky_decoder_init_res
+spooky_decoder_set_wakeup(struct spooky_decoder *dec,
+        uint16_t preamble, uint8_t listen) {
+    if (dec == NULL) { return SPOOKY_DECODER_INIT_ERROR_NULL; }
+    dec->wake_preamble = preamble;
+    dec->wake_listen = listen;
+    dec->quiet = 0;
+    return SPOOKY_DECODER_INIT_OK;
+}
+
+/* Set the line code. */
+SPOOKY_API enum spooky_decoder_init_res
+spooky_decoder_set_line_code(struct spooky_decoder *dec,
+        enum spooky_line_code code) {
+    if (dec == NULL) { return SPOOKY_DECODER_INIT_ERROR_NULL; }
+    if (code != SPOOKY_LINE_MANCHESTER && code != SPOOKY_LINE_4B5B
+        && code != SPOOKY_LINE_DIFF_MANCHESTER) {
+        return SPOOKY_DECODER_INIT_ERROR_BAD_ARGUMENT;
+    }
+    dec->line_code = code;
+    return SPOOKY_DECODER_INIT_OK;
+}
+
+/* Start reading the length byte, as if a header had just locked. */
+SPOOKY_API enum spooky_decoder_init_res
+spooky_decoder_lock(struct spooky_decoder *dec, uint8_t interval, bool level) {
+    if (dec == NULL) { return SPOOKY_DECODER_INIT_ERROR_NULL; }
+    if (interval == 0) { return SPOOKY_DECODER_INIT_ERROR_BAD_ARGUMENT; }
+    reset_decoder(dec);
+    TRACE(dec, DEC_STATE, RX_HEADER, RX_LENGTH, interval);
+    dec->mode = RX_LENGTH;
+    dec->interval = interval;
+    set_windows(dec, interval);
+    dec->last = level;
+#ifndef SPOOKY_PROFILE_TINY
+    start_alternates(dec, 0);
+#endif
+    count_lock(dec, interval);
+    TRACE(dec, DEC_LOCK, interval, 0, SPOOKY_TRACE_LOCK_EXTERNAL);
+    LOG("locked externally, interval %u\n", interval);
+    return SPOOKY_DECODER_INIT_OK;
+}
+
+#ifdef SPOOKY_DECODER_STATS
+/* Copy the counters, and zero them if CLEAR. */
+SPOOKY_API enum spooky_decoder_init_res
+spooky_decoder_read_stats(struct spooky_decoder *dec,
+        struct spooky_decoder_stats *stats, bool clear) {
+    if (dec == NULL || stats == NULL) { return SPOOKY_DECODER_INIT_ERROR_NULL; }
+    *stats = dec->stats;
+    if (clear) { memset(&dec->stats, 0, sizeof(dec->stats)); }
+    return SPOOKY_DECODER_INIT_OK;
+}
+#endif
+
+#ifdef SPOOKY_DECODER_STREAM
+/* Set the streaming callbacks. */
+SPOOKY_API enum spooky_decoder_init_res
+spooky_decoder_set_stream(struct spooky_decoder *dec,
+        spooky_decoder_byte_cb *byte_cb, spooky_decoder_end_cb *end_cb) {
+    if (dec == NULL) { return SPOOKY_DECODER_INIT_ERROR_NULL; }
+    dec->byte_cb = byte_cb;
+    dec->end_cb = end_cb;
+    return SPOOKY_DECODER_INIT_OK;
+}
+
+/* The streamed frame is over; OK if it passed the checksum. */
+static void end_stream(struct spooky_decoder *dec, bool ok) {
+    if (dec->end_cb != NULL) { dec->end_cb(ok, CB_UDATA(dec)); }
+}
+#endif
+
+/* States. The header, length, and checksum states also take the
+ * fixed interval (0 if none), see step_decoder. */
 typedef int (step_state)(struct spooky_decoder *dec, bool bit);
-static step_state step_header;
-static step_state step_length;
-static step_state step_chksum;
+static int step_header(struct spooky_decoder *dec, bool bit, uint8_t fixed);
+static int step_length(struct spooky_decoder *dec, bool bit, uint8_t fixed);
+static int step_chksum(struct spooky_decoder *dec, bool bit, uint8_t fixed);
 static step_state step_payload;
+static step_state step_sync;
 #define STATE(NAME) \
     static int NAME(struct spooky_decoder *dec, bool bit)
 
+/* Step the decoder, with the fixed interval as an argument rather than
+ * read from the struct, so that in the single-header build, where
+ * this gets inlined, a constant one drops the alternate intervals
+ * (which are only tried when recovering the clock). */
+static enum spooky_decoder_step_res step_decoder(struct spooky_decoder *dec,
+        bool bit, uint8_t fixed) {
+    LOG("dec mode %s, index %d = %20d\n",
+        st_names[dec->mode], dec->index, bit);
+    dec->ticks++;
+
+    switch (dec->mode) {
+    case RX_HEADER:
+#ifndef SPOOKY_PROFILE_TINY
+        /* Alternates left running after losing sync keep going
+         * until either they finish or a new header is found. */
+        if (fixed == 0 && alternates_running(dec)) {
+            step_alternates(dec, bit);
+            (void)step_header(dec, bit, fixed);
+            if (dec->mode == RX_HEADER) { resolve_alternates(dec); }
+            break;
+        }
+#endif
+        (void)step_header(dec, bit, fixed);
+        break;
+    case RX_LENGTH: (void)step_length(dec, bit, fixed); break;
+    case RX_CHKSUM: (void)step_chksum(dec, bit, fixed); break;
+    case RX_PAYLOAD:
+        if (step_payload(dec, bit)) return SPOOKY_DECODER_STEP_DONE;
+        break;
+    case RX_SYNC: (void)step_sync(dec, bit); break;
+    }
+
+    return SPOOKY_DECODER_STEP_OK;
+}
+
 /* Step the decoder, with a new bit of input.
  * If a complete message has been received, the callback
  * passed to spooky_decoder_init will be called with it. */
-enum spooky_decoder_step_res
+SPOOKY_API enum spooky_decoder_step_res
 spooky_decoder_step(struct spooky_decoder *dec, bool bit) {
-    enum spooky_decoder_step_res res = SPOOKY_DECODER_STEP_ERROR_NULL;
     if (dec == NULL) {
         LOG("step error: NULL decoder\n");
+        return SPOOKY_DECODER_STEP_ERROR_NULL;
+    }
+    return step_decoder(dec, bit, dec->fixed_interval);
+}
+
+/* Step the decoder, at a fixed interval known to the caller. */
+SPOOKY_API enum spooky_decoder_step_res
+spooky_decoder_step_fixed(struct spooky_decoder *dec, bool bit,
+        uint8_t interval) {
+    if (dec == NULL) {
+        LOG("step error: NULL decoder\n");
+        return SPOOKY_DECODER_STEP_ERROR_NULL;
+    }
+    return step_decoder(dec, bit, interval);
+}
+
+/* Step the decoder, and report whether the channel is empty. */
+SPOOKY_API enum spooky_decoder_step_res
+spooky_decoder_step_idle(struct spooky_decoder *dec, bool bit,
+        uint16_t *sleep_ticks) {
+    if (dec == NULL || sleep_ticks == NULL) {
+        return SPOOKY_DECODER_STEP_ERROR_NULL;
+    }
+    *sleep_ticks = 0;
+    bool edge = (bit != dec->last);
+    enum spooky_decoder_step_res res = spooky_decoder_step(dec, bit);
+    if (res != SPOOKY_DECODER_STEP_OK || dec->wake_listen == 0) { return res; }
+
+    /* Any edge, or a frame in progress, is activity. */
+    if (edge || dec->mode != RX_HEADER) {
+        dec->quiet = 0;
         return res;
     }
-    LOG("dec mode %s, index %d = %20d\n",
-        st_names[dec->mode], dec->index, bit);
-    dec->ticks++;
+#ifndef SPOOKY_PROFILE_TINY
+    if (alternates_running(dec)) {
+        dec->quiet = 0;
+        return res;
+    }
+#endif
+    if (++dec->quiet < dec->wake_listen) { return res; }
 
+    dec->quiet = 0;             /* listen again after waking */
+    if (dec->wake_preamble > dec->wake_listen) {
+        *sleep_ticks = dec->wake_preamble - dec->wake_listen;
+    }
+    LOG("idle, sleep for %u ticks\n", *sleep_ticks);
+    return SPOOKY_DECODER_STEP_IDLE;
+}
+
+/* Is a frame being received? */
+SPOOKY_API bool
+spooky_decoder_busy(const struct spooky_decoder *dec) {
+    if (dec == NULL) { return false; }
+    if (dec->mode != RX_HEADER) { return true; }
+#ifndef SPOOKY_PROFILE_TINY
+    if (alternates_running(dec)) { return true; }
+#endif
+    return false;
+}
+
+#ifndef SPOOKY_PROFILE_TINY
+static byte_cb sync_byte_cb;
+static byte_cb length_byte_cb;
+static byte_cb chksum_byte_cb;
+static byte_cb payload_byte_cb;
+
+/* Slice at the midpoint between the high and low signal levels.
+ * Each follows new peaks right away, and otherwise decays slowly
+ * toward the current level. They're kept as 8.8 fixed point. */
+static uint8_t track_threshold(struct spooky_decoder *dec, uint8_t level) {
+    uint16_t l = level << 8;
+    if (l > dec->soft_hi) {
+        dec->soft_hi = l;
+    } else {
+        dec->soft_hi -= (dec->soft_hi - l) >> SOFT_DECAY_SHIFT;
+    }
+    if (l < dec->soft_lo) {
+        dec->soft_lo = l;
+    } else {
+        dec->soft_lo += (l - dec->soft_lo) >> SOFT_DECAY_SHIFT;
+    }
+    return (dec->soft_hi >> 9) + (dec->soft_lo >> 9);
+}
+
+/* Slice a level into a bit, or 0 if the levels are too close
+ * together to be a signal. */
+static bool soft_slice(struct spooky_decoder *dec, uint8_t level) {
+    uint8_t threshold = track_threshold(dec, level);
+    if ((dec->soft_hi >> 8) - (dec->soft_lo >> 8) < SOFT_MIN_SWING) {
+        return false;
+    }
+    return level > threshold;
+}
+
+/* Count an edge at sample T of a bit as a misfit if it's neither near
+ * the middle (the data edge) nor near either end (a setup edge). */
+static void soft_misfit(struct spooky_decoder *dec, uint8_t t) {
+    uint8_t tol = dec->short_max - dec->interval;
+    if ((t > tol && t < dec->short_min)
+        || (t > dec->short_max && t + tol < 2*dec->interval)) {
+        if (dec->misfits < UINT8_MAX) { dec->misfits++; }
+        TRACE(dec, DEC_EDGE, t, 0, SPOOKY_TRACE_EDGE_MISFIT);
+    }
+}
+
+/* Step the decoder with a multi-level sample. */
+SPOOKY_API enum spooky_decoder_step_res
+spooky_decoder_step_soft(struct spooky_decoder *dec, uint8_t level) {
+    if (dec == NULL) {
+        LOG("step error: NULL decoder\n");
+        return SPOOKY_DECODER_STEP_ERROR_NULL;
+    }
+    bool bit = soft_slice(dec, level);
+
+    /* 4B5B payloads are read edge by edge, after slicing. */
+    if (dec->mode == RX_HEADER
+        || (dec->mode == RX_PAYLOAD && dec->line_code == SPOOKY_LINE_4B5B)) {
+        bool header = (dec->mode == RX_HEADER);
+        enum spooky_decoder_step_res res = spooky_decoder_step(dec, bit);
+        if (header && dec->mode != RX_HEADER) {
+            /* Locked on the data edge in the middle of the last
+             * header bit, which has already been counted. */
+            dec->ticks = dec->interval + 1;
+            dec->pre_ticks = SOFT_SKIP_BIT | SOFT_RECENTERED
+                | (bit ? SOFT_LAST_HIGH : 0);
+            dec->soft_acc = 0;
+            dec->soft_run = 0;
+            start_alternates(dec, 0);
+        }
+        return res;
+    }
+
+    /* ticks is the 1-based sample index within the bit. */
+    uint8_t t = dec->ticks++;
+    if (bit != dec->last) {
+        dec->soft_run = 0;
+        soft_misfit(dec, t);
+    } else if (++dec->soft_run > dec->max_run) {
+        /* Every bit has an edge in the middle, so the signal is gone
+         * (or below the squelch). */
+        LOG("### soft: too long w/out transition, resetting\n");
+        COUNT(dec, resets_long_run);
+        TRACE(dec, DEC_RESET, SPOOKY_TRACE_RESET_LONG_RUN, dec->mode,
+            dec->soft_run);
+        reset_decoder(dec);
+        return SPOOKY_DECODER_STEP_OK;
+    }
+    if (bit != dec->last && t >= dec->short_min && t <= dec->short_max
+        && !(dec->pre_ticks & SOFT_RECENTERED)) {
+        /* Re-center on the data edge, to follow clock drift. Only
+         * once per bit, so a spike right after it can't drag it. */
+        dec->ticks = dec->interval + 1;
+        dec->pre_ticks |= SOFT_RECENTERED;
+    }
+    dec->last = bit;
+
+    /* A 1 is low then high, a 0 is high then low. */
+    if (dec->ticks <= dec->interval) {
+        dec->soft_acc -= level >> 1;
+    } else {
+        dec->soft_acc += level >> 1;
+    }
+    if (dec->ticks < 2*dec->interval) { return SPOOKY_DECODER_STEP_OK; }
+
+    LOG("soft bit, acc %d\n", dec->soft_acc);
+    bool skip = dec->pre_ticks & SOFT_SKIP_BIT;
+    bool last_high = dec->pre_ticks & SOFT_LAST_HIGH;
+    bool soft_bit = dec->soft_acc > 0;
+    if (!skip) {
+        bool high = soft_bit;   /* the level it ended at */
+        if (dec->line_code == SPOOKY_LINE_DIFF_MANCHESTER) {
+            /* A 1 starts at the level the last bit ended at. */
+            soft_bit = (soft_bit != last_high);
+        }
+        last_high = high;
+    }
+    dec->ticks = 0;
+    dec->pre_ticks = (last_high ? SOFT_LAST_HIGH : 0);
+    dec->soft_acc = 0;
+    if (skip || !sink_bit(dec, soft_bit)) { return SPOOKY_DECODER_STEP_OK; }
+
+    int done = 0;
     switch (dec->mode) {
-    case RX_HEADER: (void)step_header(dec, bit); break;
-    case RX_LENGTH: (void)step_length(dec, bit); break;
-    case RX_CHKSUM: (void)step_chksum(dec, bit); break;
-    case RX_PAYLOAD:
-        if (step_payload(dec, bit)) return SPOOKY_DECODER_STEP_DONE;
+    case RX_SYNC: (void)sync_byte_cb(dec); break;
+    case RX_LENGTH: (void)length_byte_cb(dec); break;
+    case RX_CHKSUM:
+        (void)chksum_byte_cb(dec);
+        /* 4B5B starts a bit past the last data edge, which was
+         * interval - 1 samples ago (see re-centering, above). */
+        if (dec->mode == RX_PAYLOAD && dec->line_code == SPOOKY_LINE_4B5B) {
+            dec->ticks = dec->interval - 1;
+        }
         break;
+    case RX_PAYLOAD: done = payload_byte_cb(dec); break;
     }
-
-    return SPOOKY_DECODER_STEP_OK;
+    dec->bit_accum = 0x00;
+    return (done ? SPOOKY_DECODER_STEP_DONE : SPOOKY_DECODER_STEP_OK);
 }
+#endif
 
 /* Is a == (b +/- b/4)? */
 static bool approx_eq(int a, int b) {
@@ -151,53 +536,153 @@ static void append_to_ring_buffer(struct spooky_decoder *dec,
         ? MAX_POSSIBLE_DELAY : dec->ticks - offset);
     if (DEBUG) dump_ring_buffer(dec);
     dec->index++;
+    /* Skip 0 on wraparound, since it marks the first edge. */
+    if (dec->index == 0) { dec->index = RING_BUF_SZ; }
+}
+
+/* The 0x55 header byte, as the line code reads it. */
+static uint8_t sync_byte(struct spooky_decoder *dec) {
+    return (dec->line_code == SPOOKY_LINE_DIFF_MANCHESTER
+        ? HEADER_LONG_BYTE_DIFF : HEADER_LONG_BYTE);
 }
 
-STATE(step_header) {
+static int step_header(struct spooky_decoder *dec, bool bit, uint8_t fixed) {
     if (bit != dec->last) {     /* edge detected */
+        TRACE(dec, DEC_EDGE, dec->ticks, 0, SPOOKY_TRACE_EDGE_HEADER);
         append_to_ring_buffer(dec, 0);
         dec->ticks = 0;
 
         uint16_t total = 0;     /* total for average */
         uint16_t long_count = 0;
         uint16_t avg = 0;
+        int16_t skew = 0;       /* high minus low, then half avg. diff. */
 
         /* For the cells in the ring buffer, look for some that are
-         * approx. even, followed by 8 that are approx. 2x the
-         * average of the first 8. */
+         * approx. even, followed by LONG_TRANSITIONS that are approx.
+         * 2x the average of the first SHORT_TRANSITIONS.
+         *
+         * Levels alternate, so each cell's level is known from the
+         * current one. Receivers with AGC often stretch high pulses
+         * and shorten lows, so the difference between them in the
+         * short cells is taken out of the long ones. */
         uint8_t *buf = dec->buffer;
         for (int i=0; i<RING_BUF_SZ; i++) {
             uint8_t idx = (dec->index + i) & RING_BUF_MASK;
             uint8_t val = buf[idx];
             if (val == MAX_POSSIBLE_DELAY) { break; }
+            bool high = (i & 1) ? !bit : bit;   /* level before edge */
 
-            if (i < RING_BUF_SZ - 8) {
+            if (i < SHORT_TRANSITIONS) {
                 total += val;
-                if (i == RING_BUF_SZ - 8 - 1) {
-                    avg = total / (RING_BUF_SZ - 8);
+                skew += (high ? val : -val);
+                if (i == SHORT_TRANSITIONS - 1) {
+                    avg = total / SHORT_TRANSITIONS;
+                    skew /= SHORT_TRANSITIONS;
+                    if (skew > (int16_t)avg / 2) { skew = avg / 2; }
+                    if (skew < -(int16_t)avg / 2) { skew = -(int16_t)avg / 2; }
                 }
             } else if (avg > 0) {
-                if (approx_eq(val, 2*avg)) { long_count++; }
+                int16_t v = val - (high ? skew : -skew);
+                if (approx_eq(v, 2*avg)) { long_count++; }
             }
         }
 
         LOG(" ====> count %d, avg %d\n", long_count, avg);
-        if (long_count == 8) {
+        if (long_count == LONG_TRANSITIONS && fixed != 0) {
+            /* Known link rate: only lock on headers at that rate. */
+            if (approx_eq(avg, fixed)) {
+                avg = fixed;
+            } else {
+                LOG("avg %u doesn't match fixed interval %u\n", avg, fixed);
+                long_count = 0;
+            }
+        }
+        if (long_count == LONG_TRANSITIONS) {
             LOG("\n\n");
             LOG("Switching to LENGTH state, avg %u\n", avg);
+#if LONG_TRANSITIONS < 8
+            /* Locked partway through the 0x55 byte, so read
+             * the rest of it before the length. */
+            TRACE(dec, DEC_STATE, RX_HEADER, RX_SYNC, avg);
+            dec->mode = RX_SYNC;
+            dec->bit_accum = sync_byte(dec)
+                & (0xFF << (8 - LONG_TRANSITIONS));
+            dec->bit_index = 1 << (7 - LONG_TRANSITIONS);
+#else
+            TRACE(dec, DEC_STATE, RX_HEADER, RX_LENGTH, avg);
             dec->mode = RX_LENGTH;
+#endif
             dec->ticks = 0;
             dec->interval = avg;
+            dec->skew = skew;
+            LOG("pulse width skew %d\n", skew);
+            set_windows(dec, avg);
+            count_lock(dec, avg);
+            TRACE(dec, DEC_LOCK, avg, skew, SPOOKY_TRACE_LOCK_HEADER);
+#ifndef SPOOKY_PROFILE_TINY
+            start_alternates(dec, fixed ? 0 : avg);
+#endif
         }
     dec->last = bit;
     }
     return 0;
 }
 
-static bool longer_than_tolerance_allows(uint16_t t, uint16_t i) {
-    uint16_t max = i + (i / 4);
-    if (DEBUG > 1) { LOG("? %u > %u (%u)\n", t, max, i); }
-    return t > max;
+/* Clamp a window bound to what the uint8_t tick counter can reach. */
+static uint8_t clamp_ticks(uint16_t t) {
+    return (t > MAX_POSSIBLE_DELAY ? MAX_POSSIBLE_DELAY : t);
+}
+
+/* The range approx_eq accepts for B, clamped to the tick counter. */
+static void approx_window(uint16_t b, uint8_t *min, uint8_t *max) {
+    uint16_t tol = (b < 4 ? 1 : b / 4);
+    *min = clamp_ticks(b - tol);
+    *max = clamp_ticks(b + tol);
+}
+
+/* Most ticks without an edge at INTERVAL: a long run, plus slack. */
+static uint8_t max_run_ticks(uint8_t interval) {
+    uint16_t i = 2 * interval;
+    return clamp_ticks(i + (i / 4));
+}
+
+/* Precompute the accept windows for short (setup) and long (data)
+ * edges once the interval is known, so the payload path only
+ * needs compares -- no divides -- per tick. These match approx_eq
+ * for b = interval and b = 2*interval. */
+static void set_windows(struct spooky_decoder *dec, uint8_t interval) {
+    approx_window(interval, &dec->short_min, &dec->short_max);
+    approx_window(2 * interval, &dec->long_min, &dec->long_max);
+    dec->max_run = max_run_ticks(interval);
+    LOG("windows: short %u-%u, long %u-%u, max run %u\n",
+        dec->short_min, dec->short_max,
+        dec->long_min, dec->long_max, dec->max_run);
+}
+
+/* Count a header lock at INTERVAL. Every lock ends in either a frame
+ * or a false lock, counted by reset_decoder when it's abandoned (and
+ * taken back by adopt_alternate if an alternate carries it on). */
+static void count_lock(struct spooky_decoder *dec, uint8_t interval) {
+#ifdef SPOOKY_DECODER_STATS
+    uint8_t bin = interval >> SPOOKY_DECODER_STATS_BIN_SHIFT;
+    if (bin >= SPOOKY_DECODER_STATS_BINS) { bin = SPOOKY_DECODER_STATS_BINS - 1; }
+    dec->stats.locks++;
+    dec->stats.intervals[bin]++;
+#else
+    (void)dec;
+    (void)interval;
+#endif
+}
+
+/* Ticks since the last data edge, corrected for pulse width skew.
+ * Without a setup edge, the whole run was one level, which the
+ * receiver stretched (if high) or shortened (if low). After a setup
+ * edge, the run covers one of each, so the skew cancels out. */
+static uint8_t edge_ticks(struct spooky_decoder *dec, uint8_t ticks,
+        uint8_t pre_ticks, bool bit) {
+    if (pre_ticks != 0 || dec->skew == 0) { return ticks; }
+    int16_t t = ticks + (bit ? dec->skew : -dec->skew);
+    return (t < 0 ? 0 : clamp_ticks(t));
 }
 
 /* Sink a bit, and call the callback if appropriate. */
@@ -208,8 +693,11 @@ static int sink_bit_with_cb(struct spooky_decoder *dec, bool bit,
         dec->interval, dec->ticks, bit, dec->pre_ticks, dec->last, dec->bit_accum);
 
     if (bit == dec->last) {
-        if (longer_than_tolerance_allows(dec->ticks - dec->pre_ticks, 2*dec->interval)) {
+        if ((uint8_t)(dec->ticks - dec->pre_ticks) > dec->max_run) {
             LOG("### error in data stream (too long w/out transition), resetting\n");
+            COUNT(dec, resets_long_run);
+            TRACE(dec, DEC_RESET, SPOOKY_TRACE_RESET_LONG_RUN, dec->mode,
+                dec->ticks - dec->pre_ticks);
             reset_decoder(dec);
             return res;
         } else {
@@ -219,33 +707,65 @@ static int sink_bit_with_cb(struct spooky_decoder *dec, bool bit,
     if (DEBUG > 1) { LOG("TRANSITION, %d => %d\n", dec->last, bit); }
     dec->last = bit;
 
-    if (approx_eq(dec->ticks, dec->interval) && dec->pre_ticks == 0) { /* setup edge */
-        if (save_ticks) {
-            append_to_ring_buffer(dec, 0);
-            dec->pre_ticks = dec->ticks;
-        }
-    } else if (approx_eq(dec->ticks, 2*dec->interval)) { /* actual edge */
+    /* Differential Manchester: a 1 if there was no setup edge. */
+    bool data = (dec->line_code == SPOOKY_LINE_DIFF_MANCHESTER
+        ? dec->pre_ticks == 0 : bit);
+    uint8_t t = edge_ticks(dec, dec->ticks, dec->pre_ticks, bit);
+    if (t >= dec->short_min && t <= dec->short_max
+        && dec->pre_ticks == 0) { /* setup edge */
+        TRACE(dec, DEC_EDGE, t, 0, SPOOKY_TRACE_EDGE_SETUP);
+        if (save_ticks) { append_to_ring_buffer(dec, 0); }
+        dec->pre_ticks = dec->ticks;
+    } else if (t >= dec->long_min && t <= dec->long_max) { /* actual edge */
+        TRACE(dec, DEC_EDGE, t, dec->pre_ticks, SPOOKY_TRACE_EDGE_DATA);
         if (save_ticks) { append_to_ring_buffer(dec, dec->pre_ticks); }
         dec->pre_ticks = 0;
         dec->ticks = 0;
-        if (sink_bit(dec, bit)) {
+        if (sink_bit(dec, data)) {
             res = cb(dec);      /* call state-specific callback */
             dec->bit_accum = 0x00;
         }
+    } else {
+#ifndef SPOOKY_PROFILE_TINY
+        if (dec->misfits < UINT8_MAX) { dec->misfits++; }
+#endif
+        TRACE(dec, DEC_EDGE, t, dec->pre_ticks, SPOOKY_TRACE_EDGE_MISFIT);
     }
     return res;
 }
 
+static int sync_byte_cb(struct spooky_decoder *dec) {
+    TRACE(dec, DEC_BYTE, RX_SYNC, dec->bit_accum, 0);
+    if (dec->bit_accum == sync_byte(dec)) {
+        TRACE(dec, DEC_STATE, RX_SYNC, RX_LENGTH, dec->interval);
+        dec->mode = RX_LENGTH;
+    } else {
+        LOG("bad sync byte 0x%02x, aborting\n", dec->bit_accum);
+        COUNT(dec, resets_bad_sync);
+        TRACE(dec, DEC_RESET, SPOOKY_TRACE_RESET_BAD_SYNC, RX_SYNC,
+            dec->bit_accum);
+        reset_decoder(dec);
+    }
+    return 0;
+}
+
 static int length_byte_cb(struct spooky_decoder *dec) {
     dec->payload_length = dec->bit_accum;
     LOG("got length of 0x%02x\n", dec->payload_length);
+    TRACE(dec, DEC_BYTE, RX_LENGTH, dec->bit_accum, 0);
     if (dec->payload_length > dec->buffer_size) {
         LOG("input too large for buffer, aborting\n");
+        COUNT(dec, resets_too_long);
+        TRACE(dec, DEC_RESET, SPOOKY_TRACE_RESET_TOO_LONG, RX_LENGTH,
+            dec->payload_length);
         reset_decoder(dec);
     } else if (dec->payload_length == 0) {
         LOG("length of 0, aborting\n");
+        COUNT(dec, resets_zero_length);
+        TRACE(dec, DEC_RESET, SPOOKY_TRACE_RESET_ZERO_LENGTH, RX_LENGTH, 0);
         reset_decoder(dec);
     } else {
+        TRACE(dec, DEC_STATE, RX_LENGTH, RX_CHKSUM, dec->interval);
         dec->mode = RX_CHKSUM;
     }
     return 0;
@@ -254,7 +774,10 @@ static int length_byte_cb(struct spooky_decoder *dec) {
 static int chksum_byte_cb(struct spooky_decoder *dec) {
     dec->chksum = dec->bit_accum;
     LOG("got checksum of 0x%02x\n", dec->chksum);
+    TRACE(dec, DEC_BYTE, RX_CHKSUM, dec->chksum, 0);
+    TRACE(dec, DEC_STATE, RX_CHKSUM, RX_PAYLOAD, dec->interval);
     dec->index = 0;
+    dec->symbol = 1;
     dec->mode = RX_PAYLOAD;
     return 0;
 }
@@ -262,21 +785,50 @@ static int chksum_byte_cb(struct spooky_decoder *dec) {
 static int payload_byte_cb(struct spooky_decoder *dec) {
     uint8_t byte = dec->bit_accum;
     LOG("got byte: 0x%02x\n", byte);
+    TRACE(dec, DEC_BYTE, RX_PAYLOAD, byte, 0);
+    if (dec->index == 0 && ((byte ^ dec->address) & dec->address_mask)) {
+        LOG("frame for address 0x%02x, dropping\n", byte);
+        COUNT(dec, resets_address);
+        TRACE(dec, DEC_RESET, SPOOKY_TRACE_RESET_ADDRESS, RX_PAYLOAD, byte);
+        reset_decoder(dec);
+        return 0;
+    }
     dec->buffer[dec->index] = byte;
+#ifdef SPOOKY_DECODER_STREAM
+    if (dec->byte_cb != NULL) {
+        dec->byte_cb(byte, dec->index, dec->payload_length, CB_UDATA(dec));
+    }
+#endif
     dec->index++;
     LOG("index: %u of %u\n", dec->index, dec->payload_length);
     if (dec->index == dec->payload_length) {
         uint8_t cs = checksum(dec->buffer, dec->payload_length);
         LOG("expected 0x%02x, got 0x%02x\n", cs, dec->chksum);
+#ifdef SPOOKY_DECODER_STREAM
+        end_stream(dec, cs == dec->chksum);
+#endif
         if (cs == dec->chksum) {
             LOG("success! got %d bytes\n", dec->index);
+            COUNT(dec, frames);
+            TRACE(dec, DEC_RESET, SPOOKY_TRACE_RESET_FRAME, RX_PAYLOAD,
+                dec->index);
+#ifdef SPOOKY_DECODER_FIXED_CB
+            SPOOKY_DECODER_FIXED_CB(dec->buffer, dec->index, (void *)dec);
+#else
             dec->cb(dec->buffer, dec->index, dec->cb_udata);
+#endif
         } else {
             LOG("checksum failure, expected 0x%02x, got 0x%02x\n",
                 dec->chksum, cs);
+            COUNT(dec, chksum_failures);
+            TRACE(dec, DEC_RESET, SPOOKY_TRACE_RESET_CHKSUM, RX_PAYLOAD, cs);
         }
-        reset_decoder(dec);
         dec->index = 0;
+        if (cs == dec->chksum) {
+            reset_state(dec);
+        } else {
+            reset_decoder(dec);
+        }
         /* It could reset the buffer here, but setting the index to
          * 0 will add a MAX_POSSIBLE_DELAY value to the ring buffer,
          * preventing false matches anyway. */
@@ -285,16 +837,246 @@ static int payload_byte_cb(struct spooky_decoder *dec) {
     return 0;
 }
 
+/* Read the rest of the 0x55 header byte. */
+STATE(step_sync) { return sink_bit_with_cb(dec, bit, sync_byte_cb, true); }
+
+#ifndef SPOOKY_PROFILE_TINY
+#define LENGTH_AND_CHKSUM_BITS 16
+
+/* Start reading the length and checksum at alternate intervals, a
+ * window's width (interval/4) to either side of INTERVAL, so together
+ * they cover timing the measured interval's windows would miss.
+ * An INTERVAL of 0 disables them. */
+static void start_alternates(struct spooky_decoder *dec, uint8_t interval) {
+    uint8_t tol = (interval < 4 ? 1 : interval / 4);
+    memset(dec->alts, 0, sizeof(dec->alts));
+    dec->misfits = 0;
+    if (interval == 0) { return; }
+    dec->alts[0].interval = interval - tol;
+    if (interval <= MAX_POSSIBLE_DELAY / 2 - tol) {
+        dec->alts[1].interval = interval + tol;
+    }
+    for (int i=0; i<SPOOKY_DECODER_ALTERNATES; i++) {
+        struct spooky_decoder_alt *a = &dec->alts[i];
+        if (a->interval == 0) { continue; }
+        approx_window(a->interval, &a->short_min, &a->short_max);
+        approx_window(2 * a->interval, &a->long_min, &a->long_max);
+        a->max_run = max_run_ticks(a->interval);
+    }
+}
+
+static bool alternates_running(const struct spooky_decoder *dec) {
+    for (int i=0; i<SPOOKY_DECODER_ALTERNATES; i++) {
+        if (dec->alts[i].interval != 0) { return true; }
+    }
+    return false;
+}
+
+/* Step each alternate that's still in the running, like
+ * sink_bit_with_cb. Must be called before dec->last is updated. */
+static void step_alternates(struct spooky_decoder *dec, bool bit) {
+    for (int i=0; i<SPOOKY_DECODER_ALTERNATES; i++) {
+        struct spooky_decoder_alt *a = &dec->alts[i];
+        if (a->interval == 0 || a->bits == LENGTH_AND_CHKSUM_BITS) { continue; }
+        a->ticks++;
+
+        if (bit == dec->last) {
+            if ((uint8_t)(a->ticks - a->pre_ticks) > a->max_run) {
+                LOG("alternate %u lost sync\n", a->interval);
+                a->interval = 0;
+            }
+            continue;
+        }
+        uint8_t t = edge_ticks(dec, a->ticks, a->pre_ticks, bit);
+        if (t >= a->short_min && t <= a->short_max && a->pre_ticks == 0) {
+            a->pre_ticks = a->ticks;
+        } else if (t >= a->long_min && t <= a->long_max) {
+            bool data = (dec->line_code == SPOOKY_LINE_DIFF_MANCHESTER
+                ? a->pre_ticks == 0 : bit);
+            a->ticks = 0;
+            a->pre_ticks = 0;
+            a->accum = (a->accum << 1) | data;
+            a->bits++;
+            if (a->bits == 8 && (a->accum == 0 || a->accum > dec->buffer_size)) {
+                LOG("alternate %u got bad length\n", a->interval);
+                a->interval = 0;
+            }
+        } else if (a->misfits < UINT8_MAX) {
+            a->misfits++;
+        }
+    }
+}
+
+/* Switch to alternate A, which has read the length and checksum, and
+ * continue with the payload. */
+static void adopt_alternate(struct spooky_decoder *dec,
+        struct spooky_decoder_alt *a) {
+    LOG("switching to alternate interval %u\n", a->interval);
+#ifdef SPOOKY_DECODER_STATS
+    /* If the measured interval lost sync, reset_decoder counted this
+     * lock as false, but it's ending in a frame after all. */
+    if (dec->mode == RX_HEADER && dec->stats.false_locks > 0) {
+        dec->stats.false_locks--;
+    }
+#endif
+    TRACE(dec, DEC_STATE, dec->mode, RX_PAYLOAD, a->interval);
+    TRACE(dec, DEC_LOCK, a->interval, dec->skew, SPOOKY_TRACE_LOCK_ALTERNATE);
+    dec->mode = RX_PAYLOAD;
+    dec->interval = a->interval;
+    set_windows(dec, a->interval);
+    dec->ticks = a->ticks;
+    dec->pre_ticks = a->pre_ticks;
+    dec->payload_length = (uint8_t)(a->accum >> 8);
+    dec->chksum = (uint8_t)a->accum;
+    dec->index = 0;
+    dec->bit_accum = 0x00;
+    dec->bit_index = 0x80;
+    dec->symbol = 1;
+}
+
+/* Decide whether to switch to an alternate interval that has read the
+ * length and checksum. If the measured interval lost sync earlier (and
+ * the decoder is looking for a header again) or is still reading them,
+ * the alternate got there first, so it's more likely right. If both
+ * just finished, only switch if the alternate fit the edges better. */
+static void resolve_alternates(struct spooky_decoder *dec) {
+    bool done = (dec->mode == RX_PAYLOAD);
+    struct spooky_decoder_alt *best = NULL;
+    for (int i=0; i<SPOOKY_DECODER_ALTERNATES; i++) {
+        struct spooky_decoder_alt *a = &dec->alts[i];
+        if (a->interval == 0 || a->bits < LENGTH_AND_CHKSUM_BITS) { continue; }
+        if (done && a->misfits >= dec->misfits) { continue; }
+        if (best == NULL || a->misfits < best->misfits) { best = a; }
+    }
+    if (best != NULL) { adopt_alternate(dec, best); }
+    if (dec->mode == RX_PAYLOAD) { start_alternates(dec, 0); }
+}
+
+/* Step the length or checksum state, along with the alternates, if
+ * the interval isn't FIXED (so there are none). */
+static int step_with_alternates(struct spooky_decoder *dec, bool bit,
+        byte_cb *cb, uint8_t fixed) {
+    if (fixed != 0) { return sink_bit_with_cb(dec, bit, cb, true); }
+    step_alternates(dec, bit);
+    int res = sink_bit_with_cb(dec, bit, cb, true);
+    resolve_alternates(dec);
+    return res;
+}
+#else
+#define step_with_alternates(DEC, BIT, CB, FIXED) \
+    sink_bit_with_cb(DEC, BIT, CB, true)
+#endif
+
 /* Read a length byte. */
-STATE(step_length) { return sink_bit_with_cb(dec, bit, length_byte_cb, true); }
+static int step_length(struct spooky_decoder *dec, bool bit, uint8_t fixed) {
+    return step_with_alternates(dec, bit, length_byte_cb, fixed);
+}
 
 /* Read a checksum byte. */
-STATE(step_chksum) { return sink_bit_with_cb(dec, bit, chksum_byte_cb, true); }
+static int step_chksum(struct spooky_decoder *dec, bool bit, uint8_t fixed) {
+    return step_with_alternates(dec, bit, chksum_byte_cb, fixed);
+}
+
+/* Add a 4B5B cell to the symbol, and the symbol's nibble to the byte
+ * once it's complete. Returns -1 for a symbol that's never sent, or
+ * else whether the payload is done. */
+static int sink_cell(struct spooky_decoder *dec, bool one) {
+    dec->symbol = (dec->symbol << 1) | one;
+    if (!(dec->symbol & (1 << SYMBOL_CELLS))) { return 0; }
+    uint8_t nibble = nibble_4b5b[dec->symbol & ((1 << SYMBOL_CELLS) - 1)];
+    dec->symbol = 1;
+    if (nibble == NO_NIBBLE) { return -1; }
+    if (dec->bit_index == 0x80) {
+        dec->bit_accum = nibble << 4;
+        dec->bit_index = 0x08;
+        return 0;
+    }
+    dec->bit_accum |= nibble;
+    dec->bit_index = 0x80;
+    int res = payload_byte_cb(dec);
+    dec->bit_accum = 0x00;
+    return res;
+}
+
+/* Read a 4B5B payload. Each edge ends a run of one to MAX_RUN_CELLS
+ * cells: all 0 cells, except the 1 cell with the edge. */
+static int step_payload_4b5b(struct spooky_decoder *dec, bool bit) {
+    uint8_t i = dec->interval;
+    if (i > SPOOKY_LINE_4B5B_MAX_INTERVAL) {
+        LOG("interval %u too long for 4B5B, resetting\n", i);
+        COUNT(dec, resets_long_run);
+        TRACE(dec, DEC_RESET, SPOOKY_TRACE_RESET_LONG_RUN, RX_PAYLOAD, i);
+        reset_decoder(dec);
+        return 0;
+    }
+    uint8_t half = i / 2;
+    if (bit == dec->last) {
+        if (dec->ticks > MAX_RUN_CELLS * i + half) {
+            LOG("### error in data stream (too long w/out transition), resetting\n");
+            COUNT(dec, resets_long_run);
+            TRACE(dec, DEC_RESET, SPOOKY_TRACE_RESET_LONG_RUN, RX_PAYLOAD,
+                dec->ticks);
+            reset_decoder(dec);
+        }
+        return 0;
+    }
+    dec->last = bit;
+
+    /* Round to the nearest whole number of cells. */
+    uint8_t t = edge_ticks(dec, dec->ticks, 0, bit);
+    uint8_t cells = 0;
+    for (uint16_t bound = i - half; t >= bound; bound += i) {
+        if (++cells > MAX_RUN_CELLS) { break; }
+    }
+    if (cells == 0) {
+#ifndef SPOOKY_PROFILE_TINY
+        if (dec->misfits < UINT8_MAX) { dec->misfits++; }
+#endif
+        TRACE(dec, DEC_EDGE, t, 0, SPOOKY_TRACE_EDGE_MISFIT);
+        return 0;
+    }
+    TRACE(dec, DEC_EDGE, t, cells, SPOOKY_TRACE_EDGE_DATA);
+    dec->ticks = 0;
+
+    int res = 0;
+    for (uint8_t c = 1; c <= cells && res == 0; c++) {
+        res = sink_cell(dec, c == cells);
+        /* Dropped (e.g. for its address): the rest isn't ours. */
+        if (res == 0 && dec->mode != RX_PAYLOAD) { return 0; }
+    }
+    if (res < 0 || cells > MAX_RUN_CELLS) {
+        LOG("### bad 4B5B symbol, resetting\n");
+        COUNT(dec, resets_bad_symbol);
+        TRACE(dec, DEC_RESET, SPOOKY_TRACE_RESET_BAD_SYMBOL, RX_PAYLOAD, t);
+        reset_decoder(dec);
+        return 0;
+    }
+    return res;
+}
 
 /* Read the data payload. */
-STATE(step_payload) { return sink_bit_with_cb(dec, bit, payload_byte_cb, false); }
+STATE(step_payload) {
+    if (dec->line_code == SPOOKY_LINE_4B5B) { return step_payload_4b5b(dec, bit); }
+    return sink_bit_with_cb(dec, bit, payload_byte_cb, false);
+}
 
+/* Give up on the current frame, if any, and look for a header. */
 static void reset_decoder(struct spooky_decoder *dec) {
+    if (dec->mode != RX_HEADER) { COUNT(dec, false_locks); }
+    reset_state(dec);
+}
+
+/* Look for a header, without counting a false lock (after a frame). */
+static void reset_state(struct spooky_decoder *dec) {
+#ifdef SPOOKY_TRACE
+    if (dec->mode != RX_HEADER) {
+        TRACE(dec, DEC_STATE, dec->mode, RX_HEADER, dec->interval);
+    }
+#endif
+#ifdef SPOOKY_DECODER_STREAM
+    /* Cut off partway through the payload. */
+    if (dec->mode == RX_PAYLOAD && dec->index > 0) { end_stream(dec, false); }
+#endif
     dec->mode = RX_HEADER;
     dec->ticks = 0;
     dec->bit_index = 0x80;
@@ -302,6 +1084,11 @@ static void reset_decoder(struct spooky_decoder *dec) {
     dec->bit_accum = 0x00;
     dec->payload_length = 0x00;
     dec->pre_ticks = 0;
+    dec->short_min = dec->short_max = 0;
+    dec->long_min = dec->long_max = 0;
+    dec->max_run = 0;
+    dec->skew = 0;
+    dec->symbol = 1;
     /* Note: Intentionally not resetting the buffer or dec->last here,
      * so that a signal preceded by a false header won't be missed. */
 }
@@ -326,6 +1113,6 @@ static int sink_bit(struct spooky_decoder *dec, bool bit) {
 /* 8-bit sum-and-invert checksum */
 static uint8_t checksum(uint8_t *buf, size_t size) {
     uint8_t res = 0;
-    for (int i=0; i<size; i++) { res += buf[i]; }
+    for (size_t i=0; i<size; i++) { res += buf[i]; }
     return ~res;
 }
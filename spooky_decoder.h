@@ -5,16 +5,128 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+#include "spooky_trace.h"
+#include "spooky_line_code.h"
+
+/* Linkage for the public functions. The generated single-header
+ * build (see 'make spooky.h') defines this as 'static inline'. */
+#ifndef SPOOKY_API
+#define SPOOKY_API
+#endif
+
+/* Build-time profiles:
+ *
+ * SPOOKY_PROFILE_TINY: for ATtiny-class parts with very little RAM.
+ *     Halves the clock recovery ring (and so the minimum buffer), and
+ *     uses an 8-bit buffer index. Header detection is a bit less
+ *     picky, so more false headers get as far as the checksum, and
+ *     alternate intervals aren't tried (see spooky_decoder_step).
+ *
+ * SPOOKY_DECODER_FIXED_CB: if defined as the name of a function of
+ *     type spooky_decoder_cb, it is called directly with each message
+ *     (and the decoder as udata), and the callback pointer and udata
+ *     are dropped from the struct. The callback passed to init is ignored,
+ *     so spooky_channelizer and spooky_pipeline, which pass their own,
+ *     don't work with it.
+ *
+ * SPOOKY_DECODER_STATS: keep counters of frames, failures, resets, and
+ *     header locks in the decoder (see spooky_decoder_read_stats), for
+ *     telling radio problems from software ones in the field. Off by
+ *     default, since they cost RAM and a few cycles per event.
+ *
+ * SPOOKY_DECODER_STREAM: pass each payload byte to a callback as it
+ *     arrives, then report whether the checksum matched, so the caller
+ *     can start on a frame before it's complete (see
+ *     spooky_decoder_set_stream). Off by default, since it costs two
+ *     pointers per decoder and a few cycles per byte.
+ *
+ * SPOOKY_TRACE: keep a ring of recent events, see spooky_trace.h. */
+#ifdef SPOOKY_PROFILE_TINY
+#define SPOOKY_DECODER_RING_BITS 3
+#else
+#define SPOOKY_DECODER_RING_BITS 4
+#endif
+
 /* The smallest a buffer can be and still have space for clock recovery. */
-#define SPOOKY_DECODER_MIN_BUFFER_SIZE 16
+#define SPOOKY_DECODER_MIN_BUFFER_SIZE (1 << SPOOKY_DECODER_RING_BITS)
 #define SPOOKY_DECODER_MAX_BUFFER_SIZE 255
 
 /* Callback, called when data is received.
  * UDATA is an arbitrary pointer for user data. */
 typedef void (spooky_decoder_cb)(uint8_t *data, uint8_t data_size, void *udata);
 
+#ifdef SPOOKY_DECODER_FIXED_CB
+spooky_decoder_cb SPOOKY_DECODER_FIXED_CB;
+#endif
+
+#ifdef SPOOKY_DECODER_STREAM
+/* Streaming callbacks. BYTE_CB is called with each payload byte, at
+ * offset INDEX in a payload of LENGTH bytes, before the checksum has
+ * been checked. END_CB is called once after the last byte passed to
+ * BYTE_CB, with whether the frame was good: OK is false if the
+ * checksum didn't match or the frame was cut off. For a good frame,
+ * the frame callback is called after END_CB, as usual. UDATA is the
+ * frame callback's udata (the decoder with SPOOKY_DECODER_FIXED_CB). */
+typedef void (spooky_decoder_byte_cb)(uint8_t byte, uint8_t index,
+    uint8_t length, void *udata);
+typedef void (spooky_decoder_end_cb)(bool ok, void *udata);
+#endif
+
+#ifndef SPOOKY_PROFILE_TINY
+/* Alternate intervals tried alongside the one measured from the
+ * header, while reading the length and checksum. */
+#define SPOOKY_DECODER_ALTERNATES 2
+
+/* State for an alternate interval. */
+struct spooky_decoder_alt {
+    uint8_t interval;           /* interval, or 0 if ruled out */
+    uint8_t short_min;          /* its setup edge window... */
+    uint8_t short_max;
+    uint8_t long_min;           /* ...data edge window... */
+    uint8_t long_max;
+    uint8_t max_run;            /* ...and most ticks w/out an edge */
+    uint8_t ticks;              /* ticks since last data edge */
+    uint8_t pre_ticks;          /* tick count at setup edge */
+    uint8_t bits;               /* bits of length and checksum read */
+    uint16_t accum;             /* length and checksum bits, so far */
+    uint8_t misfits;            /* edges that fit neither window */
+};
+#endif
+
+#ifdef SPOOKY_DECODER_STATS
+/* Bins in the histogram of recovered intervals. Bin N counts locks at
+ * intervals from N << SHIFT up to ((N + 1) << SHIFT) - 1; the last
+ * also counts any above that. */
+#ifndef SPOOKY_DECODER_STATS_BINS
+#define SPOOKY_DECODER_STATS_BINS 16
+#endif
+#ifndef SPOOKY_DECODER_STATS_BIN_SHIFT
+#define SPOOKY_DECODER_STATS_BIN_SHIFT 2
+#endif
+
+/* Event counters. These wrap around, so read (and clear) them often
+ * enough that they can't wrap in between. */
+struct spooky_decoder_stats {
+    uint16_t frames;            /* delivered to the callback */
+    uint16_t chksum_failures;   /* complete payloads with a bad checksum */
+    uint16_t resets_long_run;   /* too long without a transition */
+    uint16_t resets_zero_length;    /* length byte of 0 */
+    uint16_t resets_too_long;   /* length byte over the buffer size */
+    uint16_t resets_bad_sync;   /* rest of 0x55 didn't match (tiny only) */
+    uint16_t resets_address;    /* first payload byte for another node */
+    uint16_t resets_bad_symbol; /* 4B5B payload code violations */
+    uint16_t locks;             /* headers locked */
+    uint16_t false_locks;       /* locks that didn't end in a frame */
+    uint16_t intervals[SPOOKY_DECODER_STATS_BINS];  /* locks, by interval */
+};
+#endif
+
 struct spooky_decoder {
+#ifdef SPOOKY_PROFILE_TINY
+    uint8_t index;              /* current index in buffer */
+#else
     uint16_t index;             /* current index in buffer */
+#endif
     uint8_t buffer_size;        /* buffer size, in bytes */
     uint8_t mode;               /* current state */
     uint8_t ticks;              /* ticks since last logic level change */
@@ -26,10 +138,46 @@ struct spooky_decoder {
     uint8_t chksum;             /* sum-and-invert checksum for payload */
     uint8_t pre_ticks;          /* tick count during setup part of bit frame */
 
+    /* accept windows for edge timing, precomputed from interval */
+    uint8_t short_min;          /* shortest setup edge, in ticks */
+    uint8_t short_max;          /* longest setup edge, in ticks */
+    uint8_t long_min;           /* shortest data edge, in ticks */
+    uint8_t long_max;           /* longest data edge, in ticks */
+    uint8_t max_run;            /* most ticks allowed w/out a transition */
+    uint8_t fixed_interval;     /* known interval, or 0 to recover it */
+    uint8_t address;            /* first payload byte to accept... */
+    uint8_t address_mask;       /* ...in these bits, or 0 for any */
+    uint16_t wake_preamble;     /* senders' wake-up preamble, in ticks */
+    uint8_t wake_listen;        /* quiet ticks before sleeping, or 0 */
+    uint8_t quiet;              /* ticks without an edge, while idle */
+    int8_t skew;                /* high pulses' stretch, from header */
+    uint8_t line_code;          /* enum spooky_line_code */
+    uint8_t symbol;             /* 4B5B cells so far, after a leading 1 */
+#ifndef SPOOKY_PROFILE_TINY
+    uint16_t soft_lo;           /* soft decoding: low level, 8.8 fixed */
+    uint16_t soft_hi;           /* soft decoding: high level, 8.8 fixed */
+    int16_t soft_acc;           /* soft decoding: 2nd - 1st half of bit */
+    uint8_t soft_run;           /* soft decoding: samples w/out an edge */
+    uint8_t misfits;            /* edges that fit neither window */
+    struct spooky_decoder_alt alts[SPOOKY_DECODER_ALTERNATES];
+#endif
+#ifdef SPOOKY_DECODER_STATS
+    struct spooky_decoder_stats stats;
+#endif
+#ifdef SPOOKY_DECODER_STREAM
+    spooky_decoder_byte_cb *byte_cb;    /* each payload byte, or NULL */
+    spooky_decoder_end_cb *end_cb;      /* end of streamed frame, or NULL */
+#endif
+#ifdef SPOOKY_TRACE
+    struct spooky_trace trace;  /* see spooky_trace.h */
+#endif
+
     /* internal buffer, used for clock recovery and to accumulate payload */
     uint8_t *buffer;
+#ifndef SPOOKY_DECODER_FIXED_CB
     spooky_decoder_cb *cb;      /* callback for successful data RX */
     void *cb_udata;             /* void * userdata for callback */
+#endif
 };
 
 enum spooky_decoder_init_res {
@@ -41,19 +189,126 @@ enum spooky_decoder_init_res {
 enum spooky_decoder_step_res {
     SPOOKY_DECODER_STEP_OK = 0,
     SPOOKY_DECODER_STEP_DONE = 1,
+    SPOOKY_DECODER_STEP_IDLE = 2,
     SPOOKY_DECODER_STEP_ERROR_NULL = -1,
 };
 
 /* Initialize a spooky decoder. */
-enum spooky_decoder_init_res
+SPOOKY_API enum spooky_decoder_init_res
 spooky_decoder_init(struct spooky_decoder *dec,
     uint8_t *output_buffer, size_t buffer_size,
     spooky_decoder_cb *cb, void *udata);
 
+/* Pin the decoder to a known interval (ticks between single edges,
+ * i.e., the encoder's TX_RATE times the oversampling ratio), so only
+ * headers at that rate will lock. An INTERVAL of 0 (the default)
+ * restores clock recovery. */
+SPOOKY_API enum spooky_decoder_init_res
+spooky_decoder_fix_interval(struct spooky_decoder *dec, uint8_t interval);
+
+/* Only accept frames whose first payload byte matches ADDRESS in the
+ * bits set in MASK (e.g. a device ID). Other frames are dropped as
+ * soon as that byte arrives, and the decoder goes back to looking for
+ * a header, rather than reading the rest of a frame meant for another
+ * node. A MASK of 0 (the default) accepts every frame. */
+SPOOKY_API enum spooky_decoder_init_res
+spooky_decoder_set_address(struct spooky_decoder *dec,
+    uint8_t address, uint8_t mask);
+
+/* Line code after the header (see spooky_line_code.h), which has to
+ * match the sender's. Change it between frames. */
+SPOOKY_API enum spooky_decoder_init_res
+spooky_decoder_set_line_code(struct spooky_decoder *dec,
+    enum spooky_line_code code);
+
+/* Skip header detection, and start reading the length byte as if a
+ * header at INTERVAL had just ended on an edge to LEVEL. This is for
+ * callers that found the header some other way, e.g. the correlator
+ * in spooky_correlator.h. */
+SPOOKY_API enum spooky_decoder_init_res
+spooky_decoder_lock(struct spooky_decoder *dec, uint8_t interval, bool level);
+
+#ifdef SPOOKY_DECODER_STATS
+/* Copy the decoder's counters to *STATS, and zero them if CLEAR. */
+SPOOKY_API enum spooky_decoder_init_res
+spooky_decoder_read_stats(struct spooky_decoder *dec,
+    struct spooky_decoder_stats *stats, bool clear);
+#endif
+
+#ifdef SPOOKY_DECODER_STREAM
+/* Set (or with NULL, clear) the streaming callbacks, see
+ * spooky_decoder_byte_cb. Either can be NULL. Changing them in the
+ * middle of a frame's payload may leave that frame without an
+ * END_CB call. */
+SPOOKY_API enum spooky_decoder_init_res
+spooky_decoder_set_stream(struct spooky_decoder *dec,
+    spooky_decoder_byte_cb *byte_cb, spooky_decoder_end_cb *end_cb);
+#endif
+
 /* Step the decoder, with a new bit of input.
  * If a complete message has been received, the callback
- * passed to spooky_decoder_init will be called with it. */
-enum spooky_decoder_step_res
+ * passed to spooky_decoder_init will be called with it.
+ *
+ * Unless the interval is fixed, the length and checksum are also read
+ * at a slightly shorter and longer interval than the header measured.
+ * If the measured interval loses sync, or an alternate fits the edges
+ * better, the decoder switches to it rather than dropping the frame. */
+SPOOKY_API enum spooky_decoder_step_res
 spooky_decoder_step(struct spooky_decoder *dec, bool bit);
 
+/* Step the decoder as with spooky_decoder_step, after
+ * spooky_decoder_fix_interval(DEC, INTERVAL). In the single-header
+ * build (spooky.h), a constant INTERVAL is folded into the inlined
+ * step, and a non-zero one drops the alternates' per-tick work. */
+SPOOKY_API enum spooky_decoder_step_res
+spooky_decoder_step_fixed(struct spooky_decoder *dec, bool bit,
+    uint8_t interval);
+
+/* Duty-cycled receive, for battery-powered receivers. LISTEN is how
+ * many ticks without an edge, while looking for a header, count as an
+ * empty channel; it should be more than twice the longest interval
+ * expected. PREAMBLE is the length of the transmitters' wake-up
+ * preamble (see spooky_encoder_set_preamble), in this decoder's
+ * ticks. A LISTEN of 0 (the default) turns it off. */
+SPOOKY_API enum spooky_decoder_init_res
+spooky_decoder_set_wakeup(struct spooky_decoder *dec,
+    uint16_t preamble, uint8_t listen);
+
+/* Step the decoder, as with spooky_decoder_step, but return IDLE when
+ * the channel has been empty for the LISTEN ticks set with
+ * spooky_decoder_set_wakeup (and nothing is being decoded). Then
+ * *SLEEP_TICKS is how many ticks the caller may skip (sleeping, or
+ * turning the receiver off) before the next call, and still be
+ * listening before a transmitter's wake-up preamble is over; it is
+ * PREAMBLE - LISTEN, or 0 if the preamble is shorter than that. After
+ * waking, keep stepping every tick until it returns IDLE again.
+ * Otherwise, *SLEEP_TICKS is 0. */
+SPOOKY_API enum spooky_decoder_step_res
+spooky_decoder_step_idle(struct spooky_decoder *dec, bool bit,
+    uint16_t *sleep_ticks);
+
+/* Whether DEC is in the middle of a frame: it has locked onto a
+ * header, or an alternate interval is still reading one after the
+ * measured interval lost sync. Nodes sharing a channel can check it
+ * before starting to send, so they don't talk over each other. */
+SPOOKY_API bool
+spooky_decoder_busy(const struct spooky_decoder *dec);
+
+#ifndef SPOOKY_PROFILE_TINY
+/* Step the decoder with a multi-level sample (e.g. an ADC reading of
+ * the receiver's analog output or RSSI), instead of a bit. Use this
+ * OR spooky_decoder_step with a given decoder, not both.
+ *
+ * The header is found by slicing at the midpoint of the tracked high
+ * and low levels, as usual. After that, each bit is decided by which
+ * half of the bit period has more energy, so one noisy sample no
+ * longer moves or adds an edge. Data edges near the expected point
+ * re-center the bit clock; edges near neither it nor the ends of the
+ * bit count as misfits, and no edge for longer than a bit means the
+ * signal is gone, so it goes back to looking for a header. Not
+ * available in SPOOKY_PROFILE_TINY. */
+SPOOKY_API enum spooky_decoder_step_res
+spooky_decoder_step_soft(struct spooky_decoder *dec, uint8_t level);
+#endif
+
 #endif
@@ -24,11 +24,22 @@ typedef enum {
     TX_LENGTH,                  /* header: length */
     TX_CHKSUM,                  /* header: checksum */
     TX_PAYLOAD,                 /* message */
+    TX_GAP,                     /* idle, before repeating the message */
 } tx_mode;
 
 #define HEADER_SHARP_TRANSITIONS 8
 #define HEADER_LONG_TRANSITIONS 4
 
+/* Cells per byte and per nibble, for 4B5B. */
+#define CELLS_4B5B 10
+#define SYMBOL_CELLS 5
+
+/* 4B5B symbols (as in FDDI), high cell first. */
+static const uint8_t sym_4b5b[16] = {
+    0x1E, 0x09, 0x14, 0x15, 0x0A, 0x0B, 0x0E, 0x0F,
+    0x12, 0x13, 0x16, 0x17, 0x1A, 0x1B, 0x1C, 0x1D,
+};
+
 #if 0
 #include <stdio.h>
 #define LOG(...) printf("e: " __VA_ARGS__)
@@ -36,11 +47,18 @@ typedef enum {
 #define LOG(...)
 #endif
 
+#define TRACE(OBJ, TYPE, A, B, C) \
+    SPOOKY_TRACE_EVENT(&(OBJ)->trace, SPOOKY_TRACE_##TYPE, A, B, C)
+
 static uint8_t calc_chksum(uint8_t *buf, size_t length);
 static enum spooky_encoder_step_res encode_bit(uint8_t bit, uint8_t index);
+static enum spooky_encoder_step_res encode_cell_4b5b(struct spooky_encoder *enc);
+static enum spooky_encoder_step_res encode_frame_bit(struct spooky_encoder *enc,
+    uint8_t bit, uint8_t index);
+static void end_frame(struct spooky_encoder *enc);
 
 /* Initialize an encoder. */
-enum spooky_encoder_init_res
+SPOOKY_API enum spooky_encoder_init_res
 spooky_encoder_init(struct spooky_encoder *enc,
                     uint8_t *buffer, uint8_t buffer_size, uint8_t tx_rate) {
     if ((enc == NULL) || (buffer == NULL)) {
@@ -54,15 +72,82 @@ spooky_encoder_init(struct spooky_encoder *enc,
     enc->buffer = buffer;
     enc->buffer_size = buffer_size;
     enc->tx_rate = tx_rate;
+    enc->repeat = 1;
     enc->mode = TX_NONE;
     LOG("initialized %p with buffer %p (%u bytes), rate %u\n",
         (void*)enc, (void*)buffer, buffer_size, tx_rate);
     return SPOOKY_ENCODER_INIT_OK;
 }
 
+/* Set the TX rate, between messages. */
+SPOOKY_API enum spooky_encoder_init_res
+spooky_encoder_set_rate(struct spooky_encoder *enc, uint8_t tx_rate) {
+    if (enc == NULL) { return SPOOKY_ENCODER_INIT_ERROR_NULL; }
+    if (enc->mode != TX_NONE) { return SPOOKY_ENCODER_INIT_ERROR_BUSY; }
+    if (tx_rate == 0 || abs(enc->trim) >= tx_rate) {
+        return SPOOKY_ENCODER_INIT_ERROR_BAD_ARGUMENT;
+    }
+    if (tx_rate != enc->tx_rate) {
+        LOG("rate %u -> %u\n", enc->tx_rate, tx_rate);
+        enc->tx_rate = tx_rate;
+        enc->ticks = 0;
+    }
+    return SPOOKY_ENCODER_INIT_OK;
+}
+
+/* Set the pre-emphasis. */
+SPOOKY_API enum spooky_encoder_init_res
+spooky_encoder_set_trim(struct spooky_encoder *enc, int8_t high_trim) {
+    if (enc == NULL) { return SPOOKY_ENCODER_INIT_ERROR_NULL; }
+    if (abs(high_trim) >= enc->tx_rate) {
+        return SPOOKY_ENCODER_INIT_ERROR_BAD_ARGUMENT;
+    }
+    enc->trim = high_trim;
+    return SPOOKY_ENCODER_INIT_OK;
+}
+
+/* Set the wake-up preamble. */
+SPOOKY_API enum spooky_encoder_init_res
+spooky_encoder_set_preamble(struct spooky_encoder *enc, uint16_t bits) {
+    if (enc == NULL) { return SPOOKY_ENCODER_INIT_ERROR_NULL; }
+    /* All the sharp transitions have to be counted in index. */
+    if (bits > UINT16_MAX / 2 - HEADER_SHARP_TRANSITIONS) {
+        return SPOOKY_ENCODER_INIT_ERROR_BAD_ARGUMENT;
+    }
+    enc->preamble = bits;
+    return SPOOKY_ENCODER_INIT_OK;
+}
+
+/* Set how many times to send each message. */
+SPOOKY_API enum spooky_encoder_init_res
+spooky_encoder_set_repeat(struct spooky_encoder *enc, uint8_t count,
+                          uint16_t gap) {
+    if (enc == NULL) { return SPOOKY_ENCODER_INIT_ERROR_NULL; }
+    /* The gap's half-bits are counted in index. */
+    if (count == 0 || gap > UINT16_MAX / 2) {
+        return SPOOKY_ENCODER_INIT_ERROR_BAD_ARGUMENT;
+    }
+    enc->repeat = count;
+    enc->gap = gap;
+    return SPOOKY_ENCODER_INIT_OK;
+}
+
+/* Set the line code. */
+SPOOKY_API enum spooky_encoder_init_res
+spooky_encoder_set_line_code(struct spooky_encoder *enc,
+                             enum spooky_line_code code) {
+    if (enc == NULL) { return SPOOKY_ENCODER_INIT_ERROR_NULL; }
+    if (code != SPOOKY_LINE_MANCHESTER && code != SPOOKY_LINE_4B5B
+        && code != SPOOKY_LINE_DIFF_MANCHESTER) {
+        return SPOOKY_ENCODER_INIT_ERROR_BAD_ARGUMENT;
+    }
+    enc->line_code = code;
+    return SPOOKY_ENCODER_INIT_OK;
+}
+
 /* Enqueue a new outgoing message, which will be copied into the
  * encoder's internal buffer. */
-enum spooky_encoder_enqueue_res
+SPOOKY_API enum spooky_encoder_enqueue_res
 spooky_encoder_enqueue(struct spooky_encoder *enc,
                        uint8_t *input, uint8_t input_size) {
     if (enc->mode != TX_NONE) return SPOOKY_ENCODER_ENQUEUE_ERROR_FULL;
@@ -73,16 +158,22 @@ spooky_encoder_enqueue(struct spooky_encoder *enc,
     memcpy(enc->buffer, input, input_size);
     enc->input_size = input_size;
     enc->index = 0;
+    enc->repeats_left = enc->repeat - 1;
+    /* Here rather than in the step function, so repeats reuse it. */
+    enc->chksum = calc_chksum(enc->buffer, enc->input_size);
+    TRACE(enc, ENC_START, input_size, enc->tx_rate, enc->trim);
     LOG("enqueued buffer %p (%d bytes)\n", input, input_size);
     return SPOOKY_ENCODER_ENQUEUE_OK;
 }
 
-enum spooky_encoder_clear_res
+SPOOKY_API enum spooky_encoder_clear_res
 spooky_encoder_clear(struct spooky_encoder *enc) {
     if (enc == NULL) return SPOOKY_ENCODER_CLEAR_ERROR_NULL;
     if (enc->mode != TX_NONE) {
+        TRACE(enc, ENC_CLEAR, enc->mode, 0, 0);
         enc->mode = TX_NONE;
     }
+    enc->pending_ticks = 0;
     return SPOOKY_ENCODER_CLEAR_OK;
 }
 
@@ -92,14 +183,18 @@ spooky_encoder_clear(struct spooky_encoder *enc) {
 /* Step the current encoding.
  * Returns whether the signal should stay as-is (OK),
  * transition low or high (OK_LOW, OK_HIGH), or if the TX is complete. */
-enum spooky_encoder_step_res
+SPOOKY_API enum spooky_encoder_step_res
 spooky_encoder_step(struct spooky_encoder *enc) {
     enum spooky_encoder_step_res res = SPOOKY_ENCODER_STEP_ERROR_NULL;
     if (enc == NULL) return res;
 
     enc->ticks++;
-    if ((enc->ticks % enc->tx_rate) != 0)
+    if ((enc->ticks % enc->tx_rate) != 0) {
+        if (enc->pending_ticks > 0 && --enc->pending_ticks == 0) {
+            return (enum spooky_encoder_step_res)enc->pending; /* delayed */
+        }
         return SPOOKY_ENCODER_STEP_OK;
+    }
     enc->ticks = 0;
 
     LOG("step, mod %u\n", enc->mode);
@@ -111,7 +206,8 @@ spooky_encoder_step(struct spooky_encoder *enc) {
     case TX_SHARP:                 /* send sharp transitions */
         res = encode_bit(0x01, enc->index);
         enc->index++;
-        if (enc->index == 2*HEADER_SHARP_TRANSITIONS) {
+        if (enc->index == 2*(HEADER_SHARP_TRANSITIONS + enc->preamble)) {
+            TRACE(enc, ENC_STATE, TX_SHARP, TX_LONG, 0);
             enc->mode = TX_LONG;
             enc->index = 0;
         }
@@ -122,6 +218,7 @@ spooky_encoder_step(struct spooky_encoder *enc) {
         res = encode_bit(bit, enc->index);
         enc->index++;
         if (enc->index == 4*HEADER_LONG_TRANSITIONS) {
+            TRACE(enc, ENC_STATE, TX_LONG, TX_LENGTH, 0);
             enc->mode = TX_LENGTH;
             enc->index = 0;
             LOG("length is 0x%02x\n", enc->input_size);
@@ -131,12 +228,12 @@ spooky_encoder_step(struct spooky_encoder *enc) {
     case TX_LENGTH:
     {
         uint8_t bit = enc->input_size & (1 << (7 - (enc->index / 2)));
-        res = encode_bit(bit, enc->index);
+        res = encode_frame_bit(enc, bit, enc->index);
         enc->index++;
         if (enc->index == 2*8) {
+            TRACE(enc, ENC_STATE, TX_LENGTH, TX_CHKSUM, 0);
             enc->mode = TX_CHKSUM;
             enc->index = 0;
-            enc->chksum = calc_chksum(enc->buffer, enc->input_size);
             LOG("checksum is 0x%02x\n", enc->chksum);
         }
         break;
@@ -144,9 +241,10 @@ spooky_encoder_step(struct spooky_encoder *enc) {
     case TX_CHKSUM:
     {
         uint8_t bit = enc->chksum & (1 << (7 - (enc->index/2)));
-        res = encode_bit(bit, enc->index);
+        res = encode_frame_bit(enc, bit, enc->index);
         enc->index++;
         if (enc->index == 2*8) {
+            TRACE(enc, ENC_STATE, TX_CHKSUM, TX_PAYLOAD, 0);
             enc->mode = TX_PAYLOAD;
             enc->index = 0;
         }
@@ -154,29 +252,104 @@ spooky_encoder_step(struct spooky_encoder *enc) {
     }
     case TX_PAYLOAD:
     {
+        if (enc->line_code == SPOOKY_LINE_4B5B) {
+            res = encode_cell_4b5b(enc);
+            break;
+        }
         uint8_t byte_idx = enc->index / 16;
         uint8_t bit_idx = (enc->index % 16) / 2;
         uint8_t byte = enc->buffer[byte_idx];
         LOG("sending byte 0x%02x bit %d\n", byte, 7 - bit_idx);
         uint8_t bit = byte & (1 << (7 - (bit_idx)));
-        res = encode_bit(bit, enc->index);
+        res = encode_frame_bit(enc, bit, enc->index);
         enc->index++;
-        if (enc->index == 8*2*enc->input_size) {
-            LOG("msg done!\n");
-            enc->mode = TX_NONE;
+        if (enc->index == 8*2*enc->input_size) { end_frame(enc); }
+        break;
+    }
+    case TX_GAP:                   /* hold the line low */
+        res = (enc->index == 0 && enc->level ? LOW : SPOOKY_ENCODER_STEP_OK);
+        enc->index++;
+        if (enc->index == 2*enc->gap) {
+            TRACE(enc, ENC_STATE, TX_GAP, TX_SHARP, 0);
+            enc->mode = TX_SHARP;
+            enc->index = 0;
         }
         break;
     }
+
+    if (res == LOW) {
+        enc->level = 0;
+    } else if (res == HIGH) {
+        enc->level = 1;
+    }
+
+    /* Pre-emphasis: hold back edges to the trimmed level. */
+    if ((res == HIGH && enc->trim > 0) || (res == LOW && enc->trim < 0)) {
+        enc->pending = res;
+        enc->pending_ticks = abs(enc->trim);
+        return SPOOKY_ENCODER_STEP_OK;
     }
     return res;
 }
 
 static uint8_t calc_chksum(uint8_t *buf, size_t length) {
     uint8_t res = 0;
-    for (int i=0; i<length; i++) res += buf[i];
+    for (size_t i=0; i<length; i++) res += buf[i];
     return ~res;
 }
 
+/* Half of a length, checksum, or Manchester payload bit. Differential
+ * Manchester always toggles in the middle of the bit, and also at the
+ * start for a 0; otherwise it's the same as the header. */
+static enum spooky_encoder_step_res encode_frame_bit(struct spooky_encoder *enc,
+        uint8_t bit, uint8_t index) {
+    if (enc->line_code != SPOOKY_LINE_DIFF_MANCHESTER) {
+        return encode_bit(bit, index);
+    }
+    if ((index & 0x01) == 0 && bit) { return SPOOKY_ENCODER_STEP_OK; }
+    return (enc->level ? LOW : HIGH);
+}
+
+/* One NRZI cell of the payload's 4B5B symbols: toggle for a 1, hold
+ * for a 0. After the last symbol, one more toggle closes its run of
+ * 0 cells, so the receiver doesn't have to time them out. */
+static enum spooky_encoder_step_res encode_cell_4b5b(struct spooky_encoder *enc) {
+    uint16_t cells = CELLS_4B5B * enc->input_size;
+    uint8_t one = 1;
+    if (enc->index < cells) {
+        uint8_t byte = enc->buffer[enc->index / CELLS_4B5B];
+        uint8_t cell = enc->index % CELLS_4B5B;
+        uint8_t nibble = (cell < SYMBOL_CELLS ? byte >> 4 : byte & 0x0F);
+        uint8_t sym = sym_4b5b[nibble];
+        one = sym & (0x10 >> (cell % SYMBOL_CELLS));
+        LOG("sending byte 0x%02x cell %u: %u\n", byte, cell, one ? 1 : 0);
+    }
+    enc->index++;
+    if (enc->index > cells) { end_frame(enc); }
+    if (!one) { return SPOOKY_ENCODER_STEP_OK; }
+    return (enc->level ? LOW : HIGH);
+}
+
+/* After the payload: finish, or start the next copy (after the gap). */
+static void end_frame(struct spooky_encoder *enc) {
+    enc->index = 0;
+    if (enc->repeats_left == 0) {
+        LOG("msg done!\n");
+        TRACE(enc, ENC_STATE, TX_PAYLOAD, TX_NONE, 0);
+        enc->mode = TX_NONE;
+        return;
+    }
+    enc->repeats_left--;
+    LOG("msg sent, %u more to go\n", enc->repeats_left + 1);
+    if (enc->gap == 0) {
+        TRACE(enc, ENC_STATE, TX_PAYLOAD, TX_SHARP, 0);
+        enc->mode = TX_SHARP;
+    } else {
+        TRACE(enc, ENC_STATE, TX_PAYLOAD, TX_GAP, 0);
+        enc->mode = TX_GAP;
+    }
+}
+
 static enum spooky_encoder_step_res encode_bit(uint8_t bit, uint8_t index) {
     if ((index & 0x01) == 0) {  /* prepare for bit edge */
         return bit ? LOW : HIGH;
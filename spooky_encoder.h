@@ -5,6 +5,15 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+#include "spooky_trace.h"
+#include "spooky_line_code.h"
+
+/* Linkage for the public functions. The generated single-header
+ * build (see 'make spooky.h') defines this as 'static inline'. */
+#ifndef SPOOKY_API
+#define SPOOKY_API
+#endif
+
 /* Struct for the encoder. */
 struct spooky_encoder {
     uint16_t index;
@@ -14,13 +23,26 @@ struct spooky_encoder {
     uint8_t ticks;
     uint8_t mode;
     uint8_t chksum;
+    int8_t trim;                /* pre-emphasis, see spooky_encoder_set_trim */
+    uint8_t pending;            /* delayed edge, waiting for pending_ticks */
+    uint8_t pending_ticks;
+    uint16_t preamble;          /* wake-up preamble, in bits */
+    uint16_t gap;               /* idle bits between repeats */
+    uint8_t repeat;             /* times each message is sent */
+    uint8_t repeats_left;       /* of the current message, after this */
+    uint8_t line_code;          /* enum spooky_line_code */
+    uint8_t level;              /* last level sent */
     uint8_t *buffer;
+#ifdef SPOOKY_TRACE
+    struct spooky_trace trace;  /* see spooky_trace.h */
+#endif
 };
 
 enum spooky_encoder_init_res {
     SPOOKY_ENCODER_INIT_OK = 0,
     SPOOKY_ENCODER_INIT_ERROR_NULL = -1,
     SPOOKY_ENCODER_INIT_ERROR_BAD_ARGUMENT = -2,
+    SPOOKY_ENCODER_INIT_ERROR_BUSY = -3,
 };
 
 enum spooky_encoder_enqueue_res {
@@ -46,18 +68,64 @@ enum spooky_encoder_step_res {
 /* Initialize an encoder.
  * TX_RATE is the number of ticks per bit, which must be >= 2 to allow
  * transitions within a frame. A tick consists of calling 'step' once. */
-enum spooky_encoder_init_res
+SPOOKY_API enum spooky_encoder_init_res
 spooky_encoder_init(struct spooky_encoder *enc,
     uint8_t *buffer, uint8_t buffer_size, uint8_t tx_rate);
 
+/* Change the TX rate (see spooky_encoder_init). The decoder recovers
+ * the clock from each frame's header, so it can change from one frame
+ * to the next. Returns ERROR_BUSY while a message is being sent, and
+ * ERROR_BAD_ARGUMENT if TX_RATE is 0 or the trim no longer fits. */
+SPOOKY_API enum spooky_encoder_init_res
+spooky_encoder_set_rate(struct spooky_encoder *enc, uint8_t tx_rate);
+
+/* Pre-emphasis, for receivers that stretch one level's pulses (with
+ * AGC, high pulses usually come out long and lows short). A positive
+ * HIGH_TRIM delays each rising edge that many ticks, shortening high
+ * pulses; a negative one delays falling edges, shortening lows. The
+ * bit timing is otherwise unchanged. |HIGH_TRIM| must be less than
+ * the TX rate, so it needs a TX rate of at least 2. */
+SPOOKY_API enum spooky_encoder_init_res
+spooky_encoder_set_trim(struct spooky_encoder *enc, int8_t high_trim);
+
+/* Wake-up preamble, for receivers that sleep between checks of the
+ * channel (see spooky_decoder_step_idle). Each frame starts with BITS
+ * extra bits of the header's sharp transitions, lasting
+ * BITS * 2 * TX_RATE * (receiver oversampling) receiver ticks, so a
+ * receiver that wakes up at least that often sees it in time. 0 (the
+ * default) sends none. */
+SPOOKY_API enum spooky_encoder_init_res
+spooky_encoder_set_preamble(struct spooky_encoder *enc, uint16_t bits);
+
+/* Send each message COUNT times (1, the default, sends it once),
+ * with GAP bits of idle (low) line between copies, for fire-and-forget
+ * senders that make up for lost frames with redundancy. The copies
+ * are sent from the encoder's buffer without enqueueing them again,
+ * and the step function returns OK_DONE only after the last one. The
+ * receiver gets each copy that arrives intact, so it should ignore
+ * duplicates (e.g., by a sequence number in the payload). The GAP
+ * lets a receiver reset after a damaged copy; 0 sends them back to
+ * back. Change it between messages. */
+SPOOKY_API enum spooky_encoder_init_res
+spooky_encoder_set_repeat(struct spooky_encoder *enc, uint8_t count,
+    uint16_t gap);
+
+/* Line code after the header (see spooky_line_code.h); the receiver
+ * has to use the same one. Change it between messages. For 4B5B,
+ * TX_RATE * (receiver oversampling) must be no more than
+ * SPOOKY_LINE_4B5B_MAX_INTERVAL. */
+SPOOKY_API enum spooky_encoder_init_res
+spooky_encoder_set_line_code(struct spooky_encoder *enc,
+    enum spooky_line_code code);
+
 /* Enqueue a new outgoing message, which will be copied into the
  * encoder's internal buffer. */
-enum spooky_encoder_enqueue_res
+SPOOKY_API enum spooky_encoder_enqueue_res
 spooky_encoder_enqueue(struct spooky_encoder *enc,
     uint8_t *input, uint8_t input_size);
 
 /* Abort and clear the current transmission. */
-enum spooky_encoder_clear_res
+SPOOKY_API enum spooky_encoder_clear_res
 spooky_encoder_clear(struct spooky_encoder *enc);
 
 /* Step the current encoding. Should be called periodically, at as
@@ -66,7 +134,7 @@ spooky_encoder_clear(struct spooky_encoder *enc);
  * 
  * Returns whether the signal should stay as-is (OK),
  * transition low or high (OK_LOW, OK_HIGH), or if the TX is complete. */
-enum spooky_encoder_step_res
+SPOOKY_API enum spooky_encoder_step_res
 spooky_encoder_step(struct spooky_encoder *enc);
 
 
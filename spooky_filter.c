@@ -0,0 +1,62 @@
+/* 
+ * Copyright (c) 2014 Scott Vokes <vokes.s@gmail.com>
+ *  
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *  
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <string.h>
+#include "spooky_filter.h"
+
+#if 0
+#include <stdio.h>
+#define LOG(...) printf("f: " __VA_ARGS__)
+#else
+#define LOG(...)
+#endif
+
+/* Count of set bits in each nibble. */
+static const uint8_t nibble_bits[] = {
+    0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+};
+
+/* Initialize a filter. */
+SPOOKY_API enum spooky_filter_init_res
+spooky_filter_init(struct spooky_filter *f, uint8_t window, uint8_t need) {
+    if (f == NULL) { return SPOOKY_FILTER_INIT_ERROR_NULL; }
+    if ((window == 0) || (window > SPOOKY_FILTER_MAX_WINDOW)
+        || (need > window) || (2*need <= window)) {
+        return SPOOKY_FILTER_INIT_ERROR_BAD_ARGUMENT;
+    }
+
+    memset(f, 0, sizeof(*f));
+    f->window = window;
+    f->mask = (uint8_t)((1U << window) - 1);
+    f->need = need;
+    LOG("initialized %p, %u of %u\n", (void*)f, need, window);
+    return SPOOKY_FILTER_INIT_OK;
+}
+
+/* Step the filter with a new raw sample, and get the filtered level. */
+SPOOKY_API bool
+spooky_filter_step(struct spooky_filter *f, bool bit) {
+    uint8_t h = ((f->history << 1) | (bit ? 1 : 0)) & f->mask;
+    f->history = h;
+
+    uint8_t ones = nibble_bits[h & 0x0F] + nibble_bits[h >> 4];
+    if (f->out) {
+        if (f->window - ones >= f->need) { f->out = 0; }
+    } else if (ones >= f->need) {
+        f->out = 1;
+    }
+    return f->out;
+}
@@ -0,0 +1,52 @@
+#ifndef SPOOKY_FILTER_H
+#define SPOOKY_FILTER_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Linkage for the public functions. The generated single-header
+ * build (see 'make spooky.h') defines this as 'static inline'. */
+#ifndef SPOOKY_API
+#define SPOOKY_API
+#endif
+
+/* The largest window the filter can vote over. */
+#define SPOOKY_FILTER_MAX_WINDOW 8
+
+/* Optional input conditioning, in front of spooky_decoder_step:
+ * an N-of-M majority vote over the last M samples, with hysteresis.
+ * The output only changes level once at least N of the last M samples
+ * agree on the new level, so isolated spikes shorter than (M - N + 1)
+ * samples are dropped. With N == M, it's a minimum pulse width filter.
+ *
+ * Every clean edge is delayed by exactly N - 1 samples, so the
+ * spacing between edges (which is what the decoder measures) is
+ * unchanged. */
+struct spooky_filter {
+    uint8_t history;            /* last samples, newest in bit 0 */
+    uint8_t window;             /* samples in the vote */
+    uint8_t mask;               /* (1 << window) - 1 */
+    uint8_t need;               /* samples that must agree to switch */
+    uint8_t out;                /* current output level */
+};
+
+enum spooky_filter_init_res {
+    SPOOKY_FILTER_INIT_OK = 0,
+    SPOOKY_FILTER_INIT_ERROR_NULL = -1,
+    SPOOKY_FILTER_INIT_ERROR_BAD_ARGUMENT = -2,
+};
+
+/* Initialize a filter that switches when NEED of the last WINDOW
+ * samples agree. WINDOW must be 1 to SPOOKY_FILTER_MAX_WINDOW, and
+ * NEED must be a majority of it (WINDOW / 2 < NEED <= WINDOW).
+ * A window of 1 passes samples through unchanged. */
+SPOOKY_API enum spooky_filter_init_res
+spooky_filter_init(struct spooky_filter *f, uint8_t window, uint8_t need);
+
+/* Step the filter with a new raw sample, and get the filtered level,
+ * which should be passed on to spooky_decoder_step. */
+SPOOKY_API bool
+spooky_filter_step(struct spooky_filter *f, bool bit);
+
+#endif
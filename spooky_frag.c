@@ -0,0 +1,161 @@
+/* 
+ * Copyright (c) 2014 Scott Vokes <vokes.s@gmail.com>
+ *  
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *  
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <string.h>
+#include "spooky_frag.h"
+
+#if 0
+#include <stdio.h>
+#define LOG(...) printf("g: " __VA_ARGS__)
+#else
+#define LOG(...)
+#endif
+
+/* Offsets in the fragment header. */
+#define FRAG_ID 0
+#define FRAG_INDEX 1
+#define FRAG_COUNT 2
+#define FRAG_CHUNK 3
+
+/* Start sending a message. */
+SPOOKY_API enum spooky_frag_res
+spooky_frag_tx_init(struct spooky_frag_tx *tx, const uint8_t *msg,
+        uint16_t size, uint8_t id, uint8_t frame_size) {
+    if (tx == NULL || msg == NULL) { return SPOOKY_FRAG_ERROR_NULL; }
+    if (size == 0 || frame_size <= SPOOKY_FRAG_HEADER_SIZE) {
+        return SPOOKY_FRAG_ERROR_BAD_ARGUMENT;
+    }
+    uint8_t chunk = frame_size - SPOOKY_FRAG_HEADER_SIZE;
+    uint16_t count = (size + chunk - 1) / chunk;
+    if (count > SPOOKY_FRAG_MAX_COUNT) { return SPOOKY_FRAG_ERROR_SIZE; }
+
+    memset(tx, 0, sizeof(*tx));
+    tx->msg = msg;
+    tx->size = size;
+    tx->id = id;
+    tx->chunk = chunk;
+    tx->count = count;
+    LOG("sending %u bytes as %u fragments of %u\n", size, count, chunk);
+    return SPOOKY_FRAG_OK;
+}
+
+/* Write a fragment. */
+SPOOKY_API enum spooky_frag_res
+spooky_frag_tx_fragment(struct spooky_frag_tx *tx, uint8_t index,
+        uint8_t *frame, uint8_t *size) {
+    if (tx == NULL || frame == NULL || size == NULL) {
+        return SPOOKY_FRAG_ERROR_NULL;
+    }
+    if (index >= tx->count) { return SPOOKY_FRAG_ERROR_BAD_ARGUMENT; }
+    uint16_t offset = index * tx->chunk;
+    uint8_t len = (tx->size - offset < tx->chunk
+        ? tx->size - offset : tx->chunk);
+    frame[FRAG_ID] = tx->id;
+    frame[FRAG_INDEX] = index;
+    frame[FRAG_COUNT] = tx->count;
+    frame[FRAG_CHUNK] = tx->chunk;
+    memcpy(&frame[SPOOKY_FRAG_HEADER_SIZE], &tx->msg[offset], len);
+    *size = SPOOKY_FRAG_HEADER_SIZE + len;
+    return SPOOKY_FRAG_OK;
+}
+
+/* Write the next fragment. */
+SPOOKY_API enum spooky_frag_res
+spooky_frag_tx_next(struct spooky_frag_tx *tx, uint8_t *frame,
+        uint8_t *size) {
+    if (tx == NULL) { return SPOOKY_FRAG_ERROR_NULL; }
+    if (tx->next == tx->count) { return SPOOKY_FRAG_DONE; }
+    enum spooky_frag_res res = spooky_frag_tx_fragment(tx, tx->next,
+        frame, size);
+    if (res == SPOOKY_FRAG_OK) { tx->next++; }
+    return res;
+}
+
+/* Initialize a receiver. */
+SPOOKY_API enum spooky_frag_res
+spooky_frag_rx_init(struct spooky_frag_rx *rx, uint8_t *buffer,
+        size_t buffer_size) {
+    if (rx == NULL || buffer == NULL) { return SPOOKY_FRAG_ERROR_NULL; }
+    memset(rx, 0, sizeof(*rx));
+    rx->buffer = buffer;
+    rx->buffer_size = buffer_size;
+    return SPOOKY_FRAG_OK;
+}
+
+static bool frag_have(const struct spooky_frag_rx *rx, uint8_t index) {
+    return rx->have[index / 8] & (1 << (index % 8));
+}
+
+/* Add a received fragment. */
+SPOOKY_API enum spooky_frag_res
+spooky_frag_rx_add(struct spooky_frag_rx *rx, const uint8_t *frame,
+        uint8_t size) {
+    if (rx == NULL || frame == NULL) { return SPOOKY_FRAG_ERROR_NULL; }
+    if (size <= SPOOKY_FRAG_HEADER_SIZE) {
+        return SPOOKY_FRAG_ERROR_BAD_ARGUMENT;
+    }
+    uint8_t id = frame[FRAG_ID];
+    uint8_t index = frame[FRAG_INDEX];
+    uint8_t count = frame[FRAG_COUNT];
+    uint8_t chunk = frame[FRAG_CHUNK];
+    uint8_t len = size - SPOOKY_FRAG_HEADER_SIZE;
+
+    /* Every fragment but the last is exactly one chunk. */
+    if (index >= count || len > chunk
+        || (index < count - 1 && len != chunk)) {
+        LOG("malformed fragment %u of %u, %u bytes\n", index, count, len);
+        return SPOOKY_FRAG_ERROR_BAD_ARGUMENT;
+    }
+    if (rx->count == 0 || id != rx->id) {
+        LOG("new message 0x%02x, %u fragments\n", id, count);
+        memset(rx->have, 0, sizeof(rx->have));
+        rx->id = id;
+        rx->count = count;
+        rx->chunk = chunk;
+        rx->received = 0;
+        rx->size = 0;
+    } else if (count != rx->count || chunk != rx->chunk) {
+        LOG("fragment doesn't match message 0x%02x\n", id);
+        return SPOOKY_FRAG_ERROR_BAD_ARGUMENT;
+    }
+    if (frag_have(rx, index)) { return SPOOKY_FRAG_DUPLICATE; }
+
+    size_t offset = (size_t)index * chunk;
+    if (offset + len > rx->buffer_size) {
+        LOG("message doesn't fit in %zu bytes\n", rx->buffer_size);
+        return SPOOKY_FRAG_ERROR_SIZE;
+    }
+    memcpy(&rx->buffer[offset], &frame[SPOOKY_FRAG_HEADER_SIZE], len);
+    rx->have[index / 8] |= (1 << (index % 8));
+    rx->received++;
+    if (index == count - 1) { rx->size = offset + len; }
+    LOG("fragment %u of %u, %u so far\n", index, count, rx->received);
+    return (rx->received == count ? SPOOKY_FRAG_DONE : SPOOKY_FRAG_OK);
+}
+
+/* List the fragments still missing. */
+SPOOKY_API uint8_t
+spooky_frag_rx_missing(const struct spooky_frag_rx *rx, uint8_t *missing,
+        uint8_t max) {
+    if (rx == NULL) { return 0; }
+    uint8_t n = 0;
+    for (uint16_t i=0; i<rx->count; i++) {
+        if (frag_have(rx, i)) { continue; }
+        if (missing != NULL && n < max) { missing[n] = i; }
+        n++;
+    }
+    return n;
+}
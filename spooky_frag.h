@@ -0,0 +1,109 @@
+#ifndef SPOOKY_FRAG_H
+#define SPOOKY_FRAG_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifndef SPOOKY_API
+#define SPOOKY_API
+#endif
+
+/* Fragmentation, for messages too large for one frame (a frame's
+ * payload is at most 255 bytes, see SPOOKY_DECODER_MAX_BUFFER_SIZE).
+ *
+ * The sender splits a message into fragments, each sent as its own
+ * frame, and the receiver puts them back together in a buffer of its
+ * own. Each fragment's payload starts with a header:
+ *
+ *     message ID, fragment index, fragment count, chunk size
+ *
+ * followed by the fragment's data, which is at offset index * chunk
+ * in the message. Every fragment but the last carries exactly chunk
+ * bytes. Since each fragment says where it goes, they can arrive in
+ * any order, and duplicates are ignored; spooky_frag_rx_missing lists
+ * the ones still needed, so the sender can send them again. */
+
+/* Bytes of fragment header, before the data. */
+#define SPOOKY_FRAG_HEADER_SIZE 4
+
+/* Most fragments in a message, and so the largest message is
+ * this times the chunk size (at most 255 - SPOOKY_FRAG_HEADER_SIZE). */
+#define SPOOKY_FRAG_MAX_COUNT 255
+
+enum spooky_frag_res {
+    SPOOKY_FRAG_OK = 0,
+    SPOOKY_FRAG_DONE = 1,           /* sent all / message complete */
+    SPOOKY_FRAG_DUPLICATE = 2,      /* already had that fragment */
+    SPOOKY_FRAG_ERROR_NULL = -1,
+    SPOOKY_FRAG_ERROR_BAD_ARGUMENT = -2,
+    SPOOKY_FRAG_ERROR_SIZE = -3,    /* message too large */
+};
+
+/* Sender. */
+struct spooky_frag_tx {
+    const uint8_t *msg;
+    uint16_t size;              /* message size, in bytes */
+    uint8_t id;                 /* message ID */
+    uint8_t chunk;              /* data bytes per fragment */
+    uint8_t count;              /* fragments */
+    uint8_t next;               /* next fragment for spooky_frag_tx_next */
+};
+
+/* Receiver. */
+struct spooky_frag_rx {
+    uint8_t *buffer;
+    size_t buffer_size;
+    uint16_t size;              /* message size, once the last arrives */
+    uint8_t id;                 /* current message's ID */
+    uint8_t chunk;              /* current message's chunk size */
+    uint8_t count;              /* current message's fragments, or 0 */
+    uint8_t received;           /* distinct fragments received */
+    uint8_t have[(SPOOKY_FRAG_MAX_COUNT + 7) / 8];  /* bit per fragment */
+};
+
+/* Start sending MSG (SIZE bytes, not copied, so keep it around) as
+ * message ID, in frames of up to FRAME_SIZE bytes of payload (which
+ * must fit in the receiving decoder's buffer). Use a different ID for
+ * each message, so the receiver can tell them apart. */
+SPOOKY_API enum spooky_frag_res
+spooky_frag_tx_init(struct spooky_frag_tx *tx, const uint8_t *msg,
+    uint16_t size, uint8_t id, uint8_t frame_size);
+
+/* Write the next fragment's payload to FRAME (FRAME_SIZE bytes, from
+ * init), and its size to *SIZE, for spooky_encoder_enqueue. Returns
+ * DONE, writing nothing, once all of them have been written. */
+SPOOKY_API enum spooky_frag_res
+spooky_frag_tx_next(struct spooky_frag_tx *tx, uint8_t *frame,
+    uint8_t *size);
+
+/* Write fragment INDEX's payload, as with spooky_frag_tx_next, e.g.
+ * to send one again that the receiver is missing. */
+SPOOKY_API enum spooky_frag_res
+spooky_frag_tx_fragment(struct spooky_frag_tx *tx, uint8_t index,
+    uint8_t *frame, uint8_t *size);
+
+/* Initialize a receiver, reassembling into BUFFER. */
+SPOOKY_API enum spooky_frag_res
+spooky_frag_rx_init(struct spooky_frag_rx *rx, uint8_t *buffer,
+    size_t buffer_size);
+
+/* Add a received frame's payload (as passed to the decoder's
+ * callback). Returns DONE when it completes the message, whose
+ * rx->size bytes are then in the buffer; OK if it was stored; and
+ * DUPLICATE if that fragment was already there. A fragment with a
+ * new message ID drops any incomplete message and starts on the new
+ * one. Frames that aren't well-formed fragments get BAD_ARGUMENT, and
+ * messages that won't fit in the buffer get ERROR_SIZE. */
+SPOOKY_API enum spooky_frag_res
+spooky_frag_rx_add(struct spooky_frag_rx *rx, const uint8_t *frame,
+    uint8_t size);
+
+/* Write the indexes of up to MAX fragments of the current message
+ * that haven't arrived yet to MISSING, and return how many are
+ * missing in all (0 if complete, or if nothing has arrived yet). */
+SPOOKY_API uint8_t
+spooky_frag_rx_missing(const struct spooky_frag_rx *rx, uint8_t *missing,
+    uint8_t max);
+
+#endif
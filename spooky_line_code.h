@@ -0,0 +1,36 @@
+#ifndef SPOOKY_LINE_CODE_H
+#define SPOOKY_LINE_CODE_H
+
+/* Line codes for the frame after the header. The header is the same
+ * in all of them, so the decoder can find it and recover the clock as
+ * usual. The encoder and decoder have to be set to the same one.
+ *
+ * SPOOKY_LINE_MANCHESTER: two half-bit cells per bit, with an edge in
+ *     the middle of each bit. A 1 is low then high. The default.
+ *
+ * SPOOKY_LINE_4B5B: the length and checksum are Manchester, and each
+ *     payload nibble is sent as a 5-cell 4B5B symbol, in NRZI (a 1
+ *     cell is an edge, a 0 cell isn't), followed at the end by one
+ *     more edge. The symbols never have more than three 0 cells in a
+ *     row, so edges are at most 4 cells apart, and each one re-syncs
+ *     the clock. At the same cell width (so the same shortest pulse
+ *     the radio has to pass), that's 1.25 cells per bit rather than
+ *     2, so the payload takes 5/8 as long. Needs an interval of at
+ *     most SPOOKY_LINE_4B5B_MAX_INTERVAL ticks, and isn't as tolerant
+ *     of spikes, so filter them first.
+ *
+ * SPOOKY_LINE_DIFF_MANCHESTER: differential Manchester for the length,
+ *     checksum, and payload. There's still an edge in the middle of
+ *     each bit, but the bit is whether there's also one at its start
+ *     (for a 0) or not (for a 1), not which way the edges go. Since
+ *     the header only depends on edge timing, a receiver that inverts
+ *     the line decodes it just the same. */
+enum spooky_line_code {
+    SPOOKY_LINE_MANCHESTER = 0,
+    SPOOKY_LINE_4B5B = 1,
+    SPOOKY_LINE_DIFF_MANCHESTER = 2,
+};
+
+#define SPOOKY_LINE_4B5B_MAX_INTERVAL 56
+
+#endif
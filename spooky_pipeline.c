@@ -0,0 +1,430 @@
+/*
+ * Copyright (c) 2014 Scott Vokes <vokes.s@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <unistd.h>
+#include "spooky_pipeline.h"
+
+#if 0
+#define LOG(...) fprintf(stderr, "p: " __VA_ARGS__)
+#else
+#define LOG(...)
+#endif
+
+#define DEFAULT_RING_SIZE 65536
+
+/* Frames are few, so their ring can be much smaller. */
+#define FRAME_RING_DIVISOR 64
+#define MIN_RING_SIZE 4
+
+#define CACHE_LINE 64
+
+/* Most samples the reader waits for at once. */
+#define READ_CHUNK 4096
+
+/* Times a stage yields the CPU while waiting on a ring before it
+ * sleeps until the other side wakes it, so an idle live stream
+ * doesn't keep every stage spinning. */
+#define SPIN_YIELDS 64
+
+/* Single-producer, single-consumer ring. HEAD and TAIL count entries
+ * written and read, and are only ever increased, by one side each; they
+ * sit on separate cache lines so the two sides don't contend. */
+struct ring {
+    size_t head;
+    char pad0[CACHE_LINE - sizeof(size_t)];
+    size_t tail;
+    char pad1[CACHE_LINE - sizeof(size_t)];
+    bool closed;                /* producer is done */
+    size_t mask;
+    size_t elem;                /* entry size, in bytes */
+    uint8_t *buf;
+    size_t stalls;              /* producer waits on a full ring */
+    int sleepers;               /* sides sleeping on WAKE */
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+};
+
+/* A run of LEVEL, TICKS samples long, ended by an edge (or EOF), or
+ * the part of one that had arrived when the input paused. */
+struct edge {
+    uint32_t ticks;
+    uint8_t level;
+};
+
+struct frame {
+    uint8_t size;
+    uint8_t data[255];
+};
+
+struct pipeline {
+    const struct spooky_pipeline_config *cfg;
+    struct ring samples;        /* uint8_t: reader -> slicer */
+    struct ring bits;           /* uint8_t: slicer -> edges */
+    struct ring edges;          /* struct edge: edges -> decoder */
+    struct ring frames;         /* struct frame: decoder -> sink */
+    struct spooky_pipeline_stats stats;
+    bool abort;                 /* set if the pipeline can't start */
+    bool io_error;
+};
+
+/* Producer side of a ring, for stages that write one entry at a time. */
+struct writer {
+    struct ring *r;
+    struct pipeline *p;
+    uint8_t *ptr;               /* claimed, contiguous space */
+    size_t room;
+    size_t used;
+};
+
+static bool aborted(struct pipeline *p) {
+    return __atomic_load_n(&p->abort, __ATOMIC_SEQ_CST);
+}
+
+static bool ring_init(struct ring *r, size_t size, size_t elem) {
+    memset(r, 0, sizeof(*r));
+    pthread_mutex_init(&r->lock, NULL);
+    pthread_cond_init(&r->wake, NULL);
+    r->mask = size - 1;
+    r->elem = elem;
+    r->buf = malloc(size * elem);
+    return r->buf != NULL;
+}
+
+static void ring_free(struct ring *r) {
+    pthread_mutex_destroy(&r->lock);
+    pthread_cond_destroy(&r->wake);
+    free(r->buf);
+}
+
+/* Wait for the other side to move past HEAD and TAIL, close the ring,
+ * or abort: yield at first, then sleep. The other side checks for
+ * sleepers after each store (see ring_wake), and both are SEQ_CST, so
+ * either it sees this one or this one sees its store. */
+static void ring_wait(struct pipeline *p, struct ring *r, unsigned *spins,
+        size_t head, size_t tail) {
+    if (*spins < SPIN_YIELDS) {
+        (*spins)++;
+        sched_yield();
+        return;
+    }
+    pthread_mutex_lock(&r->lock);
+    __atomic_add_fetch(&r->sleepers, 1, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&r->head, __ATOMIC_SEQ_CST) == head
+        && __atomic_load_n(&r->tail, __ATOMIC_SEQ_CST) == tail
+        && !__atomic_load_n(&r->closed, __ATOMIC_SEQ_CST) && !aborted(p)) {
+        pthread_cond_wait(&r->wake, &r->lock);
+    }
+    __atomic_sub_fetch(&r->sleepers, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&r->lock);
+}
+
+/* Wake the other side, if it's sleeping in ring_wait. */
+static void ring_wake(struct ring *r) {
+    if (__atomic_load_n(&r->sleepers, __ATOMIC_SEQ_CST) > 0) {
+        pthread_mutex_lock(&r->lock);
+        pthread_cond_broadcast(&r->wake);
+        pthread_mutex_unlock(&r->lock);
+    }
+}
+
+static void abort_pipeline(struct pipeline *p) {
+    __atomic_store_n(&p->abort, true, __ATOMIC_SEQ_CST);
+    ring_wake(&p->samples);
+    ring_wake(&p->bits);
+    ring_wake(&p->edges);
+    ring_wake(&p->frames);
+}
+
+/* Claim free space for writing, waiting while the ring is full.
+ * Returns the number of contiguous entries claimed (at least 1), or 0
+ * if the pipeline was aborted. */
+static size_t ring_reserve(struct pipeline *p, struct ring *r, uint8_t **ptr) {
+    size_t size = r->mask + 1;
+    size_t free_count, tail;
+    bool stalled = false;
+    unsigned spins = 0;
+    while ((free_count = size - (r->head
+                - (tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE)))) == 0) {
+        if (aborted(p)) { return 0; }
+        if (!stalled) { r->stalls++; stalled = true; }
+        ring_wait(p, r, &spins, r->head, tail);
+    }
+    size_t offset = r->head & r->mask;
+    size_t contiguous = size - offset;
+    *ptr = &r->buf[offset * r->elem];
+    return (free_count < contiguous ? free_count : contiguous);
+}
+
+/* Publish N entries written after ring_reserve. */
+static void ring_commit(struct ring *r, size_t n) {
+    __atomic_store_n(&r->head, r->head + n, __ATOMIC_SEQ_CST);
+    ring_wake(r);
+}
+
+static void ring_close(struct ring *r) {
+    __atomic_store_n(&r->closed, true, __ATOMIC_SEQ_CST);
+    ring_wake(r);
+}
+
+/* Get the entries available for reading, waiting while the ring is
+ * empty. Returns the number of contiguous entries, or 0 once the ring
+ * is closed and drained (or the pipeline was aborted). */
+static size_t ring_peek(struct pipeline *p, struct ring *r, uint8_t **ptr) {
+    size_t avail, head;
+    unsigned spins = 0;
+    while ((avail = (head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE))
+            - r->tail) == 0) {
+        if (__atomic_load_n(&r->closed, __ATOMIC_ACQUIRE)) {
+            /* Entries committed just before closing. */
+            avail = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) - r->tail;
+            if (avail == 0) { return 0; }
+            break;
+        }
+        if (aborted(p)) { return 0; }
+        ring_wait(p, r, &spins, head, r->tail);
+    }
+    size_t offset = r->tail & r->mask;
+    size_t contiguous = r->mask + 1 - offset;
+    *ptr = &r->buf[offset * r->elem];
+    return (avail < contiguous ? avail : contiguous);
+}
+
+/* Release N entries read after ring_peek. */
+static void ring_release(struct ring *r, size_t n) {
+    __atomic_store_n(&r->tail, r->tail + n, __ATOMIC_SEQ_CST);
+    ring_wake(r);
+}
+
+static void writer_flush(struct writer *w) {
+    if (w->used > 0) { ring_commit(w->r, w->used); }
+    w->ptr = NULL;
+    w->room = w->used = 0;
+}
+
+static bool writer_put(struct writer *w, const void *entry) {
+    if (w->used == w->room) {
+        writer_flush(w);
+        w->room = ring_reserve(w->p, w->r, &w->ptr);
+        if (w->room == 0) { return false; }
+    }
+    memcpy(&w->ptr[w->used * w->r->elem], entry, w->r->elem);
+    w->used++;
+    return true;
+}
+
+/* Read with read(2) rather than fread, which would wait for the whole
+ * request: on live input (a pipe from the radio), samples should go
+ * down the pipeline as soon as they arrive. */
+static void *reader_stage(void *arg) {
+    struct pipeline *p = (struct pipeline *)arg;
+    int fd = fileno(p->cfg->input);
+    uint8_t *ptr;
+    size_t n;
+    if (fd < 0) { p->io_error = true; }
+    while (fd >= 0 && (n = ring_reserve(p, &p->samples, &ptr)) > 0) {
+        if (n > READ_CHUNK) { n = READ_CHUNK; }
+        ssize_t got = read(fd, ptr, n);
+        if (got > 0) {
+            ring_commit(&p->samples, got);
+            p->stats.samples += got;
+        } else if (got == 0) {
+            break;
+        } else if (errno != EINTR) {
+            p->io_error = true;
+            break;
+        }
+    }
+    LOG("reader: %zu samples\n", p->stats.samples);
+    ring_close(&p->samples);
+    return NULL;
+}
+
+static void *slicer_stage(void *arg) {
+    struct pipeline *p = (struct pipeline *)arg;
+    uint8_t threshold = p->cfg->threshold;
+    uint8_t *in, *out;
+    size_t n;
+    while ((n = ring_peek(p, &p->samples, &in)) > 0) {
+        size_t room = ring_reserve(p, &p->bits, &out);
+        if (room == 0) { break; }
+        if (n > room) { n = room; }
+        for (size_t i=0; i<n; i++) { out[i] = (in[i] > threshold); }
+        ring_commit(&p->bits, n);
+        ring_release(&p->samples, n);
+    }
+    ring_close(&p->bits);
+    return NULL;
+}
+
+/* Counts edges here, since a run can be passed on in parts. */
+static void *edge_stage(void *arg) {
+    struct pipeline *p = (struct pipeline *)arg;
+    struct writer w = { .r = &p->edges, .p = p };
+    struct edge e = { .ticks = 0, .level = 0 };
+    bool started = false;
+    uint8_t *in;
+    size_t n;
+    while ((n = ring_peek(p, &p->bits, &in)) > 0) {
+        for (size_t i=0; i<n; i++) {
+            if (in[i] != e.level || e.ticks == (uint32_t)-1) {
+                if (e.ticks > 0 && !writer_put(&w, &e)) { goto done; }
+                if (started && in[i] != e.level) { p->stats.edges++; }
+                e.ticks = 0;
+                e.level = in[i];
+            }
+            e.ticks++;
+            started = true;
+        }
+        ring_release(&p->bits, n);
+        /* Pass on the run so far rather than waiting for its edge: on
+         * live input, the decoder only finishes a frame once it sees
+         * the samples after the last edge, which may be all there is
+         * until the next transmission. */
+        if (e.ticks > 0 && !writer_put(&w, &e)) { goto done; }
+        e.ticks = 0;
+        writer_flush(&w);
+    }
+    if (started) { p->stats.edges++; }
+done:
+    writer_flush(&w);
+    ring_close(&p->edges);
+    return NULL;
+}
+
+static void decoder_cb(uint8_t *data, uint8_t data_size, void *udata) {
+    struct writer *w = (struct writer *)udata;
+    struct frame f;
+    f.size = data_size;
+    memcpy(f.data, data, data_size);
+    (void)writer_put(w, &f);
+}
+
+static void *decoder_stage(void *arg) {
+    struct pipeline *p = (struct pipeline *)arg;
+    struct writer w = { .r = &p->frames, .p = p };
+    struct spooky_decoder dec;
+    uint8_t *buffer = malloc(p->cfg->buffer_size);
+    if (buffer == NULL || spooky_decoder_init(&dec, buffer,
+            p->cfg->buffer_size, decoder_cb, &w) != SPOOKY_DECODER_INIT_OK) {
+        abort_pipeline(p);
+        free(buffer);
+        ring_close(&p->frames);
+        return NULL;
+    }
+
+    uint8_t *in;
+    size_t n;
+    while ((n = ring_peek(p, &p->edges, &in)) > 0) {
+        const struct edge *edges = (const struct edge *)in;
+        for (size_t i=0; i<n; i++) {
+            for (uint32_t t=0; t<edges[i].ticks; t++) {
+                (void)spooky_decoder_step(&dec, edges[i].level);
+            }
+        }
+        ring_release(&p->edges, n);
+        writer_flush(&w);       /* don't hold frames back */
+    }
+    writer_flush(&w);
+    ring_close(&p->frames);
+    free(buffer);
+    return NULL;
+}
+
+static void *sink_stage(void *arg) {
+    struct pipeline *p = (struct pipeline *)arg;
+    uint8_t *in;
+    size_t n;
+    while ((n = ring_peek(p, &p->frames, &in)) > 0) {
+        struct frame *frames = (struct frame *)in;
+        for (size_t i=0; i<n; i++) {
+            p->cfg->cb(frames[i].data, frames[i].size, p->cfg->udata);
+        }
+        p->stats.frames += n;
+        ring_release(&p->frames, n);
+    }
+    return NULL;
+}
+
+/* Run the pipeline until EOF. */
+enum spooky_pipeline_res
+spooky_pipeline_run(const struct spooky_pipeline_config *cfg,
+        struct spooky_pipeline_stats *stats) {
+    if (cfg == NULL || cfg->input == NULL || cfg->cb == NULL) {
+        return SPOOKY_PIPELINE_ERROR_NULL;
+    }
+    size_t size = (cfg->ring_size == 0 ? DEFAULT_RING_SIZE : cfg->ring_size);
+    if (size < MIN_RING_SIZE || (size & (size - 1)) != 0
+        || cfg->buffer_size < SPOOKY_DECODER_MIN_BUFFER_SIZE) {
+        return SPOOKY_PIPELINE_ERROR_BAD_ARGUMENT;
+    }
+    size_t frame_size = size / FRAME_RING_DIVISOR;
+    if (frame_size < MIN_RING_SIZE) { frame_size = MIN_RING_SIZE; }
+
+    struct pipeline *p = calloc(1, sizeof(*p));
+    if (p == NULL) { return SPOOKY_PIPELINE_ERROR_MEMORY; }
+    p->cfg = cfg;
+
+    enum spooky_pipeline_res res = SPOOKY_PIPELINE_OK;
+    if (!ring_init(&p->samples, size, sizeof(uint8_t))
+        | !ring_init(&p->bits, size, sizeof(uint8_t))
+        | !ring_init(&p->edges, size, sizeof(struct edge))
+        | !ring_init(&p->frames, frame_size, sizeof(struct frame))) {
+        res = SPOOKY_PIPELINE_ERROR_MEMORY;
+        goto cleanup;
+    }
+
+    void *(*stages[])(void *) = {
+        reader_stage, slicer_stage, edge_stage, decoder_stage, sink_stage,
+    };
+    const int stage_count = sizeof(stages) / sizeof(stages[0]);
+    pthread_t tids[sizeof(stages) / sizeof(stages[0])];
+    int started = 0;
+    for (; started < stage_count; started++) {
+        if (pthread_create(&tids[started], NULL, stages[started], p) != 0) {
+            abort_pipeline(p);
+            res = SPOOKY_PIPELINE_ERROR_THREAD;
+            break;
+        }
+    }
+    for (int i=0; i<started; i++) { pthread_join(tids[i], NULL); }
+
+    if (res == SPOOKY_PIPELINE_OK && p->abort) {
+        res = SPOOKY_PIPELINE_ERROR_MEMORY;
+    } else if (res == SPOOKY_PIPELINE_OK && p->io_error) {
+        res = SPOOKY_PIPELINE_ERROR_IO;
+    }
+    p->stats.reader_stalls = p->samples.stalls;
+    p->stats.slicer_stalls = p->bits.stalls;
+    p->stats.edge_stalls = p->edges.stalls;
+    p->stats.decoder_stalls = p->frames.stalls;
+    if (stats != NULL) { *stats = p->stats; }
+    LOG("%zu samples, %zu edges, %zu frames\n",
+        p->stats.samples, p->stats.edges, p->stats.frames);
+
+cleanup:
+    ring_free(&p->samples);
+    ring_free(&p->bits);
+    ring_free(&p->edges);
+    ring_free(&p->frames);
+    free(p);
+    return res;
+}
@@ -0,0 +1,82 @@
+#ifndef SPOOKY_PIPELINE_H
+#define SPOOKY_PIPELINE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "spooky_decoder.h"
+
+/* Host-side receive pipeline, for a capture stream (a file, or stdin
+ * standing in for the radio) with one byte per sample.
+ *
+ * The work is split into stages, each on its own thread:
+ *
+ *     reader -> slicer -> edges -> decoder -> sink
+ *
+ * The reader reads raw samples, the slicer turns them into bits, the
+ * edge stage turns the bits into runs (one entry per edge), the decoder
+ * stage steps a spooky_decoder through the runs, and the sink calls
+ * the callback with each frame. Since the callback runs on its own
+ * thread, slow I/O there doesn't hold up reading samples until the
+ * rings between it and the reader fill up.
+ *
+ * Stages are connected by lock-free single-producer, single-consumer
+ * rings. Each side claims as much of the ring as is free (or full) at
+ * once, and publishes it with one atomic store, so the handoff cost is
+ * per batch rather than per sample. A stage waits while its output
+ * ring is full, so back-pressure flows upstream, and while its input
+ * ring is empty; after yielding the CPU a few times, it sleeps until
+ * the other side wakes it, so an idle live stream costs nothing.
+ *
+ * The edge stage passes on the run in progress at the end of each
+ * batch of input, rather than holding it until the next edge, so a
+ * frame is received once the samples after its last edge arrive, even
+ * if the input then goes quiet without reaching EOF.
+ *
+ * This uses threads and the heap, so it's host-only. */
+
+/* Callback, called on the sink thread with each frame received. */
+typedef void (spooky_pipeline_cb)(uint8_t *data, uint8_t data_size,
+    void *udata);
+
+struct spooky_pipeline_config {
+    FILE *input;                /* samples, one byte each, until EOF;
+                                 * read unbuffered, from its fd */
+    uint8_t threshold;          /* samples above this are high */
+    uint8_t buffer_size;        /* the decoder's buffer, in bytes */
+    size_t ring_size;           /* entries per ring, a power of 2,
+                                 * or 0 for the default */
+    spooky_pipeline_cb *cb;     /* callback for received frames */
+    void *udata;                /* void * userdata for callback */
+};
+
+/* Counts from a run. A stall is a stage waiting on a full output
+ * ring; stalls in the reader mean the input wasn't being read. */
+struct spooky_pipeline_stats {
+    size_t samples;
+    size_t edges;
+    size_t frames;
+    size_t reader_stalls;
+    size_t slicer_stalls;
+    size_t edge_stalls;
+    size_t decoder_stalls;
+};
+
+enum spooky_pipeline_res {
+    SPOOKY_PIPELINE_OK = 0,
+    SPOOKY_PIPELINE_ERROR_NULL = -1,
+    SPOOKY_PIPELINE_ERROR_BAD_ARGUMENT = -2,
+    SPOOKY_PIPELINE_ERROR_MEMORY = -3,
+    SPOOKY_PIPELINE_ERROR_THREAD = -4,
+    SPOOKY_PIPELINE_ERROR_IO = -5,
+};
+
+/* Run the pipeline until the input reaches EOF and every stage has
+ * drained. If STATS is non-NULL, the counts are written to it. */
+enum spooky_pipeline_res
+spooky_pipeline_run(const struct spooky_pipeline_config *cfg,
+    struct spooky_pipeline_stats *stats);
+
+#endif
@@ -0,0 +1,48 @@
+/* Receive frames from a capture, through spooky_pipeline.
+ *
+ * Usage: spooky_rx [THRESHOLD [FILE]]
+ *
+ * Reads samples (one byte each; above THRESHOLD, default 0, is high)
+ * from FILE, or stdin if it's omitted or "-", and prints each frame
+ * as a line of hex. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "spooky_pipeline.h"
+
+static void print_frame(uint8_t *data, uint8_t data_size, void *udata) {
+    FILE *out = (FILE *)udata;
+    for (uint8_t i=0; i<data_size; i++) { fprintf(out, "%02x", data[i]); }
+    fprintf(out, "\n");
+    fflush(out);
+}
+
+int main(int argc, char **argv) {
+    struct spooky_pipeline_config cfg = {
+        .input = stdin,
+        .threshold = (argc > 1 ? atoi(argv[1]) : 0),
+        .buffer_size = 255,
+        .cb = print_frame,
+        .udata = stdout,
+    };
+    if (argc > 2 && strcmp(argv[2], "-") != 0) {
+        cfg.input = fopen(argv[2], "rb");
+        if (cfg.input == NULL) {
+            fprintf(stderr, "can't open %s\n", argv[2]);
+            return 1;
+        }
+    }
+
+    struct spooky_pipeline_stats stats;
+    enum spooky_pipeline_res res = spooky_pipeline_run(&cfg, &stats);
+    if (res != SPOOKY_PIPELINE_OK) {
+        fprintf(stderr, "pipeline error %d\n", res);
+        return 1;
+    }
+    fprintf(stderr, "%zu samples, %zu edges, %zu frames, "
+        "%zu reader stalls\n", stats.samples, stats.edges, stats.frames,
+        stats.reader_stalls);
+    return 0;
+}
@@ -0,0 +1,196 @@
+/*
+ * Copyright (c) 2014 Scott Vokes <vokes.s@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <math.h>
+#include <string.h>
+#include "spooky_sim.h"
+
+#if 0
+#include <stdio.h>
+#define LOG(...) printf("s: " __VA_ARGS__)
+#else
+#define LOG(...)
+#endif
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+/* Encoder ticks per pass in spooky_sim_encode. */
+#define ENCODE_CHUNK 256
+
+#define NEVER ((size_t)-1)
+
+uint32_t spooky_sim_lcg(uint32_t *state) {
+    static const uint32_t mul = (1L << 31) - 19;
+    static const uint32_t inc = (1L << 31) - 61;
+    *state = (*state * mul) + inc;
+    return *state;
+}
+
+/* Uniform in (0, 1), from the top 24 bits. */
+static double uniform(struct spooky_sim *sim) {
+    return ((spooky_sim_lcg(&sim->rng) >> 8) + 0.5) / (1UL << 24);
+}
+
+/* Standard normal, by Box-Muller. */
+static double gaussian(struct spooky_sim *sim) {
+    double u1 = uniform(sim);
+    double u2 = uniform(sim);
+    return sqrt(-2 * log(u1)) * cos(2 * M_PI * u2);
+}
+
+/* Samples until the next event with odds P per sample. */
+static size_t gap(struct spooky_sim *sim, float p) {
+    if (p <= 0) { return NEVER; }
+    double g = floor(log(uniform(sim)) / log1p(-p));
+    return (g >= (double)(NEVER / 2) ? NEVER / 2 : (size_t)g);
+}
+
+enum spooky_sim_res
+spooky_sim_init(struct spooky_sim *sim, const struct spooky_sim_config *cfg) {
+    if (sim == NULL || cfg == NULL) { return SPOOKY_SIM_ERROR_NULL; }
+    if (!(cfg->oversample >= 1) || !(cfg->clock_skew > -1)
+        || !(cfg->jitter >= 0) || !(fabsf(cfg->asymmetry) < cfg->oversample)
+        || !(cfg->spike_rate >= 0 && cfg->spike_rate < 1)
+        || !(cfg->dropout_rate >= 0 && cfg->dropout_rate < 1)) {
+        return SPOOKY_SIM_ERROR_BAD_ARGUMENT;
+    }
+    memset(sim, 0, sizeof(*sim));
+    sim->cfg = *cfg;
+    sim->rng = cfg->seed;
+    sim->rate = cfg->oversample * (1.0 + cfg->clock_skew);
+    sim->next_spike = gap(sim, cfg->spike_rate);
+    sim->next_dropout = gap(sim, cfg->dropout_rate);
+    LOG("%.3f samples per tick\n", sim->rate);
+    return SPOOKY_SIM_OK;
+}
+
+/* Hold the line low for dropouts in OUT[0, N). */
+static void add_dropouts(struct spooky_sim *sim, uint8_t *out, size_t n) {
+    size_t i = 0;
+    while (i < n) {
+        if (sim->dropout_left > 0) {
+            size_t len = n - i;
+            if (len > sim->dropout_left) { len = sim->dropout_left; }
+            memset(&out[i], 0, len);
+            i += len;
+            sim->dropout_left -= len;
+            if (sim->dropout_left == 0) {
+                sim->next_dropout = gap(sim, sim->cfg.dropout_rate);
+            }
+            continue;
+        }
+        if (sim->next_dropout >= n - i) {
+            if (sim->next_dropout != NEVER) { sim->next_dropout -= n - i; }
+            break;
+        }
+        i += sim->next_dropout;
+        sim->dropout_left = sim->cfg.dropout_length;
+        if (sim->dropout_left == 0) {
+            sim->next_dropout = gap(sim, sim->cfg.dropout_rate) + 1;
+        }
+    }
+}
+
+/* Flip single samples in OUT[0, N). */
+static void add_spikes(struct spooky_sim *sim, uint8_t *out, size_t n) {
+    size_t i = 0;
+    while (sim->next_spike < n - i) {
+        i += sim->next_spike;
+        out[i] ^= 1;
+        i++;
+        sim->next_spike = gap(sim, sim->cfg.spike_rate);
+        if (i == n) { return; }
+    }
+    if (sim->next_spike != NEVER) { sim->next_spike -= n - i; }
+}
+
+enum spooky_sim_res
+spooky_sim_run(struct spooky_sim *sim, const uint8_t *levels, size_t count,
+        uint8_t *out, size_t max, size_t *out_count) {
+    if (sim == NULL || (levels == NULL && count > 0) || out == NULL
+        || out_count == NULL) {
+        return SPOOKY_SIM_ERROR_NULL;
+    }
+    const struct spooky_sim_config *cfg = &sim->cfg;
+    double half_asym = cfg->asymmetry / 2.0;
+    size_t n = 0;
+
+    /* Write the runs between edges. Each edge lands at its tick's
+     * position, moved by jitter and asymmetry, but never before the
+     * previous edge; sample I is at position I. */
+    for (size_t k=0; k<count; k++) {
+        uint8_t l = (levels[k] != 0);
+        if (l == sim->level) { continue; }
+        double s = sim->phase + k * sim->rate + (l ? -half_asym : half_asym);
+        if (cfg->jitter > 0) { s += cfg->jitter * gaussian(sim); }
+        if (s < sim->last_edge) { s = sim->last_edge; }
+        size_t e = (s <= n ? n : (size_t)ceil(s));
+        if (e > max) { return SPOOKY_SIM_ERROR_SIZE; }
+        memset(&out[n], sim->level, e - n);
+        n = e;
+        sim->level = l;
+        sim->last_edge = s;
+    }
+    double end = sim->phase + count * sim->rate;
+    size_t total = (end <= 0 ? 0 : (size_t)ceil(end));
+    if (total < n) { total = n; }
+    if (total > max) { return SPOOKY_SIM_ERROR_SIZE; }
+    memset(&out[n], sim->level, total - n);
+
+    /* Positions are relative to the first sample of the next call. */
+    sim->phase = end - total;
+    sim->last_edge -= total;
+
+    add_dropouts(sim, out, total);
+    add_spikes(sim, out, total);
+    *out_count = total;
+    return SPOOKY_SIM_OK;
+}
+
+enum spooky_sim_res
+spooky_sim_encode(struct spooky_sim *sim, struct spooky_encoder *enc,
+        uint8_t *out, size_t max, size_t *out_count) {
+    if (sim == NULL || enc == NULL || out == NULL || out_count == NULL) {
+        return SPOOKY_SIM_ERROR_NULL;
+    }
+    uint8_t levels[ENCODE_CHUNK];
+    uint8_t level = sim->level;
+    size_t total = 0;
+    bool done = false;
+    while (!done) {
+        size_t count = 0;
+        while (count < ENCODE_CHUNK) {
+            enum spooky_encoder_step_res res = spooky_encoder_step(enc);
+            if (res < 0) { return SPOOKY_SIM_ERROR_BAD_ARGUMENT; }
+            if (res == SPOOKY_ENCODER_STEP_OK_DONE) { done = true; break; }
+            if (res == SPOOKY_ENCODER_STEP_OK_LOW) {
+                level = 0;
+            } else if (res == SPOOKY_ENCODER_STEP_OK_HIGH) {
+                level = 1;
+            }
+            levels[count++] = level;
+        }
+        size_t n = 0;
+        enum spooky_sim_res res = spooky_sim_run(sim, levels, count,
+            &out[total], max - total, &n);
+        if (res != SPOOKY_SIM_OK) { return res; }
+        total += n;
+    }
+    *out_count = total;
+    return SPOOKY_SIM_OK;
+}
@@ -0,0 +1,86 @@
+#ifndef SPOOKY_SIM_H
+#define SPOOKY_SIM_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "spooky_encoder.h"
+
+/* Host-side radio channel model, to go between the encoder's output
+ * and the decoder's input when trying out rates and profiles.
+ *
+ * The encoder's levels (one per encoder tick) are turned into receiver
+ * samples (0 or 1, one byte each), with:
+ *
+ * - OVERSAMPLE receiver samples per encoder tick, and a CLOCK_SKEW
+ *   between the two clocks (0.01 is a receiver running 1% fast);
+ * - Gaussian JITTER on every edge, with that std. dev. in samples;
+ * - ASYMMETRY samples added to each high pulse and taken from each low,
+ *   like a receiver with AGC (negative shortens highs);
+ * - single-sample spikes, with SPIKE_RATE odds per sample;
+ * - dropouts, where the line is held low for DROPOUT_LENGTH samples,
+ *   starting with DROPOUT_RATE odds per sample.
+ *
+ * Edges are moved rather than samples, and the output is written as
+ * runs (memset), with spikes and dropouts placed by drawing the gap to
+ * the next one, so the cost is per edge and per event rather than per
+ * sample. State carries over between calls, so a long transmission can
+ * be fed through in pieces. */
+
+struct spooky_sim_config {
+    float oversample;           /* receiver samples per encoder tick */
+    float clock_skew;           /* receiver clock error, as a fraction */
+    float jitter;               /* std. dev. of edge timing, in samples */
+    float asymmetry;            /* samples added to high pulses */
+    float spike_rate;           /* odds of a spike, per sample */
+    float dropout_rate;         /* odds of a dropout starting, per sample */
+    uint16_t dropout_length;    /* samples per dropout */
+    uint32_t seed;              /* for the PRNG */
+};
+
+struct spooky_sim {
+    struct spooky_sim_config cfg;
+    uint32_t rng;               /* PRNG state */
+    double rate;                /* samples per encoder tick, with skew */
+    double phase;               /* sample position of the next tick */
+    uint8_t level;              /* current transmitted level */
+    double last_edge;           /* sample position of the latest edge */
+    size_t next_spike;          /* samples until the next spike */
+    size_t next_dropout;        /* samples until the next dropout */
+    size_t dropout_left;        /* samples left in the current dropout */
+};
+
+enum spooky_sim_res {
+    SPOOKY_SIM_OK = 0,
+    SPOOKY_SIM_ERROR_NULL = -1,
+    SPOOKY_SIM_ERROR_BAD_ARGUMENT = -2,
+    SPOOKY_SIM_ERROR_SIZE = -3,
+};
+
+/* The PRNG behind the model (the linear congruential generator the
+ * tests have always used). Advances *STATE and returns the new value;
+ * use the high bits, since the low ones are weak. */
+uint32_t spooky_sim_lcg(uint32_t *state);
+
+/* Initialize a channel model. OVERSAMPLE must be at least 1, the
+ * rates must be in [0, 1), and the rest must be >= 0 (or > -1, for
+ * CLOCK_SKEW). */
+enum spooky_sim_res
+spooky_sim_init(struct spooky_sim *sim, const struct spooky_sim_config *cfg);
+
+/* Pass COUNT encoder LEVELS (0 or 1, one per encoder tick) through
+ * the channel, writing receiver samples to OUT (up to MAX of them).
+ * The number written is stored in *OUT_COUNT; it is about COUNT times
+ * the oversampling ratio. Returns ERROR_SIZE if MAX is too small. */
+enum spooky_sim_res
+spooky_sim_run(struct spooky_sim *sim, const uint8_t *levels, size_t count,
+    uint8_t *out, size_t max, size_t *out_count);
+
+/* Step ENC until its transmission is done, and pass its output through
+ * the channel, as with spooky_sim_run. */
+enum spooky_sim_res
+spooky_sim_encode(struct spooky_sim *sim, struct spooky_encoder *enc,
+    uint8_t *out, size_t max, size_t *out_count);
+
+#endif
@@ -0,0 +1,112 @@
+#ifndef SPOOKY_TRACE_H
+#define SPOOKY_TRACE_H
+
+#include <stdlib.h>
+#include <stdint.h>
+
+/* Binary event trace, for debugging the encoder and decoder in place.
+ *
+ * Building with -DSPOOKY_TRACE adds a small ring of events to each
+ * spooky_encoder and spooky_decoder: state changes, edge timings,
+ * resets (with the reason), and header locks. Recording an event is a
+ * few stores, so unlike LOG it's cheap enough to leave on in a timer
+ * interrupt, and it runs on the MCU. When something goes wrong, send
+ * the ring out (see spooky_trace_dump) and read it on the host with
+ * spooky_trace_print.
+ *
+ * Without SPOOKY_TRACE, none of this is compiled in. */
+
+/* Events kept, oldest dropped first. Must be a power of 2, <= 128. */
+#ifndef SPOOKY_TRACE_SIZE
+#define SPOOKY_TRACE_SIZE 32
+#endif
+
+/* Event types, and the meaning of their three args. */
+enum spooky_trace_type {
+    SPOOKY_TRACE_NONE = 0x00,
+    SPOOKY_TRACE_DEC_STATE = 0x01,  /* from, to, interval */
+    SPOOKY_TRACE_DEC_EDGE = 0x02,   /* ticks, pre_ticks, edge kind */
+    SPOOKY_TRACE_DEC_BYTE = 0x03,   /* state, byte */
+    SPOOKY_TRACE_DEC_RESET = 0x04,  /* reset reason, state, value */
+    SPOOKY_TRACE_DEC_LOCK = 0x05,   /* interval, skew, lock source */
+    SPOOKY_TRACE_ENC_START = 0x81,  /* size, tx_rate, trim */
+    SPOOKY_TRACE_ENC_STATE = 0x82,  /* from, to */
+    SPOOKY_TRACE_ENC_CLEAR = 0x83,  /* state */
+};
+
+enum spooky_trace_edge {
+    SPOOKY_TRACE_EDGE_HEADER,       /* edge during header search */
+    SPOOKY_TRACE_EDGE_SETUP,        /* half-bit setup edge */
+    SPOOKY_TRACE_EDGE_DATA,         /* mid-bit data edge */
+    SPOOKY_TRACE_EDGE_MISFIT,       /* fit neither window */
+};
+
+enum spooky_trace_reset {
+    SPOOKY_TRACE_RESET_LONG_RUN,    /* too long without a transition */
+    SPOOKY_TRACE_RESET_ZERO_LENGTH, /* value: 0 */
+    SPOOKY_TRACE_RESET_TOO_LONG,    /* value: the length */
+    SPOOKY_TRACE_RESET_BAD_SYNC,    /* value: the sync byte */
+    SPOOKY_TRACE_RESET_CHKSUM,      /* value: the payload's checksum */
+    SPOOKY_TRACE_RESET_FRAME,       /* frame delivered, value: size */
+    SPOOKY_TRACE_RESET_ADDRESS,     /* value: the first payload byte */
+    SPOOKY_TRACE_RESET_BAD_SYMBOL,  /* 4B5B code violation, value: ticks */
+};
+
+enum spooky_trace_lock {
+    SPOOKY_TRACE_LOCK_HEADER,       /* measured from the header */
+    SPOOKY_TRACE_LOCK_EXTERNAL,     /* spooky_decoder_lock */
+    SPOOKY_TRACE_LOCK_ALTERNATE,    /* switched to an alternate interval */
+};
+
+/* One event. Dumped as these four bytes, in this order. */
+struct spooky_trace_event {
+    uint8_t type;
+    uint8_t arg[3];
+};
+
+#define SPOOKY_TRACE_EVENT_SIZE 4
+
+struct spooky_trace {
+    uint8_t head;               /* next event written */
+    uint8_t full;               /* has wrapped around */
+    struct spooky_trace_event events[SPOOKY_TRACE_SIZE];
+};
+
+static inline void spooky_trace_record(struct spooky_trace *t,
+        uint8_t type, uint8_t a, uint8_t b, uint8_t c) {
+    struct spooky_trace_event *e = &t->events[t->head];
+    e->type = type;
+    e->arg[0] = a;
+    e->arg[1] = b;
+    e->arg[2] = c;
+    t->head = (t->head + 1) & (SPOOKY_TRACE_SIZE - 1);
+    if (t->head == 0) { t->full = 1; }
+}
+
+/* Copy the trace's events to OUT, oldest first, as
+ * SPOOKY_TRACE_EVENT_SIZE bytes each (up to MAX bytes' worth).
+ * Returns the number of bytes written. */
+static inline size_t spooky_trace_dump(const struct spooky_trace *t,
+        uint8_t *out, size_t max) {
+    uint8_t count = (t->full ? SPOOKY_TRACE_SIZE : t->head);
+    uint8_t start = (t->full ? t->head : 0);
+    size_t used = 0;
+    for (uint8_t i=0; i<count && used + SPOOKY_TRACE_EVENT_SIZE <= max; i++) {
+        const struct spooky_trace_event *e =
+            &t->events[(start + i) & (SPOOKY_TRACE_SIZE - 1)];
+        out[used++] = e->type;
+        out[used++] = e->arg[0];
+        out[used++] = e->arg[1];
+        out[used++] = e->arg[2];
+    }
+    return used;
+}
+
+#ifdef SPOOKY_TRACE
+#define SPOOKY_TRACE_EVENT(T, TYPE, A, B, C) \
+    spooky_trace_record(T, TYPE, (uint8_t)(A), (uint8_t)(B), (uint8_t)(C))
+#else
+#define SPOOKY_TRACE_EVENT(T, TYPE, A, B, C)
+#endif
+
+#endif
@@ -0,0 +1,87 @@
+/* Pretty-print a dumped event trace (see spooky_trace.h).
+ *
+ * Usage: spooky_trace_print [FILE]
+ *
+ * Reads events, as written by spooky_trace_dump, from FILE (or stdin),
+ * and prints one per line, oldest first. */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "spooky_trace.h"
+
+/* These match rx_mode in spooky_decoder.c and tx_mode in
+ * spooky_encoder.c. */
+static const char *dec_states[] = {
+    "HEADER", "LENGTH", "CHKSUM", "PAYLOAD", "SYNC",
+};
+static const char *enc_states[] = {
+    "NONE", "SHARP", "LONG", "LENGTH", "CHKSUM", "PAYLOAD", "GAP",
+};
+static const char *edge_kinds[] = { "header", "setup", "data", "misfit", };
+static const char *reset_reasons[] = {
+    "too long without a transition", "length 0", "length over buffer size",
+    "bad sync byte", "bad checksum", "frame delivered",
+    "frame for another address", "bad 4B5B symbol",
+};
+static const char *lock_sources[] = { "header", "external", "alternate", };
+
+#define NAME(TABLE, I) \
+    ((I) < sizeof(TABLE) / sizeof(TABLE[0]) ? TABLE[I] : "?")
+
+static void print_event(const uint8_t *e) {
+    uint8_t a = e[1], b = e[2], c = e[3];
+    switch (e[0]) {
+    case SPOOKY_TRACE_DEC_STATE:
+        printf("dec state %s -> %s, interval %u\n",
+            NAME(dec_states, a), NAME(dec_states, b), c);
+        break;
+    case SPOOKY_TRACE_DEC_EDGE:
+        printf("dec edge  %s after %u ticks", NAME(edge_kinds, c), a);
+        if (b != 0) { printf(" (setup at %u)", b); }
+        printf("\n");
+        break;
+    case SPOOKY_TRACE_DEC_BYTE:
+        printf("dec byte  0x%02x in %s\n", b, NAME(dec_states, a));
+        break;
+    case SPOOKY_TRACE_DEC_RESET:
+        printf("dec reset in %s: %s (%u)\n",
+            NAME(dec_states, b), NAME(reset_reasons, a), c);
+        break;
+    case SPOOKY_TRACE_DEC_LOCK:
+        printf("dec lock  interval %u, skew %d, from %s\n",
+            a, (int8_t)b, NAME(lock_sources, c));
+        break;
+    case SPOOKY_TRACE_ENC_START:
+        printf("enc start %u bytes, tx rate %u, trim %d\n", a, b, (int8_t)c);
+        break;
+    case SPOOKY_TRACE_ENC_STATE:
+        printf("enc state %s -> %s\n", NAME(enc_states, a), NAME(enc_states, b));
+        break;
+    case SPOOKY_TRACE_ENC_CLEAR:
+        printf("enc clear in %s\n", NAME(enc_states, a));
+        break;
+    default:
+        printf("unknown   %02x %02x %02x %02x\n", e[0], a, b, c);
+        break;
+    }
+}
+
+int main(int argc, char **argv) {
+    FILE *in = stdin;
+    if (argc > 1 && strcmp(argv[1], "-") != 0) {
+        in = fopen(argv[1], "rb");
+        if (in == NULL) {
+            fprintf(stderr, "can't open %s\n", argv[1]);
+            return 1;
+        }
+    }
+
+    uint8_t e[SPOOKY_TRACE_EVENT_SIZE];
+    unsigned long n = 0;
+    while (fread(e, 1, sizeof(e), in) == sizeof(e)) {
+        printf("%4lu  ", n++);
+        print_event(e);
+    }
+    return 0;
+}
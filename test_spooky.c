@@ -1,13 +1,28 @@
+#define _POSIX_C_SOURCE 200809L     /* pipe, for the pipeline tests */
+
 #include "greatest.h"
 #include "spooky_encoder.h"
 #include "spooky_decoder.h"
+#include "spooky_filter.h"
+#include "spooky_correlator.h"
+#include "spooky_channelizer.h"
+#include "spooky_pipeline.h"
+#include "spooky_sim.h"
+#include "spooky_frag.h"
+#include "spooky_arq.h"
+#include "spooky_agg.h"
+#include <math.h>
+#include <pthread.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 typedef struct spooky_encoder spooky_encoder;
 typedef struct spooky_decoder spooky_decoder;
 
 // weak PRNG
 static void set_TCSRNG_value(uint32_t new_value);
+static uint32_t totes_cryptographically_secure_random_number_generator();
 static void fill_buffer_with_noise(uint8_t *buf, size_t sz);
 
 /* globals */
@@ -17,6 +32,50 @@ struct spooky_decoder dec;
 uint8_t buf[BUF_SZ];
 #define RATE_MUL 2
 
+#ifdef SPOOKY_DECODER_FIXED_CB
+/* With a fixed callback, decoders don't keep the callback and udata
+ * they were initialized with, so remember them here, by decoder: the
+ * fixed callback gets the decoder as its udata. */
+#define FIXED_CB_DECODERS 8
+
+static struct {
+    struct spooky_decoder *dec;
+    spooky_decoder_cb *cb;
+    void *udata;
+} fixed_cbs[FIXED_CB_DECODERS];
+static uint8_t fixed_cb_next;
+
+void SPOOKY_DECODER_FIXED_CB(uint8_t *data, uint8_t size, void *udata) {
+    for (int i=0; i<FIXED_CB_DECODERS; i++) {
+        if (fixed_cbs[i].dec == udata) {
+            fixed_cbs[i].cb(data, size, fixed_cbs[i].udata);
+            return;
+        }
+    }
+}
+
+static enum spooky_decoder_init_res
+fixed_cb_decoder_init(struct spooky_decoder *d, uint8_t *buffer,
+        size_t buffer_size, spooky_decoder_cb *cb, void *udata) {
+    enum spooky_decoder_init_res res = spooky_decoder_init(d, buffer,
+        buffer_size, cb, udata);
+    if (res != SPOOKY_DECODER_INIT_OK || cb == NULL) { return res; }
+    int i;
+    for (i=0; i<FIXED_CB_DECODERS; i++) {
+        if (fixed_cbs[i].dec == d) { break; }
+    }
+    if (i == FIXED_CB_DECODERS) {   /* replace the oldest */
+        i = fixed_cb_next;
+        fixed_cb_next = (fixed_cb_next + 1) % FIXED_CB_DECODERS;
+    }
+    fixed_cbs[i].dec = d;
+    fixed_cbs[i].cb = cb;
+    fixed_cbs[i].udata = udata;
+    return res;
+}
+#define spooky_decoder_init fixed_cb_decoder_init
+#endif
+
 /*********************************************************************
  * Encoder
  *********************************************************************/
@@ -152,6 +211,89 @@ TEST encoder_step_should_emit_bits_slower_with_longer_tx_rate() {
     PASS();
 }
 
+/* Changed between messages, the rate should apply to the next one. */
+TEST encoder_set_rate_should_apply_between_messages() {
+    ASSERT_EQ(SPOOKY_ENCODER_INIT_OK, spooky_encoder_init(&enc, buf, BUF_SZ, 1));
+    ASSERT_EQ(SPOOKY_ENCODER_INIT_ERROR_NULL, spooky_encoder_set_rate(NULL, 10));
+    ASSERT_EQ(SPOOKY_ENCODER_INIT_ERROR_BAD_ARGUMENT,
+        spooky_encoder_set_rate(&enc, 0));
+    ASSERT_EQ(SPOOKY_ENCODER_ENQUEUE_OK,
+        spooky_encoder_enqueue(&enc, test_data, sizeof(test_data)));
+    ASSERT_EQ(SPOOKY_ENCODER_INIT_ERROR_BUSY, spooky_encoder_set_rate(&enc, 10));
+    while (spooky_encoder_step(&enc) != SPOOKY_ENCODER_STEP_OK_DONE) {}
+
+    ASSERT_EQ(SPOOKY_ENCODER_INIT_OK, spooky_encoder_set_rate(&enc, 10));
+    ASSERT_EQ(SPOOKY_ENCODER_INIT_OK, spooky_encoder_set_trim(&enc, 3));
+    ASSERT_EQ(SPOOKY_ENCODER_INIT_ERROR_BAD_ARGUMENT,
+        spooky_encoder_set_rate(&enc, 3));
+    ASSERT_EQ(SPOOKY_ENCODER_INIT_OK, spooky_encoder_set_trim(&enc, 0));
+    ASSERT_EQ(SPOOKY_ENCODER_ENQUEUE_OK,
+        spooky_encoder_enqueue(&enc, test_data, sizeof(test_data)));
+    for (int i=0; i<sizeof(expected); i++) {
+        for (int ticks=1; ticks<10; ticks++) {
+            ASSERT_EQ(SPOOKY_ENCODER_STEP_OK, spooky_encoder_step(&enc));
+        }
+        ASSERT_EQ(expected[i], spooky_encoder_step(&enc));
+    }
+    PASS();
+}
+
+/* Edges to the trimmed level come TRIM ticks late. */
+TEST encoder_step_should_delay_edges_with_trim(int trim) {
+    int rate = 10;
+    ASSERT_EQ(SPOOKY_ENCODER_INIT_OK, spooky_encoder_init(&enc, buf, BUF_SZ, rate));
+    ASSERT_EQ(SPOOKY_ENCODER_INIT_ERROR_BAD_ARGUMENT,
+        spooky_encoder_set_trim(&enc, rate));
+    ASSERT_EQ(SPOOKY_ENCODER_INIT_OK, spooky_encoder_set_trim(&enc, trim));
+    ASSERT_EQ(SPOOKY_ENCODER_ENQUEUE_OK,
+        spooky_encoder_enqueue(&enc, test_data, sizeof(test_data)));
+
+    enum spooky_encoder_step_res trimmed = (trim > 0
+        ? SPOOKY_ENCODER_STEP_OK_HIGH : SPOOKY_ENCODER_STEP_OK_LOW);
+    enum spooky_encoder_step_res delayed = SPOOKY_ENCODER_STEP_OK;
+    for (int i=0; i<sizeof(expected); i++) {
+        for (int ticks=1; ticks<rate; ticks++) {
+            enum spooky_encoder_step_res sres = spooky_encoder_step(&enc);
+            if (ticks == abs(trim)) {
+                ASSERT_EQ(delayed, sres);
+            } else {
+                ASSERT_EQ(SPOOKY_ENCODER_STEP_OK, sres);
+            }
+        }
+        enum spooky_encoder_step_res sres = spooky_encoder_step(&enc);
+        if (expected[i] == trimmed) {
+            ASSERT_EQ(SPOOKY_ENCODER_STEP_OK, sres);
+            delayed = trimmed;
+        } else {
+            ASSERT_EQ(expected[i], sres);
+            delayed = SPOOKY_ENCODER_STEP_OK;
+        }
+    }
+    PASS();
+}
+
+#ifdef SPOOKY_TRACE
+TEST encoder_trace_should_record_states() {
+    uint8_t dump[SPOOKY_TRACE_SIZE * SPOOKY_TRACE_EVENT_SIZE];
+    ASSERT_EQ(SPOOKY_ENCODER_INIT_OK, spooky_encoder_init(&enc, buf, BUF_SZ, 2));
+    ASSERT_EQ(SPOOKY_ENCODER_ENQUEUE_OK,
+        spooky_encoder_enqueue(&enc, test_data, sizeof(test_data)));
+    while (spooky_encoder_step(&enc) != SPOOKY_ENCODER_STEP_OK_DONE) {}
+
+    const uint8_t expect[][4] = {
+        { SPOOKY_TRACE_ENC_START, sizeof(test_data), 2, 0 },
+        { SPOOKY_TRACE_ENC_STATE, 1, 2, 0 },
+        { SPOOKY_TRACE_ENC_STATE, 2, 3, 0 },
+        { SPOOKY_TRACE_ENC_STATE, 3, 4, 0 },
+        { SPOOKY_TRACE_ENC_STATE, 4, 5, 0 },
+        { SPOOKY_TRACE_ENC_STATE, 5, 0, 0 },
+    };
+    ASSERT_EQ(sizeof(expect), spooky_trace_dump(&enc.trace, dump, sizeof(dump)));
+    ASSERT_EQ(0, memcmp(expect, dump, sizeof(expect)));
+    PASS();
+}
+#endif
+
 SUITE(encoder) {
     printf("sizeof encoder: %zd\n", sizeof(spooky_encoder));
     RUN_TEST(encoder_init_should_detect_bad_args);
@@ -162,6 +304,12 @@ SUITE(encoder) {
     RUN_TEST(encoder_clear_should_abort_current_TX);
     RUN_TEST(encoder_step_should_emit_bits_with_header_footer_and_checksum);
     RUN_TEST(encoder_step_should_emit_bits_slower_with_longer_tx_rate);
+    RUN_TEST(encoder_set_rate_should_apply_between_messages);
+    RUN_TESTp(encoder_step_should_delay_edges_with_trim, 3);
+    RUN_TESTp(encoder_step_should_delay_edges_with_trim, -3);
+#ifdef SPOOKY_TRACE
+    RUN_TEST(encoder_trace_should_record_states);
+#endif
 }
 
 
@@ -189,8 +337,10 @@ TEST decoder_init_should_detect_bad_args() {
     ASSERT_EQ(SPOOKY_DECODER_INIT_ERROR_NULL, res);
     res = spooky_decoder_init(&dec, NULL, BUF_SZ, dec_cb, NULL);
     ASSERT_EQ(SPOOKY_DECODER_INIT_ERROR_NULL, res);
+#ifndef SPOOKY_DECODER_FIXED_CB     /* the callback is ignored */
     res = spooky_decoder_init(&dec, buf, BUF_SZ, NULL, NULL);
     ASSERT_EQ(SPOOKY_DECODER_INIT_ERROR_NULL, res);
+#endif
     res = spooky_decoder_init(&dec, buf,
         SPOOKY_DECODER_MIN_BUFFER_SIZE - 1, dec_cb, NULL);
     ASSERT_EQ(SPOOKY_DECODER_INIT_ERROR_BAD_ARGUMENT, res);
@@ -225,18 +375,19 @@ TEST decoder_step_should_reject_noise() {
     PASS();
 }
 
-static int expect_byte(struct spooky_decoder *d, uint8_t b) {
+/* Send byte B, with HALF samples per half bit. */
+static int expect_byte_at(struct spooky_decoder *d, uint8_t b, int half) {
     enum spooky_decoder_step_res res;
     for (int i=0; i<8; i++) {
         bool bit = b & (1 << (7 - i));
-        for (int r=0; r < rate * RATE_MUL; r++) {
+        for (int r=0; r < half; r++) {
             res = spooky_decoder_step(d, !bit);
             if (res < 0) {
                 printf("step error: %d\n", res);
                 return 0;
             }
         }
-        for (int r=0; r < rate * RATE_MUL; r++) {
+        for (int r=0; r < half; r++) {
             res = spooky_decoder_step(d, bit);
             if (res < 0) {
                 printf("step error: %d\n", res);
@@ -247,6 +398,10 @@ static int expect_byte(struct spooky_decoder *d, uint8_t b) {
     return 1;
 }
 
+static int expect_byte(struct spooky_decoder *d, uint8_t b) {
+    return expect_byte_at(d, b, rate * RATE_MUL);
+}
+
 #define EB(B)                                   \
     if (GREATEST_IS_VERBOSE()) { printf(" -- expect_byte: 0x%02x\n", B); }  \
     if (!expect_byte(&dec, B)) { FAIL(); }
@@ -340,7 +495,9 @@ TEST decode_buffer_when_preceded_by_false_header() {
     PASS();
 }
 
-TEST decode_buffer_when_preceded_by_noise(uint16_t size, uint8_t seed, uint8_t ticks) {
+/* Send SIZE bytes of noise from SEED, then a frame. Returns whether
+ * the frame arrived intact. */
+static int noise_then_frame(uint16_t size, uint8_t seed, uint8_t ticks) {
     uint8_t noise_buf[size];
     set_TCSRNG_value(seed);
     memset(noise_buf, 0, size);
@@ -349,22 +506,53 @@ TEST decode_buffer_when_preceded_by_noise(uint16_t size, uint8_t seed, uint8_t t
 
     for (int i=0; i<size; i++) {
         if (GREATEST_IS_VERBOSE()) printf("### junk byte 0x%02x\n", noise_buf[i]);
-        EB(noise_buf[i]);
+        if (!expect_byte(&dec, noise_buf[i])) { return 0; }
     }
 
     if (GREATEST_IS_VERBOSE()) printf("### actual content\n");
-    EB(0xFF); // 0b1111 1111
-    EB(0x55); // 0b0101 0101
-    EB(0x01); // length
-    EB(0x85); // checksum, 0b1000 0101
-    EB(0x7a); // payload: 0x7a (arbitrary)
+    uint8_t frame[] = { 0xFF, 0x55, 0x01, 0x85, 0x7a };
+    for (int i=0; i<sizeof(frame); i++) {
+        if (!expect_byte(&dec, frame[i])) { return 0; }
+    }
+    return called == 1 && output_sz == 1 && output_buf[0] == 0x7a;
+}
 
-    ASSERT_EQ(1, called);
-    ASSERT_EQ(1, output_sz);
-    ASSERT_EQ(0x7a, output_buf[0]);
-    
+TEST decode_buffer_when_preceded_by_noise(uint16_t size, uint8_t seed, uint8_t ticks) {
+    ASSERT(noise_then_frame(size, seed, ticks));
+    PASS();
+}
+
+#ifdef SPOOKY_PROFILE_TINY
+/* The tiny profile's header is 4 short and 4 long transitions, then
+ * the rest of the 0x55 checked bit by bit, so noise matches it more
+ * often. A false header that reads a plausible length swallows the
+ * real frame as its payload (see the skipped
+ * recover_when_real_message_appears_during_false_payload_state), so
+ * some frames are lost: with these seeds, 21 of 2625 (0.8%). */
+#define TINY_NOISE_MAX_LOST_PERMILLE 10
+
+TEST decode_buffer_when_preceded_by_noise_mostly() {
+    int runs = 0, lost = 0;
+    for (int ticks=1; ticks<8; ticks++) {
+        for (int size=1; size<16; size++) {
+            for (int seed=0; seed<25; seed++) {
+                dec_setup(NULL);
+                if (!noise_then_frame(size, seed, ticks)) {
+                    if (GREATEST_IS_VERBOSE()) {
+                        printf("lost: size %d, seed %d, ticks %d\n",
+                            size, seed, ticks);
+                    }
+                    lost++;
+                }
+                runs++;
+            }
+        }
+    }
+    if (GREATEST_IS_VERBOSE()) { printf("lost %d of %d\n", lost, runs); }
+    ASSERT(lost * 1000 <= runs * TINY_NOISE_MAX_LOST_PERMILLE);
     PASS();
 }
+#endif
 
 TEST recover_from_noise() {
     /* This tests recovery -- the real data starts while the state machine
@@ -403,6 +591,382 @@ TEST recover_when_real_message_appears_during_false_payload_state() {
     
     PASS();
 }
+TEST decoder_with_fixed_interval_should_lock_at_that_rate() {
+    rate = 3;
+    ASSERT_EQ(SPOOKY_DECODER_INIT_OK,
+        spooky_decoder_fix_interval(&dec, rate * RATE_MUL));
+    EB(0xFF); // 0b1111 1111
+    EB(0x55); // 0b0101 0101
+    EB(0x01); // length
+    EB(0x85); // checksum, 0b1000 0101
+    EB(0x7a); // payload: 0x7a (arbitrary)
+
+    ASSERT_EQ(1, called);
+    ASSERT_EQ(1, output_sz);
+    ASSERT_EQ(0x7a, output_buf[0]);
+    PASS();
+}
+
+TEST decoder_with_fixed_interval_should_ignore_other_rates() {
+    rate = 1;
+    ASSERT_EQ(SPOOKY_DECODER_INIT_ERROR_NULL,
+        spooky_decoder_fix_interval(NULL, 6));
+    ASSERT_EQ(SPOOKY_DECODER_INIT_OK, spooky_decoder_fix_interval(&dec, 6));
+    EB(0xFF); // 0b1111 1111
+    EB(0x55); // 0b0101 0101
+    EB(0x01); // length
+    EB(0x85); // checksum, 0b1000 0101
+    EB(0x7a); // payload: 0x7a (arbitrary)
+
+    ASSERT_EQ(0, called);
+    PASS();
+}
+
+#ifndef SPOOKY_PROFILE_TINY
+/* The header's interval is off by more than the windows allow for
+ * the rest of the frame, so it takes one of the alternates. */
+TEST decoder_should_switch_to_alternate_interval(int half) {
+    uint8_t msg[] = { 0x03, 0xf9, 0x01, 0x02, 0x03 };
+    if (!expect_byte_at(&dec, 0xFF, 8)) { FAIL(); }
+    if (!expect_byte_at(&dec, 0x55, 8)) { FAIL(); }
+    for (int i=0; i<sizeof(msg); i++) {
+        if (!expect_byte_at(&dec, msg[i], half)) { FAIL(); }
+    }
+
+    ASSERT_EQ(1, called);
+    ASSERT_EQ(3, output_sz);
+    ASSERT_EQ(0, memcmp(&msg[2], output_buf, 3));
+#ifdef SPOOKY_DECODER_STATS
+    /* One lock, ending in a frame, however the measured interval fared. */
+    ASSERT_EQ(1, dec.stats.locks);
+    ASSERT_EQ(0, dec.stats.false_locks);
+    ASSERT_EQ(1, dec.stats.frames);
+#endif
+    PASS();
+}
+#endif
+
+TEST decoder_should_drop_frames_for_other_addresses() {
+    rate = 3;
+    ASSERT_EQ(SPOOKY_DECODER_INIT_ERROR_NULL,
+        spooky_decoder_set_address(NULL, 0xED, 0xFF));
+    ASSERT_EQ(SPOOKY_DECODER_INIT_OK,
+        spooky_decoder_set_address(&dec, 0xED, 0xFF));
+
+    /* Payload EE 05, for someone else. The next frame follows right
+     * after its first byte, so it's only received if the decoder gave
+     * up on this one there. */
+    EB(0xFF);
+    EB(0x55);
+    EB(0x02);
+    EB(0x0C);
+    EB(0xEE);
+
+    /* Payload ED 05. */
+    EB(0xFF);
+    EB(0x55);
+    EB(0x02);
+    EB(0x0D);
+    EB(0xED);
+    EB(0x05);
+    ASSERT_EQ(1, called);
+    ASSERT_EQ(2, output_sz);
+    ASSERT_EQ(0xED, output_buf[0]);
+#ifdef SPOOKY_DECODER_STATS
+    ASSERT_EQ(1, dec.stats.resets_address);
+#endif
+
+    /* Only the high nibble has to match. */
+    called = 0;
+    ASSERT_EQ(SPOOKY_DECODER_INIT_OK,
+        spooky_decoder_set_address(&dec, 0xE0, 0xF0));
+    EB(0xFF);
+    EB(0x55);
+    EB(0x02);
+    EB(0x0C);
+    EB(0xEE);
+    EB(0x05);
+    ASSERT_EQ(1, called);
+    ASSERT_EQ(0xEE, output_buf[0]);
+    PASS();
+}
+
+#ifdef SPOOKY_DECODER_STATS
+/* Run a frame with length LEN, checksum CS, and one payload byte. */
+static int expect_frame_1(uint8_t len, uint8_t cs, uint8_t payload) {
+    return expect_byte(&dec, 0xFF) && expect_byte(&dec, 0x55)
+        && expect_byte(&dec, len) && expect_byte(&dec, cs)
+        && expect_byte(&dec, payload);
+}
+
+TEST decoder_stats_should_count_frames_and_failures() {
+    struct spooky_decoder_stats st;
+    rate = 3;
+    ASSERT_EQ(SPOOKY_DECODER_INIT_ERROR_NULL,
+        spooky_decoder_read_stats(NULL, &st, false));
+    ASSERT_EQ(SPOOKY_DECODER_INIT_ERROR_NULL,
+        spooky_decoder_read_stats(&dec, NULL, false));
+
+    ASSERT(expect_frame_1(0x01, 0x85, 0x7a));   /* good */
+    ASSERT(expect_frame_1(0x01, 0x86, 0x7a));   /* bad checksum */
+    ASSERT(expect_frame_1(0x00, 0x85, 0x7a));   /* length 0 */
+    ASSERT(expect_frame_1(OUTPUT_BUF_SZ + 1, 0x85, 0x7a));  /* too long */
+    ASSERT(expect_byte(&dec, 0xFF));
+    ASSERT(expect_byte(&dec, 0x55));
+    for (int i=0; i<8 * rate * RATE_MUL; i++) {  /* no transitions */
+        (void)spooky_decoder_step(&dec, true);
+    }
+    ASSERT(expect_frame_1(0x01, 0x85, 0x7a));   /* good */
+
+    ASSERT_EQ(SPOOKY_DECODER_INIT_OK, spooky_decoder_read_stats(&dec, &st, true));
+    ASSERT_EQ(2, st.frames);
+    ASSERT_EQ(1, st.chksum_failures);
+    ASSERT_EQ(1, st.resets_zero_length);
+    ASSERT_EQ(1, st.resets_too_long);
+    ASSERT_EQ(1, st.resets_long_run);
+    ASSERT_EQ(0, st.resets_bad_sync);
+    ASSERT_EQ(0, st.resets_address);
+    ASSERT_EQ(6, st.locks);
+    ASSERT_EQ(4, st.false_locks);
+    uint8_t bin = (rate * RATE_MUL) >> SPOOKY_DECODER_STATS_BIN_SHIFT;
+    for (int i=0; i<SPOOKY_DECODER_STATS_BINS; i++) {
+        ASSERT_EQ(i == bin ? 6 : 0, st.intervals[i]);
+    }
+
+    /* Cleared. */
+    ASSERT_EQ(SPOOKY_DECODER_INIT_OK, spooky_decoder_read_stats(&dec, &st, false));
+    ASSERT_EQ(0, st.frames);
+    ASSERT_EQ(0, st.locks);
+    ASSERT_EQ(0, st.intervals[bin]);
+    PASS();
+}
+#endif
+
+#ifdef SPOOKY_DECODER_STATS
+/* Clearing the counters between a lock and its frame shouldn't count
+ * the frame in progress as a false lock, or wrap the count. */
+TEST decoder_stats_should_survive_clearing_mid_frame() {
+    struct spooky_decoder_stats st;
+    rate = 3;
+    ASSERT(expect_byte(&dec, 0xFF));
+    ASSERT(expect_byte(&dec, 0x55));
+    ASSERT(expect_byte(&dec, 0x01));
+    ASSERT_EQ(SPOOKY_DECODER_INIT_OK, spooky_decoder_read_stats(&dec, &st, true));
+    ASSERT_EQ(1, st.locks);
+    ASSERT_EQ(0, st.false_locks);
+    ASSERT_EQ(0, st.frames);
+
+    ASSERT(expect_byte(&dec, 0x85));
+    ASSERT(expect_byte(&dec, 0x7a));
+    ASSERT_EQ(1, called);
+    ASSERT_EQ(SPOOKY_DECODER_INIT_OK, spooky_decoder_read_stats(&dec, &st, true));
+    ASSERT_EQ(0, st.locks);
+    ASSERT_EQ(0, st.false_locks);
+    ASSERT_EQ(1, st.frames);
+    PASS();
+}
+#endif
+
+#ifdef SPOOKY_TRACE
+/* Find the first event in DUMP (of N bytes) of TYPE, at or after
+ * byte FROM, or return -1. */
+static int find_event(const uint8_t *dump, size_t n, size_t from, uint8_t type) {
+    for (size_t i=from; i<n; i += SPOOKY_TRACE_EVENT_SIZE) {
+        if (dump[i] == type) { return i; }
+    }
+    return -1;
+}
+
+TEST decoder_trace_should_record_frame() {
+    uint8_t dump[SPOOKY_TRACE_SIZE * SPOOKY_TRACE_EVENT_SIZE];
+    rate = 3;
+    EB(0xFF);
+    EB(0x55);
+    EB(0x01);
+    EB(0x85);
+    EB(0x7a);
+    ASSERT_EQ(1, called);
+
+    size_t n = spooky_trace_dump(&dec.trace, dump, sizeof(dump));
+    ASSERT(n > 0);
+    ASSERT_EQ(0, n % SPOOKY_TRACE_EVENT_SIZE);
+
+    int lock = find_event(dump, n, 0, SPOOKY_TRACE_DEC_LOCK);
+    ASSERT(lock >= 0);
+    ASSERT_EQ(rate * RATE_MUL, dump[lock + 1]);
+    ASSERT_EQ(SPOOKY_TRACE_LOCK_HEADER, dump[lock + 3]);
+
+    /* States, in order, after the lock. */
+    const uint8_t states[][2] = { {1, 2}, {2, 3}, {3, 0} };
+    int at = lock;
+    for (int i=0; i<3; i++) {
+        at = find_event(dump, n, at, SPOOKY_TRACE_DEC_STATE);
+        ASSERT(at >= 0);
+        ASSERT_EQ(states[i][0], dump[at + 1]);
+        ASSERT_EQ(states[i][1], dump[at + 2]);
+        at += SPOOKY_TRACE_EVENT_SIZE;
+    }
+
+    /* Last: the payload byte, the reset, and back to HEADER. */
+    const uint8_t *last = &dump[n - 3*SPOOKY_TRACE_EVENT_SIZE];
+    ASSERT_EQ(SPOOKY_TRACE_DEC_BYTE, last[0]);
+    ASSERT_EQ(0x7a, last[2]);
+    ASSERT_EQ(SPOOKY_TRACE_DEC_RESET, last[4]);
+    ASSERT_EQ(SPOOKY_TRACE_RESET_FRAME, last[5]);
+    ASSERT_EQ(1, last[7]);
+    ASSERT_EQ(SPOOKY_TRACE_DEC_STATE, last[8]);
+    PASS();
+}
+
+TEST decoder_trace_should_record_reset_reason() {
+    uint8_t dump[SPOOKY_TRACE_SIZE * SPOOKY_TRACE_EVENT_SIZE];
+    rate = 3;
+    EB(0xFF);
+    EB(0x55);
+    EB(0x00);
+    size_t n = spooky_trace_dump(&dec.trace, dump, sizeof(dump));
+    int reset = find_event(dump, n, 0, SPOOKY_TRACE_DEC_RESET);
+    ASSERT(reset >= 0);
+    ASSERT_EQ(SPOOKY_TRACE_RESET_ZERO_LENGTH, dump[reset + 1]);
+    PASS();
+}
+
+TEST trace_dump_should_drop_oldest_events() {
+    struct spooky_trace t;
+    uint8_t dump[SPOOKY_TRACE_SIZE * SPOOKY_TRACE_EVENT_SIZE];
+    memset(&t, 0, sizeof(t));
+    ASSERT_EQ(0, spooky_trace_dump(&t, dump, sizeof(dump)));
+    for (int i=0; i<SPOOKY_TRACE_SIZE + 5; i++) {
+        spooky_trace_record(&t, SPOOKY_TRACE_DEC_BYTE, 0, i, 0);
+    }
+    ASSERT_EQ(sizeof(dump), spooky_trace_dump(&t, dump, sizeof(dump)));
+    for (int i=0; i<SPOOKY_TRACE_SIZE; i++) {
+        ASSERT_EQ(i + 5, dump[i*SPOOKY_TRACE_EVENT_SIZE + 2]);
+    }
+    /* Only whole events fit. */
+    ASSERT_EQ(SPOOKY_TRACE_EVENT_SIZE, spooky_trace_dump(&t, dump, 7));
+    PASS();
+}
+#endif
+
+#ifndef SPOOKY_PROFILE_TINY
+/* Edges that fit no window, many times a bit, should saturate the
+ * count, rather than wrap it around to look like a clean frame. */
+TEST decoder_should_saturate_misfits() {
+    rate = 20;
+    EB(0xFF);
+    EB(0x55);
+    for (int i=0; i<320; i++) {   /* an edge every tick */
+        (void)spooky_decoder_step(&dec, i & 1);
+    }
+    ASSERT_EQ(40, dec.interval);  /* still reading the length */
+    ASSERT_EQ(UINT8_MAX, dec.misfits);
+    PASS();
+}
+#endif
+
+#ifdef SPOOKY_DECODER_STREAM
+static struct {
+    uint8_t bytes[OUTPUT_BUF_SZ];
+    uint8_t count;
+    uint8_t length;
+    uint8_t ends;
+    bool ok;
+    int called_at_end;          /* whether the frame cb had run */
+} stream;
+
+static void stream_byte_cb(uint8_t byte, uint8_t index, uint8_t length,
+        void *udata) {
+    if (index == stream.count) { stream.bytes[stream.count++] = byte; }
+    stream.length = length;
+}
+
+static void stream_end_cb(bool ok, void *udata) {
+    stream.ends++;
+    stream.ok = ok;
+    stream.called_at_end = *(int *)udata;
+}
+
+/* Send a header, length 3, checksum CS, and then payload 01 02 03,
+ * checking that each byte streams out before the frame is done. */
+static int stream_frame(uint8_t cs) {
+    memset(&stream, 0, sizeof(stream));
+    if (SPOOKY_DECODER_INIT_OK != spooky_decoder_set_stream(&dec,
+            stream_byte_cb, stream_end_cb)) {
+        return 0;
+    }
+    if (!expect_byte(&dec, 0xFF) || !expect_byte(&dec, 0x55)
+        || !expect_byte(&dec, 3) || !expect_byte(&dec, cs)) {
+        return 0;
+    }
+    for (uint8_t b=1; b<=3; b++) {
+        if (!expect_byte(&dec, b)) { return 0; }
+        if (b < 3 && (stream.count != b || stream.ends != 0)) { return 0; }
+    }
+    return stream.count == 3 && stream.length == 3;
+}
+
+TEST decoder_stream_should_pass_bytes_then_commit() {
+    rate = 3;
+    ASSERT_EQ(SPOOKY_DECODER_INIT_ERROR_NULL,
+        spooky_decoder_set_stream(NULL, stream_byte_cb, stream_end_cb));
+    ASSERT(stream_frame(0xF9));
+    ASSERT_EQ(1, stream.bytes[0]);
+    ASSERT_EQ(3, stream.bytes[2]);
+    ASSERT_EQ(1, stream.ends);
+    ASSERT(stream.ok);
+    ASSERT_EQ(0, stream.called_at_end);     /* commit comes first */
+    ASSERT_EQ(1, called);
+    PASS();
+}
+
+TEST decoder_stream_should_abort_on_bad_checksum() {
+    rate = 3;
+    ASSERT(stream_frame(0xF8));
+    ASSERT_EQ(1, stream.ends);
+    ASSERT_FALSE(stream.ok);
+    ASSERT_EQ(0, called);
+    PASS();
+}
+
+TEST decoder_stream_should_abort_when_cut_off() {
+    rate = 3;
+    memset(&stream, 0, sizeof(stream));
+    ASSERT_EQ(SPOOKY_DECODER_INIT_OK,
+        spooky_decoder_set_stream(&dec, stream_byte_cb, stream_end_cb));
+    EB(0xFF);
+    EB(0x55);
+    EB(0x00);                   /* length 0: never reaches the payload */
+    EB(0xFF);
+    EB(0x55);
+    EB(0x03);
+    EB(0xF9);
+    EB(0x01);
+    ASSERT_EQ(1, stream.count);
+    ASSERT_EQ(0, stream.ends);
+    for (int i=0; i<8 * rate * RATE_MUL; i++) {  /* no transitions */
+        (void)spooky_decoder_step(&dec, true);
+    }
+    ASSERT_EQ(1, stream.ends);
+    ASSERT_FALSE(stream.ok);
+    ASSERT_EQ(0, called);
+
+    /* Cleared: nothing streams, but frames still arrive. */
+    ASSERT_EQ(SPOOKY_DECODER_INIT_OK,
+        spooky_decoder_set_stream(&dec, NULL, NULL));
+    memset(&stream, 0, sizeof(stream));
+    EB(0xFF);
+    EB(0x55);
+    EB(0x01);
+    EB(0x85);
+    EB(0x7a);
+    ASSERT_EQ(0, stream.count);
+    ASSERT_EQ(0, stream.ends);
+    ASSERT_EQ(1, called);
+    PASS();
+}
+#endif
+
 SUITE(decoder) {
     printf("sizeof decoder: %zd\n", sizeof(spooky_decoder));
 
@@ -417,6 +981,28 @@ SUITE(decoder) {
     RUN_TEST(decoder_step_should_return_received_buffer_when_rate_is_multiple_of_steps_7);
     RUN_TEST(decode_buffer_when_preceded_by_false_header);
     RUN_TEST(recover_from_noise);
+    RUN_TEST(decoder_with_fixed_interval_should_lock_at_that_rate);
+    RUN_TEST(decoder_with_fixed_interval_should_ignore_other_rates);
+    RUN_TEST(decoder_should_drop_frames_for_other_addresses);
+#ifndef SPOOKY_PROFILE_TINY
+    RUN_TESTp(decoder_should_switch_to_alternate_interval, 5);
+    RUN_TESTp(decoder_should_switch_to_alternate_interval, 11);
+    RUN_TEST(decoder_should_saturate_misfits);
+#endif
+#ifdef SPOOKY_DECODER_STATS
+    RUN_TEST(decoder_stats_should_count_frames_and_failures);
+    RUN_TEST(decoder_stats_should_survive_clearing_mid_frame);
+#endif
+#ifdef SPOOKY_TRACE
+    RUN_TEST(decoder_trace_should_record_frame);
+    RUN_TEST(decoder_trace_should_record_reset_reason);
+    RUN_TEST(trace_dump_should_drop_oldest_events);
+#endif
+#ifdef SPOOKY_DECODER_STREAM
+    RUN_TEST(decoder_stream_should_pass_bytes_then_commit);
+    RUN_TEST(decoder_stream_should_abort_on_bad_checksum);
+    RUN_TEST(decoder_stream_should_abort_when_cut_off);
+#endif
 
     RUN_TEST(recover_when_real_message_appears_during_false_payload_state);
 
@@ -432,7 +1018,10 @@ SUITE(decoder) {
     RUN_TESTp(decode_buffer_when_preceded_by_noise, 2, 7, 7);
     RUN_TESTp(decode_buffer_when_preceded_by_noise, 15, 2, 3);
 
-    // Fuzz the decoder
+    // Fuzz the decoder.
+#ifdef SPOOKY_PROFILE_TINY
+    RUN_TEST(decode_buffer_when_preceded_by_noise_mostly);
+#else
     for (int ticks=1; ticks<8; ticks++) {
         for (int size=1; size<16; size++) {
             for (int seed=0; seed<25; seed++) {
@@ -444,6 +1033,68 @@ SUITE(decoder) {
             }
         }
     }
+#endif
+}
+
+
+/*********************************************************************
+ * Filter
+ *********************************************************************/
+
+static struct spooky_filter filt;
+
+TEST filter_init_should_detect_bad_args() {
+    ASSERT_EQ(SPOOKY_FILTER_INIT_ERROR_NULL, spooky_filter_init(NULL, 3, 2));
+    ASSERT_EQ(SPOOKY_FILTER_INIT_ERROR_BAD_ARGUMENT,
+        spooky_filter_init(&filt, 0, 0));
+    ASSERT_EQ(SPOOKY_FILTER_INIT_ERROR_BAD_ARGUMENT,
+        spooky_filter_init(&filt, SPOOKY_FILTER_MAX_WINDOW + 1, 5));
+    ASSERT_EQ(SPOOKY_FILTER_INIT_ERROR_BAD_ARGUMENT,
+        spooky_filter_init(&filt, 3, 4));
+    ASSERT_EQ(SPOOKY_FILTER_INIT_ERROR_BAD_ARGUMENT,
+        spooky_filter_init(&filt, 4, 2)); // not a majority
+    ASSERT_EQ(SPOOKY_FILTER_INIT_OK, spooky_filter_init(&filt, 3, 2));
+    ASSERT_EQ(SPOOKY_FILTER_INIT_OK,
+        spooky_filter_init(&filt, SPOOKY_FILTER_MAX_WINDOW, 5));
+    PASS();
+}
+
+TEST filter_should_drop_single_sample_spikes() {
+    ASSERT_EQ(SPOOKY_FILTER_INIT_OK, spooky_filter_init(&filt, 3, 2));
+    bool in[]  = { 0, 0, 1, 0, 0, 1, 1, 1, 0, 1, 1, 0, 0, 0, };
+    bool out[] = { 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 0, 0, };
+    for (int i=0; i<sizeof(in); i++) {
+        ASSERT_EQ(out[i], spooky_filter_step(&filt, in[i]));
+    }
+    PASS();
+}
+
+TEST filter_should_delay_edges_by_need_minus_one(uint8_t window, uint8_t need) {
+    ASSERT_EQ(SPOOKY_FILTER_INIT_OK, spooky_filter_init(&filt, window, need));
+    int last_edge = -1;
+    bool level = false;
+    for (int i=0; i<64; i++) {
+        bool bit = (i / 8) & 0x01; // edge every 8 samples
+        bool res = spooky_filter_step(&filt, bit);
+        if (res != level) {
+            level = res;
+            ASSERT_EQ(need - 1, i % 8);
+            if (last_edge != -1) { ASSERT_EQ(8, i - last_edge); }
+            last_edge = i;
+        }
+    }
+    ASSERT(last_edge != -1);
+    PASS();
+}
+
+SUITE(filter) {
+    RUN_TEST(filter_init_should_detect_bad_args);
+    RUN_TEST(filter_should_drop_single_sample_spikes);
+    RUN_TESTp(filter_should_delay_edges_by_need_minus_one, 1, 1);
+    RUN_TESTp(filter_should_delay_edges_by_need_minus_one, 3, 2);
+    RUN_TESTp(filter_should_delay_edges_by_need_minus_one, 3, 3);
+    RUN_TESTp(filter_should_delay_edges_by_need_minus_one, 5, 3);
+    RUN_TESTp(filter_should_delay_edges_by_need_minus_one, 8, 6);
 }
 
 
@@ -456,11 +1107,7 @@ static uint32_t TCSRNG_value = (1L << 31) - 1;
 static void set_TCSRNG_value(uint32_t new_value) { TCSRNG_value = new_value; }
 
 static uint32_t totes_cryptographically_secure_random_number_generator() {
-    static uint32_t mul = (1L << 31) - 19;
-    static uint32_t inc = (1L << 31) - 61;
-
-    TCSRNG_value = (TCSRNG_value * mul) + inc;
-    return TCSRNG_value;
+    return spooky_sim_lcg(&TCSRNG_value);
 }
 
 static void fill_buffer_with_noise(uint8_t *buf, size_t sz) {
@@ -525,22 +1172,2239 @@ TEST data_should_tx_and_rx_intact(uint8_t size, uint32_t seed, uint8_t ticks) {
     PASS();
 }
 
-SUITE(integration) {
-    // regression tests
-    RUN_TESTp(data_should_tx_and_rx_intact, 9, 1, 1);
+#define MAX_SAMPLES 4096
 
-    // fuzz testing
-    for (int size=8; size<16; size++) {
-        for (int ticks=1; ticks < 4; ticks++) {
-            for (int seed=0; seed<50; seed++) {
-                if (GREATEST_IS_VERBOSE()) {
-                    printf("size %d, ticks %d, seed %d:\n",
-                        size, ticks, seed);
-                }
-                RUN_TESTp(data_should_tx_and_rx_intact, size, seed, ticks);
-            }
+/* Run the encoder to completion, saving RATE_MUL samples per step.
+ * Returns the number of samples, or 0 on error. */
+static size_t collect_samples(bool *samples, size_t max) {
+    size_t count = 0;
+    bool bit = false;
+    for (;;) {
+        enum spooky_encoder_step_res esres = spooky_encoder_step(&enc);
+        if (esres < 0) { return 0; }
+        if (esres == SPOOKY_ENCODER_STEP_OK_DONE) { break; }
+        if (esres == SPOOKY_ENCODER_STEP_OK_LOW) {
+            bit = false;
+        } else if (esres == SPOOKY_ENCODER_STEP_OK_HIGH) {
+            bit = true;
         }
+        for (int i=0; i<RATE_MUL; i++) {
+            if (count == max) { return 0; }
+            samples[count++] = bit;
+        }
+    }
+    return count;
+}
+
+TEST encoder_preamble_should_lengthen_frame() {
+    static bool samples[MAX_SAMPLES];
+    uint8_t msg[] = { 0x01, 0x02, 0x03 };
+    ASSERT_EQ(SPOOKY_ENCODER_INIT_ERROR_NULL,
+        spooky_encoder_set_preamble(NULL, 1));
+    ASSERT_EQ(SPOOKY_ENCODER_INIT_OK, spooky_encoder_init(&enc, buf, 8, 2));
+    ASSERT_EQ(SPOOKY_ENCODER_INIT_ERROR_BAD_ARGUMENT,
+        spooky_encoder_set_preamble(&enc, UINT16_MAX / 2));
+    ASSERT_EQ(SPOOKY_ENCODER_ENQUEUE_OK, spooky_encoder_enqueue(&enc, msg, 3));
+    size_t plain = collect_samples(samples, MAX_SAMPLES);
+    ASSERT(plain > 0);
+
+    ASSERT_EQ(SPOOKY_ENCODER_INIT_OK, spooky_encoder_init(&enc, buf, 8, 2));
+    ASSERT_EQ(SPOOKY_ENCODER_INIT_OK, spooky_encoder_set_preamble(&enc, 16));
+    ASSERT_EQ(SPOOKY_ENCODER_ENQUEUE_OK, spooky_encoder_enqueue(&enc, msg, 3));
+    size_t count = collect_samples(samples, MAX_SAMPLES);
+    ASSERT_EQ(plain + 16 * 2 * 2 * RATE_MUL, count);
+
+    /* The preamble is more of the header's sharp transitions. */
+    for (size_t i=2 * RATE_MUL; i<16 * 2 * 2 * RATE_MUL; i++) {
+        ASSERT(samples[i] != samples[i + 2 * RATE_MUL]);
+    }
+    PASS();
+}
+
+TEST decoder_step_idle_should_report_empty_channel() {
+    uint16_t sleep = 1;
+    dec_setup(NULL);
+    ASSERT_EQ(SPOOKY_DECODER_STEP_ERROR_NULL,
+        spooky_decoder_step_idle(NULL, false, &sleep));
+    ASSERT_EQ(SPOOKY_DECODER_STEP_ERROR_NULL,
+        spooky_decoder_step_idle(&dec, false, NULL));
+
+    /* Off by default. */
+    for (int i=0; i<300; i++) {
+        ASSERT_EQ(SPOOKY_DECODER_STEP_OK,
+            spooky_decoder_step_idle(&dec, false, &sleep));
+        ASSERT_EQ(0, sleep);
+    }
+
+    ASSERT_EQ(SPOOKY_DECODER_INIT_OK, spooky_decoder_set_wakeup(&dec, 100, 10));
+    for (int i=0; i<9; i++) {
+        ASSERT_EQ(SPOOKY_DECODER_STEP_OK,
+            spooky_decoder_step_idle(&dec, false, &sleep));
+    }
+    ASSERT_EQ(SPOOKY_DECODER_STEP_IDLE,
+        spooky_decoder_step_idle(&dec, false, &sleep));
+    ASSERT_EQ(90, sleep);
+
+    /* An edge restarts the count. */
+    for (int i=0; i<5; i++) {
+        ASSERT_EQ(SPOOKY_DECODER_STEP_OK,
+            spooky_decoder_step_idle(&dec, false, &sleep));
+    }
+    for (int i=0; i<10; i++) {    /* the edge, then 9 quiet ticks */
+        ASSERT_EQ(SPOOKY_DECODER_STEP_OK,
+            spooky_decoder_step_idle(&dec, true, &sleep));
+        ASSERT_EQ(0, sleep);
+    }
+    ASSERT_EQ(SPOOKY_DECODER_STEP_IDLE,
+        spooky_decoder_step_idle(&dec, true, &sleep));
+
+    /* A preamble no longer than the listen time leaves no time to sleep. */
+    ASSERT_EQ(SPOOKY_DECODER_INIT_OK, spooky_decoder_set_wakeup(&dec, 10, 10));
+    for (int i=0; i<9; i++) {
+        (void)spooky_decoder_step_idle(&dec, true, &sleep);
+    }
+    ASSERT_EQ(SPOOKY_DECODER_STEP_IDLE,
+        spooky_decoder_step_idle(&dec, true, &sleep));
+    ASSERT_EQ(0, sleep);
+    PASS();
+}
+
+/* A receiver that sleeps whenever the decoder says it can should
+ * still get a frame with a wake-up preamble, wherever the frame
+ * starts in its sleep cycle. */
+TEST duty_cycled_rx_should_catch_frame_with_preamble(uint16_t offset) {
+    static bool samples[MAX_SAMPLES];
+    uint8_t msg[] = { 0xED, 0x05, 0x7a, 0x00, 0xff };
+    const uint16_t preamble_bits = 32;
+    const uint16_t preamble = preamble_bits * 2 * 2 * RATE_MUL;
+    memset(samples, 0, offset * sizeof(samples[0]));
+    ASSERT_EQ(SPOOKY_ENCODER_INIT_OK, spooky_encoder_init(&enc, buf, 8, 2));
+    ASSERT_EQ(SPOOKY_ENCODER_INIT_OK,
+        spooky_encoder_set_preamble(&enc, preamble_bits));
+    ASSERT_EQ(SPOOKY_ENCODER_ENQUEUE_OK,
+        spooky_encoder_enqueue(&enc, msg, sizeof(msg)));
+    size_t count = collect_samples(&samples[offset], MAX_SAMPLES - offset);
+    ASSERT(count > 0);
+    count += offset;
+
+    called = 0;
+    output_sz = 0;
+    ASSERT_EQ(SPOOKY_DECODER_INIT_OK, spooky_decoder_init(&dec,
+            output_buf, OUTPUT_BUF_SZ, dec_cb, (void *)&called));
+    ASSERT_EQ(SPOOKY_DECODER_INIT_OK, spooky_decoder_set_wakeup(&dec,
+            preamble, 4 * 2 * RATE_MUL));
+    size_t awake = 0;
+    for (size_t i=0; i<count; i++) {
+        uint16_t sleep = 0;
+        awake++;
+        ASSERT(spooky_decoder_step_idle(&dec, samples[i], &sleep) >= 0);
+        i += sleep;
+    }
+    ASSERT_EQ(1, called);
+    ASSERT_EQ(sizeof(msg), output_sz);
+    ASSERT_EQ(0, memcmp(msg, output_buf, sizeof(msg)));
+    if (offset > preamble) { ASSERT(awake < count - preamble / 2); }
+    PASS();
+}
+
+/* Insert isolated single-sample spikes, away from real edges (which
+ * they would just move a bit), and filter them out. */
+#define SPIKE_ODDS 16
+
+TEST data_should_tx_and_rx_intact_through_spikes(uint8_t size, uint32_t seed,
+        uint8_t ticks) {
+    uint8_t in_buf[size];
+    uint8_t out_buf[size + 8];
+    static bool samples[MAX_SAMPLES];
+    set_TCSRNG_value(seed);
+    memset(out_buf, 0, size);
+    fill_buffer_with_noise(in_buf, size);
+    called = 0;
+
+    ASSERT_EQ(SPOOKY_ENCODER_INIT_OK, spooky_encoder_init(&enc,
+            buf, size, ticks));
+    ASSERT_EQ(SPOOKY_DECODER_INIT_OK, spooky_decoder_init(&dec,
+            out_buf, size + 8, dec_cb, (void *)&called));
+    ASSERT_EQ(SPOOKY_FILTER_INIT_OK, spooky_filter_init(&filt, 3, 2));
+    ASSERT_EQ(SPOOKY_ENCODER_ENQUEUE_OK, spooky_encoder_enqueue(&enc,
+            in_buf, size));
+
+    size_t count = collect_samples(samples, MAX_SAMPLES);
+    ASSERT(count > 0);
+
+    /* Add spikes. */
+    int spikes = 0;
+    for (size_t i=2; i<count - 2; i++) {
+        uint32_t r = totes_cryptographically_secure_random_number_generator();
+        bool b = samples[i];
+        if (samples[i - 2] == b && samples[i - 1] == b
+            && samples[i + 1] == b && samples[i + 2] == b
+            && (r >> 16) % SPIKE_ODDS == 0) {
+            samples[i] = !b;
+            spikes++;
+            i += 2;
+        }
+    }
+    ASSERT(spikes > 0);
+
+    for (size_t i=0; i<count; i++) {
+        enum spooky_decoder_step_res dsres = spooky_decoder_step(&dec,
+            spooky_filter_step(&filt, samples[i]));
+        if (called) { break; }
+        if (dsres < 0) { FAILm("decoder error"); }
+    }
+
+    ASSERT_EQ(1, called);
+    for (int i=0; i<size;i++) {
+        ASSERT_EQ(in_buf[i], out_buf[i]);
+    }
+    PASS();
+}
+
+/* Stretch every high pulse by STRETCH samples (and so shorten every
+ * low one), like a receiver with AGC does, optionally with the
+ * encoder trimming high pulses by TRIM ticks to make up for it. */
+TEST data_should_tx_and_rx_intact_with_stretched_highs(uint32_t seed,
+        uint8_t ticks, uint8_t stretch, int8_t trim) {
+    uint8_t in_buf[8];
+    uint8_t out_buf[16];
+    static bool samples[MAX_SAMPLES];
+    set_TCSRNG_value(seed);
+    fill_buffer_with_noise(in_buf, sizeof(in_buf));
+    called = 0;
+
+    ASSERT_EQ(SPOOKY_ENCODER_INIT_OK, spooky_encoder_init(&enc,
+            buf, sizeof(in_buf), ticks));
+    ASSERT_EQ(SPOOKY_ENCODER_INIT_OK, spooky_encoder_set_trim(&enc, trim));
+    ASSERT_EQ(SPOOKY_DECODER_INIT_OK, spooky_decoder_init(&dec,
+            out_buf, sizeof(out_buf), dec_cb, (void *)&called));
+    ASSERT_EQ(SPOOKY_ENCODER_ENQUEUE_OK, spooky_encoder_enqueue(&enc,
+            in_buf, sizeof(in_buf)));
+
+    size_t count = collect_samples(samples, MAX_SAMPLES);
+    ASSERT(count > 0);
+
+    size_t since_high = stretch + 1;
+    for (size_t i=0; i<count; i++) {
+        since_high = (samples[i] ? 0 : since_high + 1);
+        bool bit = (since_high <= stretch);
+        if (spooky_decoder_step(&dec, bit) < 0) { FAILm("decoder error"); }
+        if (called) { break; }
     }
+
+    ASSERT_EQ(1, called);
+    ASSERT_EQ(0, memcmp(in_buf, output_buf, sizeof(in_buf)));
+    PASS();
+}
+
+#ifndef SPOOKY_PROFILE_TINY
+/* Send frames as multi-level samples, with some noise, for soft
+ * decoding. After the header, add large spikes that push single
+ * samples across the threshold (but not next to real edges, where
+ * they'd just shift them), which the hard decision decoder can't
+ * reliably tell from real edges. */
+#define SOFT_NOISE 16
+#define SOFT_SPIKE_ODDS 24
+
+static uint8_t noisy_level(bool bit, uint8_t low, uint8_t high) {
+    uint32_t r = totes_cryptographically_secure_random_number_generator();
+    int level = (bit ? high : low);
+    level += (int)((r >> 8) % (2*SOFT_NOISE + 1)) - SOFT_NOISE;
+    if (level < 0) { level = 0; }
+    if (level > 255) { level = 255; }
+    return (uint8_t)level;
+}
+
+TEST data_should_tx_and_rx_intact_soft(uint8_t size, uint32_t seed,
+        uint8_t ticks, uint8_t low, uint8_t high, bool spikes) {
+    uint8_t in_buf[size];
+    uint8_t out_buf[size + 8];
+    static bool samples[MAX_SAMPLES];
+    set_TCSRNG_value(seed);
+    memset(out_buf, 0, size);
+    fill_buffer_with_noise(in_buf, size);
+    called = 0;
+
+    ASSERT_EQ(SPOOKY_ENCODER_INIT_OK, spooky_encoder_init(&enc,
+            buf, size, ticks));
+    ASSERT_EQ(SPOOKY_DECODER_INIT_OK, spooky_decoder_init(&dec,
+            out_buf, size + 8, dec_cb, (void *)&called));
+    ASSERT_EQ(SPOOKY_ENCODER_ENQUEUE_OK, spooky_encoder_enqueue(&enc,
+            in_buf, size));
+    size_t count = collect_samples(samples, MAX_SAMPLES);
+    ASSERT(count > 0);
+
+    /* idle line before the message */
+    for (int i=0; i<64; i++) {
+        ASSERT(spooky_decoder_step_soft(&dec, noisy_level(false, low, high)) >= 0);
+    }
+
+    /* 16 bits of header, 2 samples per bit per tick */
+    size_t payload_start = 16 * 2 * ticks * RATE_MUL;
+    for (size_t i=0; i<count; i++) {
+        bool bit = samples[i];
+        uint32_t r = totes_cryptographically_secure_random_number_generator();
+        if (spikes && i > payload_start && i < count - 2
+            && samples[i - 2] == bit && samples[i - 1] == bit
+            && samples[i + 1] == bit && samples[i + 2] == bit
+            && (r >> 16) % SOFT_SPIKE_ODDS == 0) {
+            bit = !bit;
+        }
+        enum spooky_decoder_step_res dsres = spooky_decoder_step_soft(&dec,
+            noisy_level(bit, low, high));
+        if (called) { break; }
+        if (dsres < 0) { FAILm("decoder error"); }
+    }
+
+    ASSERT_EQ(1, called);
+    for (int i=0; i<size;i++) {
+        ASSERT_EQ(in_buf[i], out_buf[i]);
+    }
+    if (!spikes) { ASSERT_EQ(0, dec.misfits); }
+    PASS();
+}
+
+/* Start soft decoding a frame of SIZE random bytes, at TICKS per
+ * half-bit, into out_buf; the samples are left in SAMPLES. Returns
+ * how many there are, or 0 on error. */
+static size_t soft_frame_samples(bool *samples, uint8_t size, uint8_t ticks,
+        uint8_t *in_buf, uint8_t *out_buf) {
+    set_TCSRNG_value(size);
+    fill_buffer_with_noise(in_buf, size);
+    called = 0;
+    if (spooky_encoder_init(&enc, buf, size, ticks) != SPOOKY_ENCODER_INIT_OK
+        || spooky_decoder_init(&dec, out_buf, size + 8, dec_cb,
+            (void *)&called) != SPOOKY_DECODER_INIT_OK
+        || spooky_encoder_enqueue(&enc, in_buf, size)
+        != SPOOKY_ENCODER_ENQUEUE_OK) {
+        return 0;
+    }
+    for (int i=0; i<64; i++) {      /* idle line */
+        (void)spooky_decoder_step_soft(&dec, noisy_level(false, 60, 180));
+    }
+    return collect_samples(samples, MAX_SAMPLES);
+}
+
+/* Spikes a quarter of the way into payload bits, away from where any
+ * edge belongs, should still decode, but count as misfits (so an ARQ
+ * ACK reports them). */
+TEST soft_decoder_should_count_misfits() {
+    uint8_t in_buf[8], out_buf[16];
+    static bool samples[MAX_SAMPLES];
+    uint8_t half = 3 * RATE_MUL;
+    size_t count = soft_frame_samples(samples, 8, 3, in_buf, out_buf);
+    ASSERT(count > 0);
+    /* The encoder reports each new level on the last of its steps. */
+    size_t payload_start = 16 * 2 * half + (3 - 1) * RATE_MUL;
+    for (int bit=0; bit<4; bit++) {
+        size_t i = payload_start + 2 * half * (8 * bit + 1) + half / 2;
+        samples[i] = !samples[i];
+    }
+    for (size_t i=0; i<count && !called; i++) {
+        ASSERT(spooky_decoder_step_soft(&dec,
+                noisy_level(samples[i], 60, 180)) >= 0);
+    }
+    ASSERT_EQ(1, called);
+    ASSERT_EQ(0, memcmp(in_buf, out_buf, 8));
+    ASSERT(dec.misfits >= 4);
+    PASS();
+}
+
+/* If the signal drops out partway through a frame, the decoder
+ * should give up on it, rather than reading the silence as payload
+ * and the next frame's header with it. */
+TEST soft_decoder_should_reset_when_signal_is_lost() {
+    uint8_t in_buf[8], out_buf[16];
+    static bool samples[MAX_SAMPLES];
+    size_t count = soft_frame_samples(samples, 8, 3, in_buf, out_buf);
+    ASSERT(count > 0);
+    for (size_t i=0; i<count / 2; i++) {
+        ASSERT(spooky_decoder_step_soft(&dec,
+                noisy_level(samples[i], 60, 180)) >= 0);
+    }
+    for (int i=0; i<200; i++) {
+        ASSERT(spooky_decoder_step_soft(&dec,
+                noisy_level(false, 60, 180)) >= 0);
+    }
+    for (size_t i=0; i<count && !called; i++) {
+        ASSERT(spooky_decoder_step_soft(&dec,
+                noisy_level(samples[i], 60, 180)) >= 0);
+    }
+    ASSERT_EQ(1, called);
+    ASSERT_EQ(0, memcmp(in_buf, out_buf, 8));
+    PASS();
+}
+#endif
+
+TEST line_code_should_detect_bad_args() {
+    ASSERT_EQ(SPOOKY_ENCODER_INIT_ERROR_NULL,
+        spooky_encoder_set_line_code(NULL, SPOOKY_LINE_4B5B));
+    ASSERT_EQ(SPOOKY_DECODER_INIT_ERROR_NULL,
+        spooky_decoder_set_line_code(NULL, SPOOKY_LINE_4B5B));
+    ASSERT_EQ(SPOOKY_ENCODER_INIT_OK, spooky_encoder_init(&enc, buf, 8, 2));
+    ASSERT_EQ(SPOOKY_ENCODER_INIT_ERROR_BAD_ARGUMENT,
+        spooky_encoder_set_line_code(&enc, (enum spooky_line_code)3));
+    ASSERT_EQ(SPOOKY_DECODER_INIT_OK, spooky_decoder_init(&dec,
+            output_buf, OUTPUT_BUF_SZ, dec_cb, (void *)&called));
+    ASSERT_EQ(SPOOKY_DECODER_INIT_ERROR_BAD_ARGUMENT,
+        spooky_decoder_set_line_code(&dec, (enum spooky_line_code)3));
+    PASS();
+}
+
+/* The same frame with a 4B5B payload should take 10 cells per byte
+ * (plus the closing edge) rather than 16 half bits, and decode. */
+TEST data_should_tx_and_rx_intact_4b5b(uint8_t size, uint32_t seed,
+        uint8_t ticks) {
+    uint8_t in_buf[size];
+    static bool samples[MAX_SAMPLES];
+    set_TCSRNG_value(seed);
+    fill_buffer_with_noise(in_buf, size);
+    called = 0;
+
+    ASSERT_EQ(SPOOKY_ENCODER_INIT_OK, spooky_encoder_init(&enc,
+            buf, size, ticks));
+    ASSERT_EQ(SPOOKY_ENCODER_ENQUEUE_OK, spooky_encoder_enqueue(&enc,
+            in_buf, size));
+    size_t manchester = collect_samples(samples, MAX_SAMPLES);
+    ASSERT(manchester > 0);
+
+    ASSERT_EQ(SPOOKY_ENCODER_INIT_OK, spooky_encoder_init(&enc,
+            buf, size, ticks));
+    ASSERT_EQ(SPOOKY_ENCODER_INIT_OK,
+        spooky_encoder_set_line_code(&enc, SPOOKY_LINE_4B5B));
+    ASSERT_EQ(SPOOKY_ENCODER_ENQUEUE_OK, spooky_encoder_enqueue(&enc,
+            in_buf, size));
+    size_t count = collect_samples(samples, MAX_SAMPLES);
+    ASSERT_EQ(manchester - (6 * size - 1) * ticks * RATE_MUL, count);
+
+    ASSERT_EQ(SPOOKY_DECODER_INIT_OK, spooky_decoder_init(&dec,
+            output_buf, OUTPUT_BUF_SZ, dec_cb, (void *)&called));
+    ASSERT_EQ(SPOOKY_DECODER_INIT_OK,
+        spooky_decoder_set_line_code(&dec, SPOOKY_LINE_4B5B));
+    for (size_t i=0; i<count && !called; i++) {
+        ASSERT(spooky_decoder_step(&dec, samples[i]) >= 0);
+    }
+    ASSERT_EQ(1, called);
+    ASSERT_EQ(size, output_sz);
+    ASSERT_EQ(0, memcmp(in_buf, output_buf, size));
+    PASS();
+}
+
+TEST decoder_4b5b_should_reject_manchester_payload() {
+    static bool samples[MAX_SAMPLES];
+    uint8_t msg[] = { 0xED, 0x05, 0x7a, 0x00, 0xff };
+    called = 0;
+    ASSERT_EQ(SPOOKY_ENCODER_INIT_OK, spooky_encoder_init(&enc, buf, 8, 2));
+    ASSERT_EQ(SPOOKY_ENCODER_ENQUEUE_OK,
+        spooky_encoder_enqueue(&enc, msg, sizeof(msg)));
+    size_t count = collect_samples(samples, MAX_SAMPLES);
+    ASSERT(count > 0);
+
+    ASSERT_EQ(SPOOKY_DECODER_INIT_OK, spooky_decoder_init(&dec,
+            output_buf, OUTPUT_BUF_SZ, dec_cb, (void *)&called));
+    ASSERT_EQ(SPOOKY_DECODER_INIT_OK,
+        spooky_decoder_set_line_code(&dec, SPOOKY_LINE_4B5B));
+    for (size_t i=0; i<count; i++) {
+        ASSERT(spooky_decoder_step(&dec, samples[i]) >= 0);
+    }
+    for (int i=0; i<100; i++) {
+        ASSERT(spooky_decoder_step(&dec, samples[count - 1]) >= 0);
+    }
+    ASSERT_EQ(0, called);
+#ifdef SPOOKY_DECODER_STATS
+    ASSERT_EQ(1, dec.stats.resets_bad_symbol);
+#endif
+    PASS();
+}
+
+/* Dropping a 4B5B frame for its address partway through a symbol
+ * shouldn't leave cells behind to corrupt the next frame's first one. */
+TEST decoder_4b5b_should_drop_frames_for_other_addresses() {
+    static bool samples[MAX_SAMPLES];
+    uint8_t mine[] = { 0x42, 0x05 };
+    for (int addr = 0; addr < 256; addr++) {
+        if (addr == mine[0]) { continue; }
+        uint8_t other[] = { (uint8_t)addr, 0x05 };
+        size_t count = 0;
+        for (int f = 0; f < 2; f++) {
+            ASSERT_EQ(SPOOKY_ENCODER_INIT_OK,
+                spooky_encoder_init(&enc, buf, 8, 2));
+            ASSERT_EQ(SPOOKY_ENCODER_INIT_OK,
+                spooky_encoder_set_line_code(&enc, SPOOKY_LINE_4B5B));
+            ASSERT_EQ(SPOOKY_ENCODER_ENQUEUE_OK, spooky_encoder_enqueue(&enc,
+                    f == 0 ? other : mine, 2));
+            size_t n = collect_samples(&samples[count], MAX_SAMPLES - count);
+            ASSERT(n > 0);
+            count += n;
+        }
+
+        called = 0;
+        ASSERT_EQ(SPOOKY_DECODER_INIT_OK, spooky_decoder_init(&dec,
+                output_buf, OUTPUT_BUF_SZ, dec_cb, (void *)&called));
+        ASSERT_EQ(SPOOKY_DECODER_INIT_OK,
+            spooky_decoder_set_line_code(&dec, SPOOKY_LINE_4B5B));
+        ASSERT_EQ(SPOOKY_DECODER_INIT_OK,
+            spooky_decoder_set_address(&dec, mine[0], 0xFF));
+        for (size_t i=0; i<count && !called; i++) {
+            ASSERT(spooky_decoder_step(&dec, samples[i]) >= 0);
+        }
+        ASSERT_EQm("frame after a foreign one was lost", 1, called);
+        ASSERT_EQ(2, output_sz);
+        ASSERT_EQ(0, memcmp(mine, output_buf, 2));
+    }
+    PASS();
+}
+
+#ifndef SPOOKY_PROFILE_TINY
+TEST data_should_tx_and_rx_intact_soft_4b5b(uint32_t seed, uint8_t ticks) {
+    uint8_t in_buf[8];
+    static bool samples[MAX_SAMPLES];
+    set_TCSRNG_value(seed);
+    fill_buffer_with_noise(in_buf, sizeof(in_buf));
+    called = 0;
+
+    ASSERT_EQ(SPOOKY_ENCODER_INIT_OK, spooky_encoder_init(&enc,
+            buf, sizeof(in_buf), ticks));
+    ASSERT_EQ(SPOOKY_ENCODER_INIT_OK,
+        spooky_encoder_set_line_code(&enc, SPOOKY_LINE_4B5B));
+    ASSERT_EQ(SPOOKY_DECODER_INIT_OK, spooky_decoder_init(&dec,
+            output_buf, OUTPUT_BUF_SZ, dec_cb, (void *)&called));
+    ASSERT_EQ(SPOOKY_DECODER_INIT_OK,
+        spooky_decoder_set_line_code(&dec, SPOOKY_LINE_4B5B));
+    ASSERT_EQ(SPOOKY_ENCODER_ENQUEUE_OK, spooky_encoder_enqueue(&enc,
+            in_buf, sizeof(in_buf)));
+    size_t count = collect_samples(samples, MAX_SAMPLES);
+    ASSERT(count > 0);
+
+    for (int i=0; i<64; i++) {
+        ASSERT(spooky_decoder_step_soft(&dec, noisy_level(false, 60, 180)) >= 0);
+    }
+    for (size_t i=0; i<count && !called; i++) {
+        ASSERT(spooky_decoder_step_soft(&dec,
+                noisy_level(samples[i], 60, 180)) >= 0);
+    }
+    ASSERT_EQ(1, called);
+    ASSERT_EQ(0, memcmp(in_buf, output_buf, sizeof(in_buf)));
+    PASS();
+}
+#endif
+
+/* Decode COUNT samples with line code CODE, into output_buf.
+ * Returns whether a frame arrived. */
+static int decode_samples(const bool *samples, size_t count,
+        enum spooky_line_code code) {
+    called = 0;
+    output_sz = 0;
+    if (spooky_decoder_init(&dec, output_buf, OUTPUT_BUF_SZ, dec_cb,
+            (void *)&called) != SPOOKY_DECODER_INIT_OK) { return 0; }
+    if (spooky_decoder_set_line_code(&dec, code) != SPOOKY_DECODER_INIT_OK) {
+        return 0;
+    }
+    for (size_t i=0; i<count && !called; i++) {
+        if (spooky_decoder_step(&dec, samples[i]) < 0) { return 0; }
+    }
+    return called;
+}
+
+/* Differential Manchester should decode the same whether or not the
+ * receiver inverts the line; Manchester can't. */
+TEST data_should_tx_and_rx_intact_diff(uint8_t size, uint32_t seed,
+        uint8_t ticks, bool invert) {
+    uint8_t in_buf[size];
+    static bool samples[MAX_SAMPLES];
+    set_TCSRNG_value(seed);
+    fill_buffer_with_noise(in_buf, size);
+
+    ASSERT_EQ(SPOOKY_ENCODER_INIT_OK, spooky_encoder_init(&enc,
+            buf, size, ticks));
+    ASSERT_EQ(SPOOKY_ENCODER_INIT_OK,
+        spooky_encoder_set_line_code(&enc, SPOOKY_LINE_DIFF_MANCHESTER));
+    ASSERT_EQ(SPOOKY_ENCODER_ENQUEUE_OK, spooky_encoder_enqueue(&enc,
+            in_buf, size));
+    size_t count = collect_samples(samples, MAX_SAMPLES);
+    ASSERT(count > 0);
+    if (invert) {
+        for (size_t i=0; i<count; i++) { samples[i] = !samples[i]; }
+        /* The length comes out inverted, so too long. */
+        ASSERT_EQ(0, decode_samples(samples, count, SPOOKY_LINE_MANCHESTER));
+    }
+
+    ASSERT_EQ(1, decode_samples(samples, count, SPOOKY_LINE_DIFF_MANCHESTER));
+    ASSERT_EQ(size, output_sz);
+    ASSERT_EQ(0, memcmp(in_buf, output_buf, size));
+    PASS();
+}
+
+#ifndef SPOOKY_PROFILE_TINY
+TEST data_should_tx_and_rx_intact_soft_diff(uint32_t seed, uint8_t ticks,
+        bool invert) {
+    uint8_t in_buf[8];
+    static bool samples[MAX_SAMPLES];
+    set_TCSRNG_value(seed);
+    fill_buffer_with_noise(in_buf, sizeof(in_buf));
+    called = 0;
+
+    ASSERT_EQ(SPOOKY_ENCODER_INIT_OK, spooky_encoder_init(&enc,
+            buf, sizeof(in_buf), ticks));
+    ASSERT_EQ(SPOOKY_ENCODER_INIT_OK,
+        spooky_encoder_set_line_code(&enc, SPOOKY_LINE_DIFF_MANCHESTER));
+    ASSERT_EQ(SPOOKY_DECODER_INIT_OK, spooky_decoder_init(&dec,
+            output_buf, OUTPUT_BUF_SZ, dec_cb, (void *)&called));
+    ASSERT_EQ(SPOOKY_DECODER_INIT_OK,
+        spooky_decoder_set_line_code(&dec, SPOOKY_LINE_DIFF_MANCHESTER));
+    ASSERT_EQ(SPOOKY_ENCODER_ENQUEUE_OK, spooky_encoder_enqueue(&enc,
+            in_buf, sizeof(in_buf)));
+    size_t count = collect_samples(samples, MAX_SAMPLES);
+    ASSERT(count > 0);
+
+    for (int i=0; i<64; i++) {
+        ASSERT(spooky_decoder_step_soft(&dec, noisy_level(invert, 60, 180)) >= 0);
+    }
+    for (size_t i=0; i<count && !called; i++) {
+        ASSERT(spooky_decoder_step_soft(&dec,
+                noisy_level(samples[i] != invert, 60, 180)) >= 0);
+    }
+    ASSERT_EQ(1, called);
+    ASSERT_EQ(0, memcmp(in_buf, output_buf, sizeof(in_buf)));
+    PASS();
+}
+#endif
+
+static int repeats_got;
+
+static void repeat_cb(uint8_t *buf, uint8_t sz, void *udata) {
+    (void)udata;
+    repeats_got++;
+    memcpy(output_buf, buf, sz);
+    output_sz = sz;
+}
+
+/* A message sent COUNT times, GAP bits apart, should arrive COUNT
+ * times, taking exactly that much longer than sending it once. */
+TEST data_should_arrive_once_per_repeat(uint8_t count, uint16_t gap,
+        enum spooky_line_code code) {
+    static bool samples[MAX_SAMPLES];
+    uint8_t in_buf[] = { 0xED, 0x05, 0xA5 };
+    uint8_t rate = 2;
+    ASSERT_EQ(SPOOKY_ENCODER_INIT_OK, spooky_encoder_init(&enc, buf, BUF_SZ, rate));
+    ASSERT_EQ(SPOOKY_ENCODER_INIT_OK, spooky_encoder_set_line_code(&enc, code));
+    ASSERT_EQ(SPOOKY_ENCODER_ENQUEUE_OK, spooky_encoder_enqueue(&enc,
+            in_buf, sizeof(in_buf)));
+    size_t once = collect_samples(samples, MAX_SAMPLES);
+    ASSERT(once > 0);
+
+    ASSERT_EQ(SPOOKY_ENCODER_INIT_ERROR_BAD_ARGUMENT,
+        spooky_encoder_set_repeat(&enc, 0, gap));
+    ASSERT_EQ(SPOOKY_ENCODER_INIT_OK, spooky_encoder_set_repeat(&enc, count, gap));
+    ASSERT_EQ(SPOOKY_ENCODER_ENQUEUE_OK, spooky_encoder_enqueue(&enc,
+            in_buf, sizeof(in_buf)));
+    ASSERT_EQ(SPOOKY_ENCODER_ENQUEUE_ERROR_FULL, spooky_encoder_enqueue(&enc,
+            in_buf, sizeof(in_buf)));
+    size_t total = collect_samples(samples, MAX_SAMPLES);
+    /* Only the last copy waits out the final half-bit before DONE. */
+    ASSERT_EQ(count * once + (count - 1) * (2 * gap - 1) * rate * RATE_MUL
+        + (count - 1) * RATE_MUL, total);
+
+    /* The decoder's buffer is reused between frames, so copy out. */
+    uint8_t dec_buf[OUTPUT_BUF_SZ];
+    repeats_got = 0;
+    ASSERT_EQ(SPOOKY_DECODER_INIT_OK, spooky_decoder_init(&dec, dec_buf,
+            sizeof(dec_buf), repeat_cb, NULL));
+    ASSERT_EQ(SPOOKY_DECODER_INIT_OK, spooky_decoder_set_line_code(&dec, code));
+    for (size_t i=0; i<total; i++) {
+        ASSERT(spooky_decoder_step(&dec, samples[i]) >= 0);
+    }
+    ASSERT_EQ(count, repeats_got);
+    ASSERT_EQ(sizeof(in_buf), output_sz);
+    ASSERT_EQ(0, memcmp(in_buf, output_buf, sizeof(in_buf)));
+    PASS();
+}
+
+TEST encoder_clear_should_abort_repeats() {
+    static bool samples[MAX_SAMPLES];
+    uint8_t in_buf[] = { 0x01, 0x02 };
+    ASSERT_EQ(SPOOKY_ENCODER_INIT_OK, spooky_encoder_init(&enc, buf, BUF_SZ, 1));
+    ASSERT_EQ(SPOOKY_ENCODER_INIT_OK, spooky_encoder_set_repeat(&enc, 1, 0));
+    ASSERT_EQ(SPOOKY_ENCODER_ENQUEUE_OK, spooky_encoder_enqueue(&enc,
+            in_buf, sizeof(in_buf)));
+    size_t once = collect_samples(samples, MAX_SAMPLES);
+
+    ASSERT_EQ(SPOOKY_ENCODER_INIT_OK, spooky_encoder_set_repeat(&enc, 5, 4));
+    ASSERT_EQ(SPOOKY_ENCODER_ENQUEUE_OK, spooky_encoder_enqueue(&enc,
+            in_buf, sizeof(in_buf)));
+    for (size_t i=0; i<once / RATE_MUL + 10; i++) {
+        ASSERT(spooky_encoder_step(&enc) != SPOOKY_ENCODER_STEP_OK_DONE);
+    }
+    ASSERT_EQ(SPOOKY_ENCODER_CLEAR_OK, spooky_encoder_clear(&enc));
+    ASSERT_EQ(SPOOKY_ENCODER_STEP_OK_DONE, spooky_encoder_step(&enc));
+    PASS();
+}
+
+SUITE(integration) {
+    // regression tests
+    RUN_TESTp(data_should_tx_and_rx_intact, 9, 1, 1);
+
+    // fuzz testing
+    for (int size=8; size<16; size++) {
+        for (int ticks=1; ticks < 4; ticks++) {
+            for (int seed=0; seed<50; seed++) {
+                if (GREATEST_IS_VERBOSE()) {
+                    printf("size %d, ticks %d, seed %d:\n",
+                        size, ticks, seed);
+                }
+                RUN_TESTp(data_should_tx_and_rx_intact, size, seed, ticks);
+            }
+        }
+    }
+
+    RUN_TEST(encoder_preamble_should_lengthen_frame);
+    RUN_TEST(decoder_step_idle_should_report_empty_channel);
+    for (int offset=0; offset<1000; offset += 37) {
+        RUN_TESTp(duty_cycled_rx_should_catch_frame_with_preamble, offset);
+    }
+
+    for (int ticks=2; ticks < 4; ticks++) {
+        for (int seed=0; seed<50; seed++) {
+            RUN_TESTp(data_should_tx_and_rx_intact_through_spikes,
+                8, seed, ticks);
+        }
+    }
+
+    // pulse width distortion, over half of a half bit
+    for (int seed=0; seed<20; seed++) {
+        RUN_TESTp(data_should_tx_and_rx_intact_with_stretched_highs,
+            seed, 4, 5, 0);
+        RUN_TESTp(data_should_tx_and_rx_intact_with_stretched_highs,
+            seed, 4, 5, 2);
+        RUN_TESTp(data_should_tx_and_rx_intact_with_stretched_highs,
+            seed, 6, 7, 0);
+    }
+
+#ifndef SPOOKY_PROFILE_TINY
+    // soft decoding, at various signal levels
+    for (int ticks=1; ticks < 4; ticks++) {
+        for (int seed=0; seed<20; seed++) {
+            RUN_TESTp(data_should_tx_and_rx_intact_soft,
+                8, seed, ticks, 60, 180, false);
+            RUN_TESTp(data_should_tx_and_rx_intact_soft,
+                8, seed, ticks, 20, 90, false);
+            RUN_TESTp(data_should_tx_and_rx_intact_soft,
+                8, seed, ticks, 150, 240, false);
+        }
+    }
+
+    // soft decoding, with spikes in the payload
+    for (int ticks=2; ticks < 4; ticks++) {
+        for (int seed=0; seed<50; seed++) {
+            RUN_TESTp(data_should_tx_and_rx_intact_soft,
+                8, seed, ticks, 60, 180, true);
+        }
+    }
+    RUN_TEST(soft_decoder_should_count_misfits);
+    RUN_TEST(soft_decoder_should_reset_when_signal_is_lost);
+#endif
+
+    // 4B5B payloads
+    RUN_TEST(line_code_should_detect_bad_args);
+    for (int size=1; size<16; size += 3) {
+        for (int ticks=1; ticks < 4; ticks++) {
+            for (int seed=0; seed<20; seed++) {
+                RUN_TESTp(data_should_tx_and_rx_intact_4b5b, size, seed, ticks);
+            }
+        }
+    }
+    RUN_TEST(decoder_4b5b_should_reject_manchester_payload);
+    RUN_TEST(decoder_4b5b_should_drop_frames_for_other_addresses);
+#ifndef SPOOKY_PROFILE_TINY
+    for (int ticks=1; ticks < 4; ticks++) {
+        for (int seed=0; seed<20; seed++) {
+            RUN_TESTp(data_should_tx_and_rx_intact_soft_4b5b, seed, ticks);
+        }
+    }
+#endif
+
+    // differential Manchester, either way up
+    for (int size=1; size<16; size += 3) {
+        for (int ticks=1; ticks < 4; ticks++) {
+            for (int seed=0; seed<20; seed++) {
+                RUN_TESTp(data_should_tx_and_rx_intact_diff,
+                    size, seed, ticks, false);
+                RUN_TESTp(data_should_tx_and_rx_intact_diff,
+                    size, seed, ticks, true);
+            }
+        }
+    }
+#ifndef SPOOKY_PROFILE_TINY
+    for (int ticks=1; ticks < 4; ticks++) {
+        for (int seed=0; seed<20; seed++) {
+            RUN_TESTp(data_should_tx_and_rx_intact_soft_diff, seed, ticks, false);
+            RUN_TESTp(data_should_tx_and_rx_intact_soft_diff, seed, ticks, true);
+        }
+    }
+#endif
+
+    // repeats
+    for (int code=0; code<3; code++) {
+        RUN_TESTp(data_should_arrive_once_per_repeat, 1, 8, code);
+        RUN_TESTp(data_should_arrive_once_per_repeat, 3, 8, code);
+        RUN_TESTp(data_should_arrive_once_per_repeat, 4, 0, code);
+    }
+    RUN_TEST(encoder_clear_should_abort_repeats);
+}
+
+/**************
+ * Correlator *
+ **************/
+
+#define IDLE_SAMPLES 100
+
+static const uint8_t corr_intervals[] = { 2, 4, 6, 8 };
+
+static void count_cb(uint8_t *buf, uint8_t sz, void *udata) {
+    int *c = (int *)udata;
+    (*c)++;
+    memcpy(output_buf, buf, sz);
+    output_sz = sz;
+}
+
+/* Append a frame of SIZE random bytes (into IN_BUF) at TICKS, after
+ * some idle samples, to SAMPLES as 0/1 bytes. Returns the new count,
+ * or 0 on error. */
+static size_t append_frame(uint8_t *samples, size_t count, size_t max,
+        uint8_t *in_buf, uint8_t size, uint8_t ticks) {
+    static bool bits[MAX_SAMPLES];
+    fill_buffer_with_noise(in_buf, size);
+    if (spooky_encoder_init(&enc, buf, size, ticks) != SPOOKY_ENCODER_INIT_OK) {
+        return 0;
+    }
+    if (spooky_encoder_enqueue(&enc, in_buf, size) != SPOOKY_ENCODER_ENQUEUE_OK) {
+        return 0;
+    }
+    size_t frame = collect_samples(bits, MAX_SAMPLES);
+    if (frame == 0 || count + IDLE_SAMPLES + frame > max) { return 0; }
+    for (size_t i=0; i<IDLE_SAMPLES; i++) { samples[count++] = 0; }
+    for (size_t i=0; i<frame; i++) { samples[count++] = bits[i]; }
+    return count;
+}
+
+TEST correlator_scan_should_detect_bad_args() {
+    uint8_t samples[4] = { 0, 1, 0, 1 };
+    uint8_t zero = 0;
+    struct spooky_correlator_lock locks[1];
+    size_t n = 0;
+    ASSERT_EQ(SPOOKY_CORRELATOR_ERROR_NULL, spooky_correlator_scan(NULL, 4,
+            corr_intervals, 1, 75, locks, 1, &n));
+    ASSERT_EQ(SPOOKY_CORRELATOR_ERROR_NULL, spooky_correlator_scan(samples, 4,
+            NULL, 1, 75, locks, 1, &n));
+    ASSERT_EQ(SPOOKY_CORRELATOR_ERROR_NULL, spooky_correlator_scan(samples, 4,
+            corr_intervals, 1, 75, NULL, 1, &n));
+    ASSERT_EQ(SPOOKY_CORRELATOR_ERROR_BAD_ARGUMENT, spooky_correlator_scan(samples, 4,
+            corr_intervals, 0, 75, locks, 1, &n));
+    ASSERT_EQ(SPOOKY_CORRELATOR_ERROR_BAD_ARGUMENT, spooky_correlator_scan(samples, 4,
+            &zero, 1, 75, locks, 1, &n));
+    ASSERT_EQ(SPOOKY_CORRELATOR_ERROR_BAD_ARGUMENT, spooky_correlator_scan(samples, 4,
+            corr_intervals, 1, 101, locks, 1, &n));
+    ASSERT_EQ(SPOOKY_CORRELATOR_OK, spooky_correlator_scan(samples, 4,
+            corr_intervals, 1, 75, locks, 1, &n));
+    ASSERT_EQ(0, n);
+    PASS();
+}
+
+TEST correlator_should_find_header_at_its_interval(uint8_t ticks) {
+    static uint8_t samples[MAX_SAMPLES];
+    uint8_t in_buf[8];
+    struct spooky_correlator_lock locks[4];
+    size_t n = 0;
+    set_TCSRNG_value(ticks);
+
+    size_t count = append_frame(samples, 0, MAX_SAMPLES, in_buf, 8, ticks);
+    ASSERT(count > 0);
+    ASSERT_EQ(SPOOKY_CORRELATOR_OK, spooky_correlator_scan(samples, count,
+            corr_intervals, sizeof(corr_intervals), 75, locks, 4, &n));
+    ASSERT_EQ(1, n);
+    /* The encoder idles for TICKS - 1 steps before the first bit. */
+    ASSERT_EQ(IDLE_SAMPLES + (ticks - 1) * RATE_MUL, locks[0].offset);
+    ASSERT_EQ(ticks * RATE_MUL, locks[0].interval);
+    ASSERT_EQ(100, locks[0].score);
+    PASS();
+}
+
+/* Put a spike in the middle of every 8th half bit of the header, so
+ * the decoder's own header search misses it, but most of the header
+ * still matches. */
+TEST correlator_should_recover_frame_with_damaged_header(uint32_t seed) {
+    static uint8_t samples[MAX_SAMPLES];
+    uint8_t in_buf[8];
+    uint8_t out_buf[16];
+    struct spooky_correlator_lock locks[4];
+    size_t n = 0;
+    uint8_t ticks = 2;
+    uint8_t interval = ticks * RATE_MUL;
+    set_TCSRNG_value(seed);
+
+    size_t count = append_frame(samples, 0, MAX_SAMPLES, in_buf, 8, ticks);
+    ASSERT(count > 0);
+    size_t start = IDLE_SAMPLES + (ticks - 1) * RATE_MUL;
+    for (int h=1; h<SPOOKY_CORRELATOR_HEADER_HALF_BITS; h += 8) {
+        size_t at = start + h * interval + interval / 2;
+        samples[at] = !samples[at];
+    }
+
+    called = 0;
+    ASSERT_EQ(SPOOKY_DECODER_INIT_OK, spooky_decoder_init(&dec,
+            out_buf, sizeof(out_buf), count_cb, (void *)&called));
+    for (size_t i=0; i<count; i++) {
+        (void)spooky_decoder_step(&dec, samples[i]);
+    }
+    ASSERT_EQ(0, called);
+
+    ASSERT_EQ(SPOOKY_CORRELATOR_OK, spooky_correlator_scan(samples, count,
+            corr_intervals, sizeof(corr_intervals), 75, locks, 4, &n));
+    /* Payload can look enough like a header to match, too. */
+    ASSERT(n >= 1);
+    ASSERT_EQ(start, locks[0].offset);
+    ASSERT_EQ(SPOOKY_DECODER_INIT_OK, spooky_decoder_init(&dec,
+            out_buf, sizeof(out_buf), count_cb, (void *)&called));
+    ASSERT_EQ(SPOOKY_CORRELATOR_OK, spooky_correlator_decode(&dec,
+            samples, count, locks, (n < 4 ? n : 4)));
+    ASSERT_EQ(1, called);
+    ASSERT_EQ(8, output_sz);
+    ASSERT_EQ(0, memcmp(in_buf, output_buf, 8));
+    PASS();
+}
+
+TEST correlator_should_decode_frames_at_different_rates() {
+    static uint8_t samples[3 * MAX_SAMPLES];
+    uint8_t in_buf[3][8];
+    uint8_t out_buf[16];
+    uint8_t ticks[3] = { 1, 3, 2 };
+    struct spooky_correlator_lock locks[4];
+    size_t n = 0, count = 0;
+    set_TCSRNG_value(23);
+
+    for (int f=0; f<3; f++) {
+        count = append_frame(samples, count, sizeof(samples),
+            in_buf[f], 8, ticks[f]);
+        ASSERT(count > 0);
+    }
+
+    ASSERT_EQ(SPOOKY_CORRELATOR_OK, spooky_correlator_scan(samples, count,
+            corr_intervals, sizeof(corr_intervals), 75, locks, 4, &n));
+    ASSERT_EQ(3, n);
+    for (int f=0; f<3; f++) {
+        ASSERT_EQ(ticks[f] * RATE_MUL, locks[f].interval);
+    }
+
+    called = 0;
+    ASSERT_EQ(SPOOKY_DECODER_INIT_OK, spooky_decoder_init(&dec,
+            out_buf, sizeof(out_buf), count_cb, (void *)&called));
+    ASSERT_EQ(SPOOKY_CORRELATOR_OK, spooky_correlator_decode(&dec,
+            samples, count, locks, (n < 4 ? n : 4)));
+    ASSERT_EQ(3, called);
+    ASSERT_EQ(0, memcmp(in_buf[2], output_buf, 8));
+    PASS();
+}
+
+SUITE(correlator) {
+    RUN_TEST(correlator_scan_should_detect_bad_args);
+    for (int ticks=1; ticks<5; ticks++) {
+        RUN_TESTp(correlator_should_find_header_at_its_interval, ticks);
+    }
+    for (int seed=0; seed<20; seed++) {
+        RUN_TESTp(correlator_should_recover_frame_with_damaged_header, seed);
+    }
+    RUN_TEST(correlator_should_decode_frames_at_different_rates);
+}
+
+/***************
+ * Channelizer *
+ ***************/
+
+#define CHAN_COUNT 16
+#define CHAN_IDLE 64            /* output samples before the frames */
+#define CHAN_NOISE 0.05f
+
+static int chan_called[CHAN_COUNT];
+static uint8_t chan_out[CHAN_COUNT][16];
+static uint8_t chan_out_sz[CHAN_COUNT];
+
+/* Each channel is only ever called from one thread. */
+static void chan_cb(uint16_t channel, uint8_t *data, uint8_t size, void *udata) {
+    (void)udata;
+    chan_called[channel]++;
+    memcpy(chan_out[channel], data, size);
+    chan_out_sz[channel] = size;
+}
+
+static float chan_noise(void) {
+    uint32_t r = totes_cryptographically_secure_random_number_generator() >> 16;
+    return CHAN_NOISE * ((r % 2001) / 1000.0f - 1);
+}
+
+TEST channelizer_new_should_detect_bad_args() {
+    struct spooky_channelizer *ch = NULL;
+    struct spooky_channelizer_config cfg = {
+        .channels = 12, .taps = 8, .threads = 1, .buffer_size = 16,
+        .squelch = 0.2f, .cb = chan_cb,
+    };
+    ASSERT_EQ(SPOOKY_CHANNELIZER_ERROR_NULL, spooky_channelizer_new(NULL, &ch));
+    ASSERT_EQ(SPOOKY_CHANNELIZER_ERROR_BAD_ARGUMENT, spooky_channelizer_new(&cfg, &ch));
+    cfg.channels = 16;
+    cfg.threads = 0;
+    ASSERT_EQ(SPOOKY_CHANNELIZER_ERROR_BAD_ARGUMENT, spooky_channelizer_new(&cfg, &ch));
+    cfg.threads = 1;
+    cfg.cb = NULL;
+    ASSERT_EQ(SPOOKY_CHANNELIZER_ERROR_NULL, spooky_channelizer_new(&cfg, &ch));
+    cfg.cb = chan_cb;
+    ASSERT_EQ(SPOOKY_CHANNELIZER_OK, spooky_channelizer_new(&cfg, &ch));
+    spooky_channelizer_free(ch);
+    PASS();
+}
+
+/* Send two frames at once, at different rates and amplitudes, on
+ * carriers at the centers of two channels, and push the IQ samples
+ * through in odd-sized pieces. */
+TEST channelizer_should_rx_frames_on_their_channels(uint8_t threads) {
+    const uint16_t chan[2] = { 3, 12 };
+    const uint8_t ticks[2] = { 2, 4 };
+    const float amp[2] = { 1.0f, 0.5f };
+    uint8_t in_buf[2][8];
+    uint8_t enc_buf[2][8];
+    struct spooky_encoder encs[2];
+    bool level[2] = { false, false };
+    bool done[2] = { false, false };
+    static float iq[2 * 997];
+    size_t fill = 0;
+    uint32_t n = 0;             /* input sample index */
+
+    set_TCSRNG_value(threads);
+    memset(chan_called, 0, sizeof(chan_called));
+    struct spooky_channelizer *ch = NULL;
+    struct spooky_channelizer_config cfg = {
+        .channels = CHAN_COUNT, .taps = 8, .threads = threads,
+        .buffer_size = 16, .squelch = 0.2f, .cb = chan_cb,
+    };
+    ASSERT_EQ(SPOOKY_CHANNELIZER_OK, spooky_channelizer_new(&cfg, &ch));
+
+    for (int f=0; f<2; f++) {
+        fill_buffer_with_noise(in_buf[f], 8);
+        ASSERT_EQ(SPOOKY_ENCODER_INIT_OK, spooky_encoder_init(&encs[f],
+                enc_buf[f], 8, ticks[f]));
+        ASSERT_EQ(SPOOKY_ENCODER_ENQUEUE_OK, spooky_encoder_enqueue(&encs[f],
+                in_buf[f], 8));
+    }
+
+    /* One output sample (decoder tick) per CHAN_COUNT input samples,
+     * and RATE_MUL of those per encoder step. */
+    for (int out=0; !(done[0] && done[1]) || out < CHAN_IDLE; out++) {
+        if (out >= CHAN_IDLE && out % RATE_MUL == 0) {
+            for (int f=0; f<2; f++) {
+                if (done[f]) { continue; }
+                enum spooky_encoder_step_res esres = spooky_encoder_step(&encs[f]);
+                ASSERT(esres >= 0);
+                if (esres == SPOOKY_ENCODER_STEP_OK_DONE) {
+                    done[f] = true;
+                    level[f] = false;
+                } else if (esres == SPOOKY_ENCODER_STEP_OK_LOW) {
+                    level[f] = false;
+                } else if (esres == SPOOKY_ENCODER_STEP_OK_HIGH) {
+                    level[f] = true;
+                }
+            }
+        }
+        for (int i=0; i<CHAN_COUNT; i++, n++) {
+            float re = chan_noise(), im = chan_noise();
+            for (int f=0; f<2; f++) {
+                if (!level[f]) { continue; }
+                double phase = 2 * 3.14159265358979 * chan[f] * (n % CHAN_COUNT) / CHAN_COUNT;
+                re += amp[f] * (float)cos(phase);
+                im += amp[f] * (float)sin(phase);
+            }
+            iq[2*fill] = re;
+            iq[2*fill + 1] = im;
+            if (++fill == sizeof(iq) / (2 * sizeof(float))) {
+                ASSERT_EQ(SPOOKY_CHANNELIZER_OK, spooky_channelizer_push(ch, iq, fill));
+                fill = 0;
+            }
+        }
+    }
+    /* Flush the filter bank with some idle line. */
+    for (int i=0; i<16 * CHAN_COUNT; i++) {
+        iq[2*fill] = chan_noise();
+        iq[2*fill + 1] = chan_noise();
+        fill++;
+    }
+    ASSERT_EQ(SPOOKY_CHANNELIZER_OK, spooky_channelizer_push(ch, iq, fill));
+    spooky_channelizer_free(ch);
+
+    for (int k=0; k<CHAN_COUNT; k++) {
+        if (k == chan[0] || k == chan[1]) {
+            ASSERT_EQ(1, chan_called[k]);
+        } else {
+            ASSERT_EQ(0, chan_called[k]);
+        }
+    }
+    for (int f=0; f<2; f++) {
+        ASSERT_EQ(8, chan_out_sz[chan[f]]);
+        ASSERT_EQ(0, memcmp(in_buf[f], chan_out[chan[f]], 8));
+    }
+    PASS();
+}
+
+SUITE(channelizer) {
+    RUN_TEST(channelizer_new_should_detect_bad_args);
+    RUN_TESTp(channelizer_should_rx_frames_on_their_channels, 1);
+    RUN_TESTp(channelizer_should_rx_frames_on_their_channels, 4);
+}
+
+/************
+ * Pipeline *
+ ************/
+
+#define PIPE_FRAMES 8
+
+static uint8_t pipe_out[PIPE_FRAMES][8];
+static int pipe_count;
+
+static void pipe_cb(uint8_t *data, uint8_t data_size, void *udata) {
+    (void)udata;
+    if (pipe_count < PIPE_FRAMES && data_size == 8) {
+        memcpy(pipe_out[pipe_count], data, data_size);
+    }
+    pipe_count++;
+}
+
+TEST pipeline_run_should_detect_bad_args() {
+    FILE *f = tmpfile();
+    ASSERT(f != NULL);
+    struct spooky_pipeline_config cfg = {
+        .input = f, .buffer_size = 16, .ring_size = 12, .cb = pipe_cb,
+    };
+    ASSERT_EQ(SPOOKY_PIPELINE_ERROR_NULL, spooky_pipeline_run(NULL, NULL));
+    ASSERT_EQ(SPOOKY_PIPELINE_ERROR_BAD_ARGUMENT, spooky_pipeline_run(&cfg, NULL));
+    cfg.ring_size = 16;
+    cfg.cb = NULL;
+    ASSERT_EQ(SPOOKY_PIPELINE_ERROR_NULL, spooky_pipeline_run(&cfg, NULL));
+    cfg.cb = pipe_cb;
+    cfg.buffer_size = 1;
+    ASSERT_EQ(SPOOKY_PIPELINE_ERROR_BAD_ARGUMENT, spooky_pipeline_run(&cfg, NULL));
+    fclose(f);
+    PASS();
+}
+
+/* Write frames at several rates to a file as multi-level samples,
+ * and read them back through the pipeline. Small rings make every
+ * stage wrap around and wait on the next one many times. */
+TEST pipeline_should_rx_frames_from_file(size_t ring_size) {
+    static uint8_t samples[PIPE_FRAMES * MAX_SAMPLES];
+    uint8_t in_buf[PIPE_FRAMES][8];
+    size_t count = 0;
+    set_TCSRNG_value(ring_size);
+    for (int i=0; i<PIPE_FRAMES; i++) {
+        count = append_frame(samples, count, sizeof(samples),
+            in_buf[i], 8, 1 + i % 3);
+        ASSERT(count > 0);
+    }
+    for (size_t i=0; i<count; i++) {
+        uint8_t jitter = totes_cryptographically_secure_random_number_generator() % 32;
+        samples[i] = (samples[i] ? 200 - jitter : 40 + jitter);
+    }
+
+    FILE *f = tmpfile();
+    ASSERT(f != NULL);
+    ASSERT_EQ(count, fwrite(samples, 1, count, f));
+    rewind(f);
+
+    pipe_count = 0;
+    struct spooky_pipeline_stats stats;
+    struct spooky_pipeline_config cfg = {
+        .input = f, .threshold = 128, .buffer_size = 16,
+        .ring_size = ring_size, .cb = pipe_cb,
+    };
+    ASSERT_EQ(SPOOKY_PIPELINE_OK, spooky_pipeline_run(&cfg, &stats));
+    fclose(f);
+
+    ASSERT_EQ(count, stats.samples);
+    ASSERT_EQ(PIPE_FRAMES, stats.frames);
+    ASSERT_EQ(PIPE_FRAMES, pipe_count);
+    for (int i=0; i<PIPE_FRAMES; i++) {
+        ASSERT_EQ(0, memcmp(in_buf[i], pipe_out[i], 8));
+    }
+    PASS();
+}
+
+/* Stands in for a radio that goes quiet after a frame: writes the
+ * samples, then holds the pipe open until the frame comes out (or a
+ * couple of seconds pass). */
+struct live_input {
+    int fd;
+    const uint8_t *samples;
+    size_t count;
+    int frames_before_eof;
+};
+
+static void *live_input_thread(void *arg) {
+    struct live_input *li = (struct live_input *)arg;
+    for (size_t off = 0; off < li->count; ) {
+        ssize_t n = write(li->fd, &li->samples[off], li->count - off);
+        if (n <= 0) { break; }
+        off += n;
+    }
+    struct timespec ms = { .tv_sec = 0, .tv_nsec = 1000000 };
+    for (int i=0; i<2000; i++) {
+        if (__atomic_load_n(&pipe_count, __ATOMIC_SEQ_CST) > 0) { break; }
+        nanosleep(&ms, NULL);
+    }
+    li->frames_before_eof = __atomic_load_n(&pipe_count, __ATOMIC_SEQ_CST);
+    close(li->fd);
+    return NULL;
+}
+
+/* A frame followed by idle samples should be received without waiting
+ * for EOF, since the decoder has all it needs. This one's last edge
+ * goes low, into the idle level, so no later edge ends that run. */
+TEST pipeline_should_rx_frames_before_eof() {
+    static bool bits[MAX_SAMPLES];
+    static uint8_t samples[MAX_SAMPLES + 2000];
+    uint8_t in_buf[8] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+    ASSERT_EQ(SPOOKY_ENCODER_INIT_OK, spooky_encoder_init(&enc, buf, 8, 2));
+    ASSERT_EQ(SPOOKY_ENCODER_ENQUEUE_OK, spooky_encoder_enqueue(&enc, in_buf, 8));
+    size_t count = collect_samples(bits, MAX_SAMPLES);
+    ASSERT(count > 0);
+    ASSERT_EQ(false, bits[count - 1]);
+    for (size_t i=0; i<count; i++) { samples[i] = bits[i]; }
+    for (int i=0; i<2000; i++) { samples[count++] = 0; }
+
+    int fds[2];
+    ASSERT_EQ(0, pipe(fds));
+    FILE *f = fdopen(fds[0], "rb");
+    ASSERT(f != NULL);
+    pipe_count = 0;
+    struct live_input li = { .fd = fds[1], .samples = samples, .count = count };
+    pthread_t tid;
+    ASSERT_EQ(0, pthread_create(&tid, NULL, live_input_thread, &li));
+    struct spooky_pipeline_config cfg = {
+        .input = f, .threshold = 0, .buffer_size = 16, .cb = pipe_cb,
+    };
+    enum spooky_pipeline_res res = spooky_pipeline_run(&cfg, NULL);
+    pthread_join(tid, NULL);
+    fclose(f);
+
+    ASSERT_EQ(SPOOKY_PIPELINE_OK, res);
+    ASSERT_EQm("frame held until EOF", 1, li.frames_before_eof);
+    ASSERT_EQ(0, memcmp(in_buf, pipe_out[0], 8));
+    PASS();
+}
+
+SUITE(pipeline) {
+    RUN_TEST(pipeline_run_should_detect_bad_args);
+    RUN_TESTp(pipeline_should_rx_frames_from_file, (size_t)16);
+    RUN_TESTp(pipeline_should_rx_frames_from_file, (size_t)0);
+    RUN_TEST(pipeline_should_rx_frames_before_eof);
+}
+
+/*******************
+ * Channel model   *
+ *******************/
+
+static struct spooky_sim sim;
+
+static const struct spooky_sim_config clean_channel = {
+    .oversample = RATE_MUL,
+};
+
+TEST sim_init_should_detect_bad_args() {
+    struct spooky_sim_config cfg = clean_channel;
+    ASSERT_EQ(SPOOKY_SIM_ERROR_NULL, spooky_sim_init(NULL, &cfg));
+    ASSERT_EQ(SPOOKY_SIM_ERROR_NULL, spooky_sim_init(&sim, NULL));
+    cfg.oversample = 0.5f;
+    ASSERT_EQ(SPOOKY_SIM_ERROR_BAD_ARGUMENT, spooky_sim_init(&sim, &cfg));
+    cfg.oversample = 2;
+    cfg.spike_rate = 1;
+    ASSERT_EQ(SPOOKY_SIM_ERROR_BAD_ARGUMENT, spooky_sim_init(&sim, &cfg));
+    cfg.spike_rate = 0;
+    cfg.jitter = -1;
+    ASSERT_EQ(SPOOKY_SIM_ERROR_BAD_ARGUMENT, spooky_sim_init(&sim, &cfg));
+    cfg.jitter = 0;
+    cfg.asymmetry = 2;
+    ASSERT_EQ(SPOOKY_SIM_ERROR_BAD_ARGUMENT, spooky_sim_init(&sim, &cfg));
+    cfg.asymmetry = 1;
+    ASSERT_EQ(SPOOKY_SIM_OK, spooky_sim_init(&sim, &cfg));
+    PASS();
+}
+
+/* With no impairments, it's the same as holding each level for
+ * RATE_MUL samples. */
+TEST sim_clean_channel_should_match_encoder(uint8_t ticks) {
+    uint8_t in_buf[8];
+    static bool expect[MAX_SAMPLES];
+    static uint8_t samples[MAX_SAMPLES];
+    set_TCSRNG_value(ticks);
+    fill_buffer_with_noise(in_buf, sizeof(in_buf));
+    ASSERT_EQ(SPOOKY_ENCODER_INIT_OK, spooky_encoder_init(&enc, buf, 8, ticks));
+    ASSERT_EQ(SPOOKY_ENCODER_ENQUEUE_OK, spooky_encoder_enqueue(&enc, in_buf, 8));
+    size_t count = collect_samples(expect, MAX_SAMPLES);
+    ASSERT(count > 0);
+
+    ASSERT_EQ(SPOOKY_SIM_OK, spooky_sim_init(&sim, &clean_channel));
+    ASSERT_EQ(SPOOKY_ENCODER_INIT_OK, spooky_encoder_init(&enc, buf, 8, ticks));
+    ASSERT_EQ(SPOOKY_ENCODER_ENQUEUE_OK, spooky_encoder_enqueue(&enc, in_buf, 8));
+    size_t n = 0;
+    ASSERT_EQ(SPOOKY_SIM_ERROR_SIZE, spooky_sim_encode(&sim, &enc, samples, 10, &n));
+
+    ASSERT_EQ(SPOOKY_SIM_OK, spooky_sim_init(&sim, &clean_channel));
+    ASSERT_EQ(SPOOKY_ENCODER_INIT_OK, spooky_encoder_init(&enc, buf, 8, ticks));
+    ASSERT_EQ(SPOOKY_ENCODER_ENQUEUE_OK, spooky_encoder_enqueue(&enc, in_buf, 8));
+    ASSERT_EQ(SPOOKY_SIM_OK, spooky_sim_encode(&sim, &enc, samples, MAX_SAMPLES, &n));
+    ASSERT_EQ(count, n);
+    for (size_t i=0; i<n; i++) { ASSERT_EQ(expect[i], samples[i]); }
+    PASS();
+}
+
+/* Clock skew changes the number of samples, and the rest of the
+ * impairments happen at about the configured rates. */
+TEST sim_should_apply_skew_spikes_and_dropouts() {
+    static uint8_t levels[10000];
+    static uint8_t samples[30000];
+    size_t n = 0;
+    struct spooky_sim_config cfg = {
+        .oversample = 2, .clock_skew = 0.05f, .seed = 1,
+    };
+    ASSERT_EQ(SPOOKY_SIM_OK, spooky_sim_init(&sim, &cfg));
+    ASSERT_EQ(SPOOKY_SIM_OK, spooky_sim_run(&sim, levels, 10000,
+            samples, sizeof(samples), &n));
+    ASSERT(n >= 21000 && n <= 21001);   /* 0.05f is not exact */
+
+    /* In pieces, the fractional sample positions carry over. */
+    size_t total = 0;
+    ASSERT_EQ(SPOOKY_SIM_OK, spooky_sim_init(&sim, &cfg));
+    for (int i=0; i<100; i++) {
+        ASSERT_EQ(SPOOKY_SIM_OK, spooky_sim_run(&sim, levels, 100,
+                samples, sizeof(samples), &n));
+        total += n;
+    }
+    ASSERT(total >= 21000 && total <= 21001);
+
+    cfg.clock_skew = 0;
+    cfg.spike_rate = 0.01f;
+    ASSERT_EQ(SPOOKY_SIM_OK, spooky_sim_init(&sim, &cfg));
+    ASSERT_EQ(SPOOKY_SIM_OK, spooky_sim_run(&sim, levels, 10000,
+            samples, sizeof(samples), &n));
+    int ones = 0;
+    for (size_t i=0; i<n; i++) { ones += samples[i]; }
+    ASSERT(ones > 150 && ones < 250);   /* 200 expected */
+
+    /* Dropouts of 50 samples, 1 per 1000 samples: about 5% low. */
+    memset(levels, 1, sizeof(levels));
+    cfg.spike_rate = 0;
+    cfg.dropout_rate = 0.001f;
+    cfg.dropout_length = 50;
+    ASSERT_EQ(SPOOKY_SIM_OK, spooky_sim_init(&sim, &cfg));
+    ASSERT_EQ(SPOOKY_SIM_OK, spooky_sim_run(&sim, levels, 10000,
+            samples, sizeof(samples), &n));
+    int lows = 0;
+    for (size_t i=0; i<n; i++) { lows += !samples[i]; }
+    ASSERT(lows > 500 && lows < 1500);
+    memset(levels, 0, sizeof(levels));
+    PASS();
+}
+
+/* Frames through a moderately rough channel should still decode. */
+TEST sim_frames_should_decode_through_impairments(uint32_t seed,
+        enum spooky_line_code code) {
+    uint8_t in_buf[8];
+    static uint8_t samples[2 * MAX_SAMPLES];
+    set_TCSRNG_value(seed);
+    fill_buffer_with_noise(in_buf, sizeof(in_buf));
+    called = 0;
+    struct spooky_sim_config cfg = {
+        .oversample = 4, .clock_skew = 0.03f, .jitter = 0.4f,
+        .asymmetry = 1.5f, .seed = seed,
+    };
+    ASSERT_EQ(SPOOKY_SIM_OK, spooky_sim_init(&sim, &cfg));
+    ASSERT_EQ(SPOOKY_ENCODER_INIT_OK, spooky_encoder_init(&enc, buf, 8, 2));
+    ASSERT_EQ(SPOOKY_ENCODER_INIT_OK, spooky_encoder_set_line_code(&enc, code));
+    ASSERT_EQ(SPOOKY_ENCODER_ENQUEUE_OK, spooky_encoder_enqueue(&enc, in_buf, 8));
+    ASSERT_EQ(SPOOKY_DECODER_INIT_OK, spooky_decoder_init(&dec,
+            output_buf, OUTPUT_BUF_SZ, dec_cb, (void *)&called));
+    ASSERT_EQ(SPOOKY_DECODER_INIT_OK, spooky_decoder_set_line_code(&dec, code));
+    size_t n = 0;
+    ASSERT_EQ(SPOOKY_SIM_OK, spooky_sim_encode(&sim, &enc, samples,
+            sizeof(samples), &n));
+    for (size_t i=0; i<n && !called; i++) {
+        (void)spooky_decoder_step(&dec, samples[i]);
+    }
+    ASSERT_EQ(1, called);
+    ASSERT_EQ(0, memcmp(in_buf, output_buf, sizeof(in_buf)));
+    PASS();
+}
+
+SUITE(channel_model) {
+    RUN_TEST(sim_init_should_detect_bad_args);
+    for (int ticks=1; ticks<4; ticks++) {
+        RUN_TESTp(sim_clean_channel_should_match_encoder, ticks);
+    }
+    RUN_TEST(sim_should_apply_skew_spikes_and_dropouts);
+    for (int seed=0; seed<20; seed++) {
+        RUN_TESTp(sim_frames_should_decode_through_impairments, seed,
+            SPOOKY_LINE_MANCHESTER);
+        RUN_TESTp(sim_frames_should_decode_through_impairments, seed,
+            SPOOKY_LINE_4B5B);
+    }
+}
+
+/*******************
+ * Fragmentation   *
+ *******************/
+
+#define FRAG_MSG_SZ 1000
+
+static struct spooky_frag_tx ftx;
+static struct spooky_frag_rx frx;
+static uint8_t frag_msg[FRAG_MSG_SZ];
+static uint8_t frag_out[FRAG_MSG_SZ];
+
+static void frag_setup(void *unused) {
+    set_TCSRNG_value(1);
+    fill_buffer_with_noise(frag_msg, sizeof(frag_msg));
+    memset(frag_out, 0, sizeof(frag_out));
+}
+
+TEST frag_should_detect_bad_args() {
+    uint8_t frame[32], size;
+    ASSERT_EQ(SPOOKY_FRAG_ERROR_NULL,
+        spooky_frag_tx_init(NULL, frag_msg, 10, 1, 32));
+    ASSERT_EQ(SPOOKY_FRAG_ERROR_NULL, spooky_frag_tx_init(&ftx, NULL, 10, 1, 32));
+    ASSERT_EQ(SPOOKY_FRAG_ERROR_BAD_ARGUMENT,
+        spooky_frag_tx_init(&ftx, frag_msg, 0, 1, 32));
+    ASSERT_EQ(SPOOKY_FRAG_ERROR_BAD_ARGUMENT, spooky_frag_tx_init(&ftx,
+            frag_msg, 10, 1, SPOOKY_FRAG_HEADER_SIZE));
+    /* 1000 bytes at 1 byte per fragment is too many fragments. */
+    ASSERT_EQ(SPOOKY_FRAG_ERROR_SIZE, spooky_frag_tx_init(&ftx,
+            frag_msg, FRAG_MSG_SZ, 1, SPOOKY_FRAG_HEADER_SIZE + 1));
+    ASSERT_EQ(SPOOKY_FRAG_OK, spooky_frag_tx_init(&ftx, frag_msg, 10, 1, 32));
+    ASSERT_EQ(SPOOKY_FRAG_ERROR_BAD_ARGUMENT,
+        spooky_frag_tx_fragment(&ftx, 1, frame, &size));
+
+    ASSERT_EQ(SPOOKY_FRAG_ERROR_NULL, spooky_frag_rx_init(NULL, frag_out, 10));
+    ASSERT_EQ(SPOOKY_FRAG_ERROR_NULL, spooky_frag_rx_init(&frx, NULL, 10));
+    ASSERT_EQ(SPOOKY_FRAG_OK, spooky_frag_rx_init(&frx, frag_out, 10));
+    ASSERT_EQ(SPOOKY_FRAG_ERROR_BAD_ARGUMENT,
+        spooky_frag_rx_add(&frx, frame, SPOOKY_FRAG_HEADER_SIZE));
+    uint8_t bad_index[] = { 1, 2, 2, 4, 0xaa };       /* index 2 of 2 */
+    ASSERT_EQ(SPOOKY_FRAG_ERROR_BAD_ARGUMENT,
+        spooky_frag_rx_add(&frx, bad_index, sizeof(bad_index)));
+    uint8_t short_chunk[] = { 1, 0, 2, 4, 0xaa };     /* not the last */
+    ASSERT_EQ(SPOOKY_FRAG_ERROR_BAD_ARGUMENT,
+        spooky_frag_rx_add(&frx, short_chunk, sizeof(short_chunk)));
+    PASS();
+}
+
+/* Send a large message over the link, one frame per fragment. */
+TEST frag_message_should_survive_link() {
+    static bool samples[MAX_SAMPLES];
+    uint8_t frame[OUTPUT_BUF_SZ], size;
+    ASSERT_EQ(SPOOKY_FRAG_OK, spooky_frag_tx_init(&ftx, frag_msg,
+            FRAG_MSG_SZ, 0x42, OUTPUT_BUF_SZ));
+    ASSERT_EQ(SPOOKY_FRAG_OK, spooky_frag_rx_init(&frx, frag_out,
+            sizeof(frag_out)));
+    ASSERT_EQ(SPOOKY_DECODER_INIT_OK, spooky_decoder_init(&dec,
+            output_buf, OUTPUT_BUF_SZ, dec_cb, (void *)&called));
+    enum spooky_frag_res res = SPOOKY_FRAG_OK;
+    int frames = 0;
+    while (spooky_frag_tx_next(&ftx, frame, &size) == SPOOKY_FRAG_OK) {
+        ASSERT_EQ(SPOOKY_FRAG_OK, res);
+        ASSERT(size <= OUTPUT_BUF_SZ);
+        ASSERT_EQ(SPOOKY_ENCODER_INIT_OK,
+            spooky_encoder_init(&enc, buf, OUTPUT_BUF_SZ, 2));
+        ASSERT_EQ(SPOOKY_ENCODER_ENQUEUE_OK,
+            spooky_encoder_enqueue(&enc, frame, size));
+        size_t count = collect_samples(samples, MAX_SAMPLES);
+        ASSERT(count > 0);
+        called = 0;
+        for (size_t i=0; i<count; i++) {
+            (void)spooky_decoder_step(&dec, samples[i]);
+        }
+        ASSERT_EQ(1, called);
+        res = spooky_frag_rx_add(&frx, output_buf, output_sz);
+        frames++;
+    }
+    ASSERT_EQ(SPOOKY_FRAG_DONE, res);
+    ASSERT_EQ((FRAG_MSG_SZ + OUTPUT_BUF_SZ - SPOOKY_FRAG_HEADER_SIZE - 1)
+        / (OUTPUT_BUF_SZ - SPOOKY_FRAG_HEADER_SIZE), frames);
+    ASSERT_EQ(FRAG_MSG_SZ, frx.size);
+    ASSERT_EQ(0, memcmp(frag_msg, frag_out, FRAG_MSG_SZ));
+    PASS();
+}
+
+/* Shuffled, with some dropped and some duplicated, then the missing
+ * ones sent again. */
+TEST frag_should_reassemble_out_of_order(uint32_t seed) {
+    uint8_t order[SPOOKY_FRAG_MAX_COUNT];
+    uint8_t missing[SPOOKY_FRAG_MAX_COUNT];
+    uint8_t frame[64], size;
+    ASSERT_EQ(SPOOKY_FRAG_OK, spooky_frag_tx_init(&ftx, frag_msg,
+            FRAG_MSG_SZ, seed, sizeof(frame)));
+    ASSERT_EQ(SPOOKY_FRAG_OK, spooky_frag_rx_init(&frx, frag_out,
+            sizeof(frag_out)));
+    ASSERT_EQ(0, spooky_frag_rx_missing(&frx, missing, sizeof(missing)));
+
+    uint8_t count = ftx.count;
+    for (int i=0; i<count; i++) { order[i] = i; }
+    set_TCSRNG_value(seed);
+    for (int i=count - 1; i>0; i--) {
+        int j = (totes_cryptographically_secure_random_number_generator()
+            >> 16) % (i + 1);
+        uint8_t t = order[i]; order[i] = order[j]; order[j] = t;
+    }
+
+    int dropped = 0;
+    for (int i=0; i<count; i++) {
+        uint32_t r = totes_cryptographically_secure_random_number_generator();
+        if (((r >> 16) & 3) == 0) { dropped++; continue; }
+        ASSERT_EQ(SPOOKY_FRAG_OK,
+            spooky_frag_tx_fragment(&ftx, order[i], frame, &size));
+        enum spooky_frag_res res = spooky_frag_rx_add(&frx, frame, size);
+        ASSERT(res == SPOOKY_FRAG_OK || res == SPOOKY_FRAG_DONE);
+        if ((r >> 18) & 1) {
+            ASSERT_EQ(SPOOKY_FRAG_DUPLICATE,
+                spooky_frag_rx_add(&frx, frame, size));
+        }
+    }
+
+    uint8_t n = spooky_frag_rx_missing(&frx, missing, sizeof(missing));
+    ASSERT_EQ(dropped, n);
+    for (int i=0; i<n; i++) {
+        ASSERT_EQ(SPOOKY_FRAG_OK,
+            spooky_frag_tx_fragment(&ftx, missing[i], frame, &size));
+        ASSERT_EQ(i == n - 1 ? SPOOKY_FRAG_DONE : SPOOKY_FRAG_OK,
+            spooky_frag_rx_add(&frx, frame, size));
+    }
+    ASSERT_EQ(0, spooky_frag_rx_missing(&frx, missing, sizeof(missing)));
+    ASSERT_EQ(FRAG_MSG_SZ, frx.size);
+    ASSERT_EQ(0, memcmp(frag_msg, frag_out, FRAG_MSG_SZ));
+    PASS();
+}
+
+TEST frag_new_message_should_replace_incomplete_one() {
+    uint8_t frame[64], size;
+    uint8_t other[100];
+    memset(other, 0x5a, sizeof(other));
+    ASSERT_EQ(SPOOKY_FRAG_OK, spooky_frag_rx_init(&frx, frag_out,
+            sizeof(frag_out)));
+    ASSERT_EQ(SPOOKY_FRAG_OK, spooky_frag_tx_init(&ftx, frag_msg,
+            FRAG_MSG_SZ, 1, sizeof(frame)));
+    ASSERT_EQ(SPOOKY_FRAG_OK, spooky_frag_tx_next(&ftx, frame, &size));
+    ASSERT_EQ(SPOOKY_FRAG_OK, spooky_frag_rx_add(&frx, frame, size));
+    ASSERT_EQ(SPOOKY_FRAG_OK, spooky_frag_tx_next(&ftx, frame, &size));
+    ASSERT_EQ(SPOOKY_FRAG_OK, spooky_frag_rx_add(&frx, frame, size));
+
+    ASSERT_EQ(SPOOKY_FRAG_OK, spooky_frag_tx_init(&ftx, other,
+            sizeof(other), 2, sizeof(frame)));
+    ASSERT_EQ(SPOOKY_FRAG_OK, spooky_frag_tx_next(&ftx, frame, &size));
+    ASSERT_EQ(SPOOKY_FRAG_OK, spooky_frag_rx_add(&frx, frame, size));
+    ASSERT_EQ(1, spooky_frag_rx_missing(&frx, NULL, 0));
+    ASSERT_EQ(SPOOKY_FRAG_OK, spooky_frag_tx_next(&ftx, frame, &size));
+    ASSERT_EQ(SPOOKY_FRAG_DONE, spooky_frag_rx_add(&frx, frame, size));
+    ASSERT_EQ(SPOOKY_FRAG_DONE, spooky_frag_tx_next(&ftx, frame, &size));
+    ASSERT_EQ(sizeof(other), frx.size);
+    ASSERT_EQ(0, memcmp(other, frag_out, sizeof(other)));
+    PASS();
+}
+
+TEST frag_should_reject_message_larger_than_buffer() {
+    uint8_t frame[64], size;
+    ASSERT_EQ(SPOOKY_FRAG_OK, spooky_frag_rx_init(&frx, frag_out, 100));
+    ASSERT_EQ(SPOOKY_FRAG_OK, spooky_frag_tx_init(&ftx, frag_msg,
+            FRAG_MSG_SZ, 1, sizeof(frame)));
+    ASSERT_EQ(SPOOKY_FRAG_OK, spooky_frag_tx_next(&ftx, frame, &size));
+    ASSERT_EQ(SPOOKY_FRAG_OK, spooky_frag_rx_add(&frx, frame, size));
+    ASSERT_EQ(SPOOKY_FRAG_OK, spooky_frag_tx_fragment(&ftx,
+            ftx.count - 1, frame, &size));
+    ASSERT_EQ(SPOOKY_FRAG_ERROR_SIZE, spooky_frag_rx_add(&frx, frame, size));
+    PASS();
+}
+
+SUITE(frag) {
+    SET_SETUP(frag_setup, NULL);
+    RUN_TEST(frag_should_detect_bad_args);
+    RUN_TEST(frag_message_should_survive_link);
+    for (int seed=0; seed<20; seed++) {
+        RUN_TESTp(frag_should_reassemble_out_of_order, seed);
+    }
+    RUN_TEST(frag_new_message_should_replace_incomplete_one);
+    RUN_TEST(frag_should_reject_message_larger_than_buffer);
+}
+
+/*******************
+ * ARQ             *
+ *******************/
+
+#define ARQ_FRAME_SZ 16
+#define ARQ_MSGS 30
+
+struct arq_node {
+    struct spooky_encoder enc;
+    struct spooky_decoder dec;
+    struct spooky_arq arq;
+    struct spooky_sim sim;      /* channel to the other node */
+    uint8_t enc_buf[ARQ_FRAME_SZ];
+    uint8_t dec_buf[ARQ_FRAME_SZ];
+    uint8_t slots[SPOOKY_ARQ_MAX_WINDOW * ARQ_FRAME_SZ];
+    uint8_t level;
+    uint8_t got[2 * ARQ_MSGS];  /* first byte of each message */
+    uint8_t got_count;
+};
+
+static struct arq_node arq_a, arq_b;
+
+static void arq_cb(const uint8_t *data, uint8_t size, void *udata) {
+    struct arq_node *n = (struct arq_node *)udata;
+    if (size > 0 && n->got_count < sizeof(n->got)) {
+        n->got[n->got_count++] = data[0];
+    }
+}
+
+static int arq_node_init(struct arq_node *n, uint8_t address, uint8_t peer,
+        uint8_t window, uint16_t timeout, uint8_t max_retries,
+        uint8_t tx_rate, uint8_t fast_rate) {
+    struct spooky_arq_config cfg = {
+        .address = address, .peer = peer, .window = window,
+        .timeout = timeout, .max_retries = max_retries,
+        .fast_rate = fast_rate,
+    };
+    memset(n, 0, sizeof(*n));
+    if (spooky_encoder_init(&n->enc, n->enc_buf, sizeof(n->enc_buf), tx_rate)
+        != SPOOKY_ENCODER_INIT_OK) { return -1; }
+    if (spooky_decoder_init(&n->dec, n->dec_buf, sizeof(n->dec_buf),
+            spooky_arq_frame_cb, &n->arq) != SPOOKY_DECODER_INIT_OK) {
+        return -1;
+    }
+    return spooky_arq_init(&n->arq, &cfg, &n->enc, &n->dec, n->slots,
+        window * ARQ_FRAME_SZ, arq_cb, n);
+}
+
+/* Tick FROM, and if it handed its encoder a frame, pass that straight
+ * to TO (unless DROP), as if it had been sent. Returns the frame's
+ * size, or 0 if there wasn't one. */
+static uint8_t arq_hop(struct arq_node *from, struct arq_node *to, bool drop,
+        enum spooky_arq_res *res) {
+    *res = spooky_arq_tick(&from->arq);
+    if (from->enc.mode == 0) { return 0; }  /* idle */
+    uint8_t size = from->enc.input_size;
+    if (!drop) { spooky_arq_frame_cb(from->enc_buf, size, &to->arq); }
+    (void)spooky_encoder_clear(&from->enc);
+    return size;
+}
+
+/* Sync FROM to TO: a SYNC frame and its ACK. */
+static int arq_sync(struct arq_node *from, struct arq_node *to) {
+    enum spooky_arq_res res;
+    if (arq_hop(from, to, false, &res) == 0) { return -1; }
+    if (arq_hop(to, from, false, &res) == 0) { return -1; }
+    return (from->arq.synced ? 0 : -1);
+}
+
+TEST arq_should_detect_bad_args() {
+    struct spooky_arq_config cfg = { .address = 1, .peer = 2, .window = 2,
+        .timeout = 10 };
+    uint8_t slots[2 * ARQ_FRAME_SZ];
+    ASSERT_EQ(0, arq_node_init(&arq_a, 1, 2, 2, 10, 0, 2, 0));
+    ASSERT_EQ(SPOOKY_ARQ_ERROR_NULL, spooky_arq_init(NULL, &cfg,
+            &arq_a.enc, &arq_a.dec, slots, sizeof(slots), arq_cb, NULL));
+    ASSERT_EQ(SPOOKY_ARQ_ERROR_NULL, spooky_arq_init(&arq_a.arq, &cfg,
+            NULL, &arq_a.dec, slots, sizeof(slots), arq_cb, NULL));
+    cfg.window = SPOOKY_ARQ_MAX_WINDOW + 1;
+    ASSERT_EQ(SPOOKY_ARQ_ERROR_BAD_ARGUMENT, spooky_arq_init(&arq_a.arq,
+            &cfg, &arq_a.enc, &arq_a.dec, slots, sizeof(slots), arq_cb, NULL));
+    cfg.window = 2;
+    cfg.peer = cfg.address;
+    ASSERT_EQ(SPOOKY_ARQ_ERROR_BAD_ARGUMENT, spooky_arq_init(&arq_a.arq,
+            &cfg, &arq_a.enc, &arq_a.dec, slots, sizeof(slots), arq_cb, NULL));
+    cfg.peer = 2;
+    ASSERT_EQ(SPOOKY_ARQ_ERROR_SIZE, spooky_arq_init(&arq_a.arq, &cfg,
+            &arq_a.enc, &arq_a.dec, slots, 2 * SPOOKY_ARQ_HEADER_SIZE,
+            arq_cb, NULL));
+    ASSERT_EQ(SPOOKY_ARQ_OK, spooky_arq_init(&arq_a.arq, &cfg,
+            &arq_a.enc, &arq_a.dec, slots, sizeof(slots), arq_cb, NULL));
+
+    uint8_t msg[ARQ_FRAME_SZ] = { 0 };
+    ASSERT_EQ(SPOOKY_ARQ_ERROR_SIZE, spooky_arq_send(&arq_a.arq, msg,
+            ARQ_FRAME_SZ - SPOOKY_ARQ_HEADER_SIZE + 1));
+    ASSERT_EQ(SPOOKY_ARQ_OK, spooky_arq_send(&arq_a.arq, msg,
+            ARQ_FRAME_SZ - SPOOKY_ARQ_HEADER_SIZE));
+    ASSERT_EQ(SPOOKY_ARQ_OK, spooky_arq_send(&arq_a.arq, msg, 1));
+    ASSERT_EQ(SPOOKY_ARQ_ERROR_FULL, spooky_arq_send(&arq_a.arq, msg, 1));
+    ASSERT_EQ(2, spooky_arq_pending(&arq_a.arq));
+    PASS();
+}
+
+/* Lose the first frame: the second is out of order, so it isn't
+ * delivered, and after the timeout both are sent again. Then lose an
+ * ACK, so the receiver gets a duplicate, which it ACKs but doesn't
+ * deliver again. */
+TEST arq_should_resend_lost_frames_in_order() {
+    enum spooky_arq_res res;
+    ASSERT_EQ(0, arq_node_init(&arq_a, 1, 2, 2, 10, 0, 2, 0));
+    ASSERT_EQ(0, arq_node_init(&arq_b, 2, 1, 2, 10, 0, 2, 0));
+    for (uint8_t i=0; i<2; i++) {
+        ASSERT_EQ(SPOOKY_ARQ_OK, spooky_arq_send(&arq_a.arq, &i, 1));
+    }
+
+    ASSERT_EQ(0, arq_sync(&arq_a, &arq_b));
+    ASSERT(arq_hop(&arq_a, &arq_b, true, &res) > 0);       /* 0, lost */
+    ASSERT(arq_hop(&arq_a, &arq_b, false, &res) > 0);      /* 1 */
+    ASSERT_EQ(0, arq_b.got_count);
+    ASSERT(arq_hop(&arq_b, &arq_a, false, &res) > 0);      /* ACK 0 */
+    ASSERT_EQ(2, spooky_arq_pending(&arq_a.arq));
+
+    int ticks = 0;
+    while (arq_hop(&arq_a, &arq_b, false, &res) == 0) {   /* 0, again */
+        ASSERT_EQ(SPOOKY_ARQ_OK, res);
+        ASSERT(++ticks < 20);
+    }
+    ASSERT_EQ(1, arq_b.got_count);
+    ASSERT(arq_hop(&arq_b, &arq_a, true, &res) > 0);       /* ACK 1, lost */
+    ASSERT(arq_hop(&arq_a, &arq_b, false, &res) > 0);      /* 1 */
+    ASSERT_EQ(2, arq_b.got_count);
+    ASSERT(arq_hop(&arq_b, &arq_a, false, &res) > 0);      /* ACK 2 */
+    ASSERT_EQ(0, spooky_arq_pending(&arq_a.arq));
+
+    ASSERT_EQ(0, arq_b.got[0]);
+    ASSERT_EQ(1, arq_b.got[1]);
+
+    /* Nothing more to send. */
+    for (int i=0; i<50; i++) {
+        ASSERT_EQ(0, arq_hop(&arq_a, &arq_b, false, &res));
+        ASSERT_EQ(0, arq_hop(&arq_b, &arq_a, false, &res));
+    }
+    PASS();
+}
+
+/* After giving up on a peer, the next message should still get
+ * through, even though the peer got some of the abandoned ones. */
+TEST arq_should_give_up_and_resync() {
+    enum spooky_arq_res res;
+    ASSERT_EQ(0, arq_node_init(&arq_a, 1, 2, 2, 10, 2, 2, 0));
+    ASSERT_EQ(0, arq_node_init(&arq_b, 2, 1, 2, 10, 2, 2, 0));
+    uint8_t msg = 7;
+    ASSERT_EQ(SPOOKY_ARQ_OK, spooky_arq_send(&arq_a.arq, &msg, 1));
+    msg = 8;
+    ASSERT_EQ(SPOOKY_ARQ_OK, spooky_arq_send(&arq_a.arq, &msg, 1));
+
+    /* B gets both, but every ACK is lost. */
+    ASSERT_EQ(0, arq_sync(&arq_a, &arq_b));
+    int gave_up = 0;
+    for (int i=0; i<200 && !gave_up; i++) {
+        (void)arq_hop(&arq_a, &arq_b, false, &res);
+        if (res == SPOOKY_ARQ_GAVE_UP) { gave_up = 1; }
+        (void)arq_hop(&arq_b, &arq_a, true, &res);
+    }
+    ASSERT(gave_up);
+    ASSERT_EQ(0, spooky_arq_pending(&arq_a.arq));
+    ASSERT_EQ(2, arq_b.got_count);
+
+    msg = 9;
+    ASSERT_EQ(SPOOKY_ARQ_OK, spooky_arq_send(&arq_a.arq, &msg, 1));
+    for (int i=0; i<50; i++) {
+        (void)arq_hop(&arq_a, &arq_b, false, &res);
+        ASSERT_EQ(SPOOKY_ARQ_OK, res);
+        (void)arq_hop(&arq_b, &arq_a, false, &res);
+    }
+    ASSERT_EQ(0, spooky_arq_pending(&arq_a.arq));
+    ASSERT_EQ(3, arq_b.got_count);
+    ASSERT_EQ(9, arq_b.got[2]);
+    PASS();
+}
+
+/* Send messages FIRST..LAST from A to B, with nothing lost. */
+static int arq_send_range(uint8_t first, uint8_t last) {
+    enum spooky_arq_res res;
+    uint8_t msg = first;
+    for (int i=0; i<200; i++) {
+        if (msg <= last
+            && spooky_arq_send(&arq_a.arq, &msg, 1) == SPOOKY_ARQ_OK) {
+            msg++;
+        } else if (msg > last && spooky_arq_pending(&arq_a.arq) == 0) {
+            return 0;
+        }
+        (void)arq_hop(&arq_a, &arq_b, false, &res);
+        if (res != SPOOKY_ARQ_OK) { return -1; }
+        (void)arq_hop(&arq_b, &arq_a, false, &res);
+    }
+    return -1;
+}
+
+/* If the sender restarts mid-stream, it starts over at sequence number
+ * 0, which the receiver would take for a duplicate; it should pick up
+ * at the receiver's count instead, resending forever or not. */
+TEST arq_should_resync_after_sender_restarts(uint8_t max_retries) {
+    ASSERT_EQ(0, arq_node_init(&arq_a, 1, 2, 4, 10, max_retries, 2, 0));
+    ASSERT_EQ(0, arq_node_init(&arq_b, 2, 1, 4, 10, max_retries, 2, 0));
+    ASSERT_EQ(0, arq_send_range(0, 4));
+    ASSERT_EQ(5, arq_b.got_count);
+
+    ASSERT_EQ(0, arq_node_init(&arq_a, 1, 2, 4, 10, max_retries, 2, 0));
+    ASSERT_EQ(0, arq_send_range(5, 7));
+    ASSERT_EQ(8, arq_b.got_count);
+    for (int i=0; i<8; i++) { ASSERT_EQ(i, arq_b.got[i]); }
+    PASS();
+}
+
+/* If the receiver restarts mid-stream, it should get the sender to
+ * sync again, rather than waiting for a sequence number that will
+ * never come. */
+TEST arq_should_resync_after_receiver_restarts(uint8_t max_retries) {
+    ASSERT_EQ(0, arq_node_init(&arq_a, 1, 2, 4, 10, max_retries, 2, 0));
+    ASSERT_EQ(0, arq_node_init(&arq_b, 2, 1, 4, 10, max_retries, 2, 0));
+    ASSERT_EQ(0, arq_send_range(0, 4));
+    ASSERT_EQ(5, arq_b.got_count);
+
+    ASSERT_EQ(0, arq_node_init(&arq_b, 2, 1, 4, 10, max_retries, 2, 0));
+    ASSERT_EQ(0, arq_send_range(5, 7));
+    ASSERT_EQ(3, arq_b.got_count);
+    for (int i=0; i<3; i++) { ASSERT_EQ(5 + i, arq_b.got[i]); }
+    PASS();
+}
+
+/* Step FROM's encoder and its channel, feeding TO's decoder. */
+static int arq_link_step(struct arq_node *from, struct arq_node *to) {
+    uint8_t samples[16];
+    size_t n = 0;
+    enum spooky_encoder_step_res esres = spooky_encoder_step(&from->enc);
+    if (esres < 0) { return -1; }
+    if (esres == SPOOKY_ENCODER_STEP_OK_LOW) {
+        from->level = 0;
+    } else if (esres == SPOOKY_ENCODER_STEP_OK_HIGH) {
+        from->level = 1;
+    }
+    if (spooky_sim_run(&from->sim, &from->level, 1, samples, sizeof(samples),
+            &n) != SPOOKY_SIM_OK) { return -1; }
+    for (size_t i=0; i<n; i++) {
+        if (spooky_decoder_step(&to->dec, samples[i]) < 0) { return -1; }
+    }
+    return 0;
+}
+
+/* Two nodes sending to each other at once, over channels that lose
+ * frames to dropouts, should get every message, in order, once. */
+TEST arq_should_deliver_everything_over_lossy_channel(uint32_t seed,
+        uint8_t window) {
+    struct spooky_sim_config cfg = {
+        .oversample = RATE_MUL, .jitter = 0.3f, .asymmetry = 0.5f,
+        .dropout_rate = 0.0002f, .dropout_length = 40,
+    };
+    ASSERT_EQ(0, arq_node_init(&arq_a, 1, 2, window, 3000, 0, 2, 0));
+    ASSERT_EQ(0, arq_node_init(&arq_b, 2, 1, window, 3000, 0, 2, 0));
+    cfg.seed = seed;
+    ASSERT_EQ(SPOOKY_SIM_OK, spooky_sim_init(&arq_a.sim, &cfg));
+    cfg.seed = seed + 1000;
+    ASSERT_EQ(SPOOKY_SIM_OK, spooky_sim_init(&arq_b.sim, &cfg));
+
+    uint8_t a_sent = 0, b_sent = 0;
+    int resends = 0;
+    uint8_t msg[8];
+    memset(msg, 0xA5, sizeof(msg));
+    for (long t=0; t<2000000; t++) {
+        msg[0] = a_sent;
+        if (a_sent < ARQ_MSGS
+            && spooky_arq_send(&arq_a.arq, msg, sizeof(msg)) == SPOOKY_ARQ_OK) {
+            a_sent++;
+        }
+        msg[0] = b_sent;
+        if (b_sent < ARQ_MSGS / 3
+            && spooky_arq_send(&arq_b.arq, msg, sizeof(msg)) == SPOOKY_ARQ_OK) {
+            b_sent++;
+        }
+        uint8_t retries = arq_a.arq.retries;
+        ASSERT_EQ(SPOOKY_ARQ_OK, spooky_arq_tick(&arq_a.arq));
+        ASSERT_EQ(SPOOKY_ARQ_OK, spooky_arq_tick(&arq_b.arq));
+        if (arq_a.arq.retries > retries) { resends++; }
+        ASSERT_EQ(0, arq_link_step(&arq_a, &arq_b));
+        ASSERT_EQ(0, arq_link_step(&arq_b, &arq_a));
+        if (a_sent == ARQ_MSGS && b_sent == ARQ_MSGS / 3
+            && spooky_arq_pending(&arq_a.arq) == 0
+            && spooky_arq_pending(&arq_b.arq) == 0) {
+            break;
+        }
+    }
+
+    ASSERT(resends > 0);
+    ASSERT_EQ(ARQ_MSGS, arq_b.got_count);
+    for (int i=0; i<ARQ_MSGS; i++) { ASSERT_EQ(i, arq_b.got[i]); }
+    ASSERT_EQ(ARQ_MSGS / 3, arq_a.got_count);
+    for (int i=0; i<ARQ_MSGS / 3; i++) { ASSERT_EQ(i, arq_a.got[i]); }
+    PASS();
+}
+
+/* Step both nodes' encoders onto one shared medium (a high from
+ * either is a high), and feed it to both decoders, each through its
+ * own SIM: a half-duplex channel, where each node also hears itself. */
+static int arq_medium_step(struct arq_node *a, struct arq_node *b) {
+    struct arq_node *nodes[] = { a, b };
+    for (int i=0; i<2; i++) {
+        enum spooky_encoder_step_res esres = spooky_encoder_step(&nodes[i]->enc);
+        if (esres < 0) { return -1; }
+        if (esres == SPOOKY_ENCODER_STEP_OK_LOW) {
+            nodes[i]->level = 0;
+        } else if (esres == SPOOKY_ENCODER_STEP_OK_HIGH) {
+            nodes[i]->level = 1;
+        } else if (esres == SPOOKY_ENCODER_STEP_OK_DONE) {
+            nodes[i]->level = 0;    /* off the air */
+        }
+    }
+    uint8_t level = a->level | b->level;
+    for (int i=0; i<2; i++) {
+        uint8_t samples[16];
+        size_t n = 0;
+        if (spooky_sim_run(&nodes[i]->sim, &level, 1, samples,
+                sizeof(samples), &n) != SPOOKY_SIM_OK) { return -1; }
+        for (size_t s=0; s<n; s++) {
+            if (spooky_decoder_step(&nodes[i]->dec, samples[s]) < 0) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+/* Two nodes sending to each other on a shared medium should also get
+ * every message, in order, once: each holds off while it's receiving,
+ * and frames lost when both start at once are sent again. */
+TEST arq_should_deliver_everything_over_shared_medium(uint32_t seed,
+        uint8_t window) {
+    struct spooky_sim_config cfg = {
+        .oversample = RATE_MUL, .jitter = 0.3f, .asymmetry = 0.5f,
+    };
+    ASSERT_EQ(0, arq_node_init(&arq_a, 1, 2, window, 3000, 0, 2, 0));
+    ASSERT_EQ(0, arq_node_init(&arq_b, 2, 1, window, 3000, 0, 2, 0));
+    arq_a.arq.cfg.backoff = arq_b.arq.cfg.backoff = 1500;
+    cfg.seed = seed;
+    ASSERT_EQ(SPOOKY_SIM_OK, spooky_sim_init(&arq_a.sim, &cfg));
+    cfg.seed = seed + 1000;
+    ASSERT_EQ(SPOOKY_SIM_OK, spooky_sim_init(&arq_b.sim, &cfg));
+
+    uint8_t a_sent = 0, b_sent = 0;
+    uint8_t msg[8];
+    memset(msg, 0xA5, sizeof(msg));
+    for (long t=0; t<4000000; t++) {
+        msg[0] = a_sent;
+        if (a_sent < ARQ_MSGS
+            && spooky_arq_send(&arq_a.arq, msg, sizeof(msg)) == SPOOKY_ARQ_OK) {
+            a_sent++;
+        }
+        msg[0] = b_sent;
+        if (b_sent < ARQ_MSGS / 3
+            && spooky_arq_send(&arq_b.arq, msg, sizeof(msg)) == SPOOKY_ARQ_OK) {
+            b_sent++;
+        }
+        ASSERT_EQ(SPOOKY_ARQ_OK, spooky_arq_tick(&arq_a.arq));
+        ASSERT_EQ(SPOOKY_ARQ_OK, spooky_arq_tick(&arq_b.arq));
+        ASSERT_EQ(0, arq_medium_step(&arq_a, &arq_b));
+        if (a_sent == ARQ_MSGS && b_sent == ARQ_MSGS / 3
+            && spooky_arq_pending(&arq_a.arq) == 0
+            && spooky_arq_pending(&arq_b.arq) == 0) {
+            break;
+        }
+    }
+
+    ASSERT_EQ(ARQ_MSGS, arq_b.got_count);
+    for (int i=0; i<ARQ_MSGS; i++) { ASSERT_EQ(i, arq_b.got[i]); }
+    ASSERT_EQ(ARQ_MSGS / 3, arq_a.got_count);
+    for (int i=0; i<ARQ_MSGS / 3; i++) { ASSERT_EQ(i, arq_a.got[i]); }
+    PASS();
+}
+
+/* Nothing should be sent while the decoder is partway through a
+ * frame, even with one waiting. */
+TEST arq_should_hold_off_while_receiving() {
+    ASSERT_EQ(0, arq_node_init(&arq_a, 1, 2, 1, 100, 0, 2, 0));
+    uint8_t msg = 7;
+    ASSERT_EQ(SPOOKY_ARQ_OK, spooky_arq_send(&arq_a.arq, &msg, 1));
+    ASSERT_FALSE(spooky_decoder_busy(&arq_a.dec));
+    ASSERT_EQ(SPOOKY_DECODER_INIT_OK, spooky_decoder_lock(&arq_a.dec, 4, true));
+    ASSERT(spooky_decoder_busy(&arq_a.dec));
+    ASSERT_EQ(SPOOKY_ARQ_OK, spooky_arq_tick(&arq_a.arq));
+    ASSERT_EQ(0, arq_a.enc.mode);
+
+    /* The frame breaks off (no edges for too long), so go ahead. */
+    for (int i=0; i<64; i++) { (void)spooky_decoder_step(&arq_a.dec, true); }
+    ASSERT_FALSE(spooky_decoder_busy(&arq_a.dec));
+    ASSERT_EQ(SPOOKY_ARQ_OK, spooky_arq_tick(&arq_a.arq));
+    ASSERT(arq_a.enc.mode != 0);
+    PASS();
+}
+
+/* Send a frame from node 1 (window 1), and ACK it from node 2,
+ * reporting INTERVAL and MISFITS. */
+static void arq_report(uint8_t interval, uint8_t misfits) {
+    enum spooky_arq_res res;
+    uint8_t msg = 0;
+    (void)spooky_arq_send(&arq_a.arq, &msg, 1);
+    (void)arq_hop(&arq_a, &arq_b, true, &res);
+    uint8_t ack[] = { 1, 2, 0x02, arq_a.arq.base + 1, interval, misfits };
+    spooky_arq_frame_cb(ack, sizeof(ack), &arq_a.arq);
+}
+
+TEST arq_should_adapt_rate_to_reports() {
+    ASSERT_EQ(0, arq_node_init(&arq_a, 1, 2, 1, 10, 0, 8, 2));
+    ASSERT_EQ(8, spooky_arq_rate(&arq_a.arq));
+
+    /* Clean ACKs: faster. */
+    for (int i=0; i<SPOOKY_ARQ_RATE_UP_ACKS - 1; i++) { arq_report(16, 0); }
+    ASSERT_EQ(8, spooky_arq_rate(&arq_a.arq));
+    arq_report(16, 0);
+    ASSERT_EQ(7, spooky_arq_rate(&arq_a.arq));
+
+    /* A few misses hold the rate, too many go back, and since the
+     * faster rate never worked, it takes twice as long to retry it. */
+    arq_report(14, SPOOKY_ARQ_MAX_MISFITS);
+    ASSERT_EQ(7, spooky_arq_rate(&arq_a.arq));
+    arq_report(14, SPOOKY_ARQ_MAX_MISFITS + 1);
+    ASSERT_EQ(8, spooky_arq_rate(&arq_a.arq));
+    for (int i=0; i<2 * SPOOKY_ARQ_RATE_UP_ACKS - 1; i++) { arq_report(16, 0); }
+    ASSERT_EQ(8, spooky_arq_rate(&arq_a.arq));
+    arq_report(16, 0);
+    ASSERT_EQ(7, spooky_arq_rate(&arq_a.arq));
+
+    /* Once it has, back to the usual wait. */
+    for (int i=0; i<SPOOKY_ARQ_RATE_UP_ACKS; i++) { arq_report(14, 0); }
+    ASSERT_EQ(6, spooky_arq_rate(&arq_a.arq));
+
+    /* No faster than the receiver can follow: at rate 6, an interval
+     * of 6 would be 5 at rate 5, but 5 would be 4 at rate 4 and 3 at
+     * rate 3. */
+    for (int i=0; i<4 * SPOOKY_ARQ_RATE_UP_ACKS; i++) { arq_report(
+            spooky_arq_rate(&arq_a.arq), 0); }
+    ASSERT_EQ(4, spooky_arq_rate(&arq_a.arq));
+
+    /* A timeout goes back, and the encoder follows between frames. */
+    uint8_t msg = 1;
+    enum spooky_arq_res res;
+    ASSERT_EQ(SPOOKY_ARQ_OK, spooky_arq_send(&arq_a.arq, &msg, 1));
+    ASSERT(arq_hop(&arq_a, &arq_b, true, &res) > 0);
+    ASSERT_EQ(4, arq_a.enc.tx_rate);
+    for (int i=0; i<10; i++) { (void)spooky_arq_tick(&arq_a.arq); }
+    ASSERT_EQ(5, spooky_arq_rate(&arq_a.arq));
+    ASSERT(arq_hop(&arq_a, &arq_b, true, &res) > 0);
+    ASSERT_EQ(5, arq_a.enc.tx_rate);
+    PASS();
+}
+
+/* Stale and duplicate ACKs (e.g. for a frame that was sent again)
+ * report on frames that were already counted, if at all. */
+TEST arq_should_adapt_rate_only_to_new_acks() {
+    ASSERT_EQ(0, arq_node_init(&arq_a, 1, 2, 1, 10, 0, 8, 2));
+    arq_report(16, 0);
+    uint8_t ack[] = { 1, 2, 0x02, arq_a.arq.base, 16, 0 };
+    for (int i=0; i<4 * SPOOKY_ARQ_RATE_UP_ACKS; i++) {
+        spooky_arq_frame_cb(ack, sizeof(ack), &arq_a.arq);
+    }
+    ASSERT_EQ(8, spooky_arq_rate(&arq_a.arq));
+    PASS();
+}
+
+TEST arq_should_keep_rate_without_fast_rate() {
+    ASSERT_EQ(0, arq_node_init(&arq_a, 1, 2, 1, 10, 0, 8, 0));
+    for (int i=0; i<4 * SPOOKY_ARQ_RATE_UP_ACKS; i++) { arq_report(16, 0); }
+    ASSERT_EQ(8, spooky_arq_rate(&arq_a.arq));
+    ASSERT_EQ(SPOOKY_ARQ_ERROR_BAD_ARGUMENT,
+        arq_node_init(&arq_a, 1, 2, 1, 10, 0, 8, 9));
+    PASS();
+}
+
+/* Starting slow, A should speed up on a clean link and stay slower on
+ * one with more edge jitter, without losing anything either way. */
+TEST arq_should_adapt_rate_to_channel(float jitter, uint8_t min_rate,
+        uint8_t max_rate) {
+    struct spooky_sim_config cfg = {
+        .oversample = RATE_MUL, .jitter = jitter,
+    };
+    ASSERT_EQ(0, arq_node_init(&arq_a, 1, 2, 2, 8000, 0, 8, 1));
+    ASSERT_EQ(0, arq_node_init(&arq_b, 2, 1, 2, 8000, 0, 8, 0));
+    ASSERT_EQ(SPOOKY_SIM_OK, spooky_sim_init(&arq_a.sim, &cfg));
+    cfg.seed = 1000;
+    ASSERT_EQ(SPOOKY_SIM_OK, spooky_sim_init(&arq_b.sim, &cfg));
+
+    uint8_t sent = 0;
+    uint8_t msg[8];
+    memset(msg, 0x5A, sizeof(msg));
+    for (long t=0; t<4000000; t++) {
+        msg[0] = sent;
+        if (sent < 2 * ARQ_MSGS
+            && spooky_arq_send(&arq_a.arq, msg, sizeof(msg)) == SPOOKY_ARQ_OK) {
+            sent++;
+        }
+        ASSERT_EQ(SPOOKY_ARQ_OK, spooky_arq_tick(&arq_a.arq));
+        ASSERT_EQ(SPOOKY_ARQ_OK, spooky_arq_tick(&arq_b.arq));
+        ASSERT_EQ(0, arq_link_step(&arq_a, &arq_b));
+        ASSERT_EQ(0, arq_link_step(&arq_b, &arq_a));
+        if (sent == 2 * ARQ_MSGS && spooky_arq_pending(&arq_a.arq) == 0) {
+            break;
+        }
+    }
+
+    ASSERT_EQ(2 * ARQ_MSGS, arq_b.got_count);
+    for (int i=0; i<2 * ARQ_MSGS; i++) { ASSERT_EQ(i, arq_b.got[i]); }
+    uint8_t rate = spooky_arq_rate(&arq_a.arq);
+    ASSERT(rate >= min_rate);
+    ASSERT(rate <= max_rate);
+    PASS();
+}
+
+SUITE(arq) {
+    RUN_TEST(arq_should_detect_bad_args);
+    RUN_TEST(arq_should_resend_lost_frames_in_order);
+    RUN_TEST(arq_should_give_up_and_resync);
+    RUN_TESTp(arq_should_resync_after_sender_restarts, 0);
+    RUN_TESTp(arq_should_resync_after_sender_restarts, 2);
+    RUN_TESTp(arq_should_resync_after_receiver_restarts, 0);
+    RUN_TESTp(arq_should_resync_after_receiver_restarts, 2);
+    RUN_TEST(arq_should_hold_off_while_receiving);
+    RUN_TEST(arq_should_adapt_rate_to_reports);
+    RUN_TEST(arq_should_adapt_rate_only_to_new_acks);
+    RUN_TEST(arq_should_keep_rate_without_fast_rate);
+    RUN_TESTp(arq_should_adapt_rate_to_channel, 0.2f, 2, 5);
+    RUN_TESTp(arq_should_adapt_rate_to_channel, 1.5f, 7, 8);
+    for (int seed=0; seed<10; seed++) {
+        RUN_TESTp(arq_should_deliver_everything_over_lossy_channel, seed, 1);
+        RUN_TESTp(arq_should_deliver_everything_over_lossy_channel, seed, 4);
+        RUN_TESTp(arq_should_deliver_everything_over_shared_medium, seed, 1);
+        RUN_TESTp(arq_should_deliver_everything_over_shared_medium, seed, 4);
+    }
+}
+
+/*******************
+ * Aggregation     *
+ *******************/
+
+#define AGG_READINGS 10
+
+static uint8_t agg_got[AGG_READINGS][2];
+static uint8_t agg_got_count;
+
+static void agg_cb(const uint8_t *data, uint8_t size, void *udata) {
+    (void)udata;
+    if (size == 2 && agg_got_count < AGG_READINGS) {
+        memcpy(agg_got[agg_got_count], data, size);
+    }
+    agg_got_count++;
+}
+
+TEST agg_tx_should_pack_messages_with_sizes() {
+    struct spooky_agg_tx tx;
+    uint8_t frame[8];
+    uint8_t a[] = { 0xA1, 0xA2 };
+    uint8_t b[] = { 0xB1, 0xB2, 0xB3 };
+    ASSERT_EQ(SPOOKY_AGG_ERROR_NULL, spooky_agg_tx_init(NULL, frame, 8));
+    ASSERT_EQ(SPOOKY_AGG_ERROR_BAD_ARGUMENT, spooky_agg_tx_init(&tx, frame, 1));
+    ASSERT_EQ(SPOOKY_AGG_OK, spooky_agg_tx_init(&tx, frame, sizeof(frame)));
+
+    ASSERT_EQ(SPOOKY_AGG_ERROR_BAD_ARGUMENT, spooky_agg_tx_add(&tx, a, 0));
+    ASSERT_EQ(SPOOKY_AGG_ERROR_SIZE, spooky_agg_tx_add(&tx, buf, 8));
+    ASSERT_EQ(SPOOKY_AGG_OK, spooky_agg_tx_add(&tx, a, sizeof(a)));
+    ASSERT_EQ(SPOOKY_AGG_OK, spooky_agg_tx_add(&tx, b, sizeof(b)));
+    ASSERT_EQ(SPOOKY_AGG_ERROR_FULL, spooky_agg_tx_add(&tx, a, sizeof(a)));
+    ASSERT_EQ(2, spooky_agg_tx_pending(&tx));
+
+    uint8_t expect[] = { 2, 0xA1, 0xA2, 3, 0xB1, 0xB2, 0xB3 };
+    ASSERT_EQ(SPOOKY_ENCODER_INIT_OK, spooky_encoder_init(&enc, buf, BUF_SZ, 2));
+    ASSERT_EQ(SPOOKY_AGG_OK, spooky_agg_tx_enqueue(&tx, &enc));
+    ASSERT_EQ(sizeof(expect), enc.input_size);
+    ASSERT_EQ(0, memcmp(expect, buf, sizeof(expect)));
+    ASSERT_EQ(0, spooky_agg_tx_pending(&tx));
+    ASSERT_EQ(SPOOKY_AGG_EMPTY, spooky_agg_tx_enqueue(&tx, &enc));
+
+    /* The encoder's busy, so the messages wait. */
+    ASSERT_EQ(SPOOKY_AGG_OK, spooky_agg_tx_add(&tx, a, sizeof(a)));
+    ASSERT_EQ(SPOOKY_AGG_ERROR_FULL, spooky_agg_tx_enqueue(&tx, &enc));
+    ASSERT_EQ(1, spooky_agg_tx_pending(&tx));
+    PASS();
+}
+
+TEST agg_rx_should_reject_frames_that_are_not_containers() {
+    struct spooky_agg_rx rx;
+    uint8_t ok[] = { 2, 0x01, 0x02, 2, 0x03, 0x04 };
+    uint8_t zero[] = { 2, 0x01, 0x02, 0, 0x03 };
+    uint8_t short_[] = { 2, 0x01, 0x02, 3, 0x03, 0x04 };
+    uint8_t long_[] = { 2, 0x01, 0x02, 1, 0x03, 0x04 };
+    ASSERT_EQ(SPOOKY_AGG_ERROR_NULL, spooky_agg_rx_init(&rx, NULL, NULL));
+    ASSERT_EQ(SPOOKY_AGG_OK, spooky_agg_rx_init(&rx, agg_cb, NULL));
+
+    agg_got_count = 0;
+    ASSERT_EQ(SPOOKY_AGG_ERROR_BAD_ARGUMENT,
+        spooky_agg_rx_split(&rx, zero, sizeof(zero)));
+    ASSERT_EQ(SPOOKY_AGG_ERROR_BAD_ARGUMENT,
+        spooky_agg_rx_split(&rx, short_, sizeof(short_)));
+    ASSERT_EQ(SPOOKY_AGG_ERROR_BAD_ARGUMENT,
+        spooky_agg_rx_split(&rx, long_, sizeof(long_)));
+    ASSERT_EQ(SPOOKY_AGG_ERROR_BAD_ARGUMENT, spooky_agg_rx_split(&rx, ok, 0));
+    ASSERT_EQ(0, agg_got_count);
+    ASSERT_EQ(4, rx.rejected);
+
+    ASSERT_EQ(SPOOKY_AGG_OK, spooky_agg_rx_split(&rx, ok, sizeof(ok)));
+    ASSERT_EQ(2, agg_got_count);
+    ASSERT_EQ(0x03, agg_got[1][0]);
+    ASSERT_EQ(0x04, agg_got[1][1]);
+    ASSERT_EQ(2, rx.messages);
+    PASS();
+}
+
+/* Encoder ticks to send a SIZE byte frame. */
+static size_t frame_ticks(uint8_t *frame, uint8_t size) {
+    size_t ticks = 0;
+    if (spooky_encoder_enqueue(&enc, frame, size) != SPOOKY_ENCODER_ENQUEUE_OK) {
+        return 0;
+    }
+    while (spooky_encoder_step(&enc) != SPOOKY_ENCODER_STEP_OK_DONE) { ticks++; }
+    return ticks;
+}
+
+/* Ten 2-byte readings, sent as one container frame with a PREAMBLE
+ * bit wake-up preamble, should each reach the callback, in under
+ * 10/TENTHS the time of ten frames. */
+TEST agg_should_deliver_each_message_in_one_frame(uint16_t preamble,
+        uint8_t tenths) {
+    static bool samples[MAX_SAMPLES];
+    struct spooky_agg_tx tx;
+    struct spooky_agg_rx rx;
+    uint8_t frame[3 * AGG_READINGS];
+    ASSERT_EQ(SPOOKY_AGG_OK, spooky_agg_tx_init(&tx, frame, sizeof(frame)));
+    ASSERT_EQ(SPOOKY_AGG_OK, spooky_agg_rx_init(&rx, agg_cb, NULL));
+    ASSERT_EQ(SPOOKY_ENCODER_INIT_OK, spooky_encoder_init(&enc, buf, BUF_SZ, 1));
+    ASSERT_EQ(SPOOKY_ENCODER_INIT_OK, spooky_encoder_set_preamble(&enc, preamble));
+
+    size_t separate = 0;
+    for (uint8_t i=0; i<AGG_READINGS; i++) {
+        uint8_t reading[] = { i, 0xF0 | i };
+        ASSERT_EQ(SPOOKY_AGG_OK, spooky_agg_tx_add(&tx, reading, 2));
+        separate += frame_ticks(reading, sizeof(reading));
+    }
+    ASSERT_EQ(SPOOKY_AGG_OK, spooky_agg_tx_enqueue(&tx, &enc));
+    size_t count = collect_samples(samples, MAX_SAMPLES);
+    ASSERT(count > 0);
+    ASSERT(tenths * count / RATE_MUL < 10 * separate);
+
+    agg_got_count = 0;
+    ASSERT_EQ(SPOOKY_DECODER_INIT_OK, spooky_decoder_init(&dec, output_buf,
+            OUTPUT_BUF_SZ, spooky_agg_frame_cb, &rx));
+    for (size_t i=0; i<count; i++) {
+        ASSERT(spooky_decoder_step(&dec, samples[i]) >= 0);
+    }
+    ASSERT_EQ(AGG_READINGS, agg_got_count);
+    for (uint8_t i=0; i<AGG_READINGS; i++) {
+        ASSERT_EQ(i, agg_got[i][0]);
+        ASSERT_EQ(0xF0 | i, agg_got[i][1]);
+    }
+    PASS();
+}
+
+SUITE(agg) {
+    RUN_TEST(agg_tx_should_pack_messages_with_sizes);
+    RUN_TEST(agg_rx_should_reject_frames_that_are_not_containers);
+    RUN_TESTp(agg_should_deliver_each_message_in_one_frame, 0, 15);
+    RUN_TESTp(agg_should_deliver_each_message_in_one_frame, 32, 25);
+    RUN_TESTp(agg_should_deliver_each_message_in_one_frame, 128, 40);
 }
 
 /* Add all the definitions that need to be in the test runner's main file. */
@@ -550,6 +3414,16 @@ int main(int argc, char **argv) {
     GREATEST_MAIN_BEGIN();      /* command-line arguments, initialization. */
     RUN_SUITE(encoder);
     RUN_SUITE(decoder);
+    RUN_SUITE(filter);
     RUN_SUITE(integration);
+    RUN_SUITE(correlator);
+#ifndef SPOOKY_DECODER_FIXED_CB     /* they set their own callbacks */
+    RUN_SUITE(channelizer);
+    RUN_SUITE(pipeline);
+#endif
+    RUN_SUITE(channel_model);
+    RUN_SUITE(frag);
+    RUN_SUITE(arq);
+    RUN_SUITE(agg);
     GREATEST_MAIN_END();        /* display results */
 }
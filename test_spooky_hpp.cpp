@@ -0,0 +1,175 @@
+#include "greatest.h"
+#include "spooky.hpp"
+#include <string.h>
+
+/* Tests for the header-only C++ layer in spooky.hpp. */
+
+#define RATE_MUL 2
+#define TX_RATE 3
+
+static int called = 0;
+static uint8_t output_buf[64];
+static uint8_t output_sz = 0;
+
+struct Handler {
+    static void frame(uint8_t *data, uint8_t size) {
+        called++;
+        memcpy(output_buf, data, size);
+        output_sz = size;
+    }
+};
+
+template <typename Enc, typename Dec>
+static int run_link(Enc &enc, Dec &dec) {
+    bool bit = false;
+    for (int timeout=0; timeout<10000; timeout++) {
+        spooky_encoder_step_res esres = enc.step();
+        if (esres < 0) { return -1; }
+        if (esres == SPOOKY_ENCODER_STEP_OK_LOW) {
+            bit = false;
+        } else if (esres == SPOOKY_ENCODER_STEP_OK_HIGH) {
+            bit = true;
+        }
+        for (int i=0; i<RATE_MUL; i++) {
+            if (dec.step(bit) < 0) { return -1; }
+            if (called) { return 0; }
+        }
+    }
+    return -1;
+}
+
+static void setup(void *unused) {
+    (void)unused;
+    called = 0;
+    output_sz = 0;
+    memset(output_buf, 0, sizeof(output_buf));
+}
+
+TEST wrapper_should_tx_and_rx_intact() {
+    spooky::Encoder<16, TX_RATE> enc;
+    spooky::Decoder<32, 0, Handler> dec;
+    const uint8_t msg[] = { 0xED, 0x05, 0x7a, 0x00, 0xff };
+    ASSERT_EQ(SPOOKY_ENCODER_ENQUEUE_OK, enc.enqueue(msg));
+    ASSERT_EQ(0, run_link(enc, dec));
+    ASSERT_EQ(1, called);
+    ASSERT_EQ(sizeof(msg), output_sz);
+    ASSERT_EQ(0, memcmp(msg, output_buf, sizeof(msg)));
+    PASS();
+}
+
+TEST wrapper_with_fixed_interval_should_rx_at_that_rate() {
+    spooky::Encoder<16, TX_RATE> enc;
+    spooky::Decoder<32, TX_RATE * RATE_MUL, Handler> dec;
+    const uint8_t msg[] = { 0x01, 0x02, 0x03 };
+    ASSERT_EQ(SPOOKY_ENCODER_ENQUEUE_OK, enc.enqueue(msg));
+    ASSERT_EQ(0, run_link(enc, dec));
+    ASSERT_EQ(1, called);
+    ASSERT_EQ(0, memcmp(msg, output_buf, sizeof(msg)));
+    PASS();
+}
+
+TEST wrapper_with_fixed_interval_should_ignore_other_rates() {
+    spooky::Encoder<16, TX_RATE> enc;
+    spooky::Decoder<32, 4 * TX_RATE * RATE_MUL, Handler> dec;
+    const uint8_t msg[] = { 0x01, 0x02, 0x03 };
+    ASSERT_EQ(SPOOKY_ENCODER_ENQUEUE_OK, enc.enqueue(msg));
+    ASSERT_EQ(-1, run_link(enc, dec));
+    ASSERT_EQ(0, called);
+    PASS();
+}
+
+TEST wrapper_with_address_should_ignore_other_nodes() {
+    spooky::Encoder<16, TX_RATE> enc;
+    spooky::Decoder<32, 0, Handler> dec;
+    dec.set_address(0xEE);
+    const uint8_t msg[] = { 0xED, 0x05 };
+    ASSERT_EQ(SPOOKY_ENCODER_ENQUEUE_OK, enc.enqueue(msg));
+    ASSERT_EQ(-1, run_link(enc, dec));
+    ASSERT_EQ(0, called);
+    PASS();
+}
+
+TEST wrapper_with_4b5b_should_tx_and_rx_intact() {
+    spooky::Encoder<16, TX_RATE> enc;
+    spooky::Decoder<32, 0, Handler> dec;
+    enc.set_line_code(SPOOKY_LINE_4B5B);
+    dec.set_line_code(SPOOKY_LINE_4B5B);
+    const uint8_t msg[] = { 0xED, 0x05, 0x7a, 0x00, 0xff };
+    ASSERT_EQ(SPOOKY_ENCODER_ENQUEUE_OK, enc.enqueue(msg));
+    ASSERT_EQ(0, run_link(enc, dec));
+    ASSERT_EQ(1, called);
+    ASSERT_EQ(0, memcmp(msg, output_buf, sizeof(msg)));
+    PASS();
+}
+
+TEST wrapper_with_repeat_should_rx_each_copy() {
+    spooky::Encoder<16, TX_RATE> enc;
+    spooky::Decoder<32, 0, Handler> dec;
+    ASSERT_EQ(SPOOKY_ENCODER_INIT_ERROR_BAD_ARGUMENT, enc.set_repeat(0, 4));
+    ASSERT_EQ(SPOOKY_ENCODER_INIT_OK, enc.set_repeat(2, 4));
+    const uint8_t msg[] = { 0xED, 0x05 };
+    ASSERT_EQ(SPOOKY_ENCODER_ENQUEUE_OK, enc.enqueue(msg));
+    ASSERT_EQ(0, run_link(enc, dec));
+    ASSERT_EQ(SPOOKY_ENCODER_ENQUEUE_ERROR_FULL, enc.enqueue(msg));
+    called = 0;
+    ASSERT_EQ(0, run_link(enc, dec));
+    ASSERT_EQ(0, memcmp(msg, output_buf, sizeof(msg)));
+    PASS();
+}
+
+static int other_called = 0;
+
+struct OtherHandler {
+    static void frame(uint8_t *data, uint8_t size) {
+        (void)data;
+        (void)size;
+        other_called++;
+    }
+};
+
+TEST wrapper_should_call_each_decoders_own_handler() {
+    spooky::Encoder<16, TX_RATE> enc;
+    spooky::Decoder<32, TX_RATE * RATE_MUL, Handler> dec;
+    spooky::Decoder<16, 0, OtherHandler> other;
+    const uint8_t msg[] = { 0xED, 0x05 };
+    ASSERT_EQ(SPOOKY_ENCODER_ENQUEUE_OK, enc.enqueue(msg));
+    other_called = 0;
+    bool bit = false;
+    for (int timeout=0; timeout<10000 && !(called && other_called); timeout++) {
+        spooky_encoder_step_res esres = enc.step();
+        ASSERT(esres >= 0);
+        if (esres == SPOOKY_ENCODER_STEP_OK_LOW) {
+            bit = false;
+        } else if (esres == SPOOKY_ENCODER_STEP_OK_HIGH) {
+            bit = true;
+        }
+        for (int i=0; i<RATE_MUL; i++) {
+            if (!called) { ASSERT(dec.step(bit) >= 0); }
+            if (!other_called) { ASSERT(other.step(bit) >= 0); }
+        }
+    }
+    ASSERT_EQ(1, called);
+    ASSERT_EQ(1, other_called);
+    ASSERT_EQ(0, memcmp(msg, output_buf, sizeof(msg)));
+    PASS();
+}
+
+SUITE(wrapper) {
+    SET_SETUP(setup, NULL);
+    RUN_TEST(wrapper_should_tx_and_rx_intact);
+    RUN_TEST(wrapper_with_fixed_interval_should_rx_at_that_rate);
+    RUN_TEST(wrapper_with_fixed_interval_should_ignore_other_rates);
+    RUN_TEST(wrapper_with_address_should_ignore_other_nodes);
+    RUN_TEST(wrapper_with_4b5b_should_tx_and_rx_intact);
+    RUN_TEST(wrapper_with_repeat_should_rx_each_copy);
+    RUN_TEST(wrapper_should_call_each_decoders_own_handler);
+}
+
+/* Add all the definitions that need to be in the test runner's main file. */
+GREATEST_MAIN_DEFS();
+
+int main(int argc, char **argv) {
+    GREATEST_MAIN_BEGIN();      /* command-line arguments, initialization. */
+    RUN_SUITE(wrapper);
+    GREATEST_MAIN_END();        /* display results */
+}